@@ -0,0 +1,70 @@
+#include "dipp_client.h"
+
+int dipp_client_open(DippClient **client)
+{
+    *client = calloc(1, sizeof(DippClient));
+    if (!*client)
+        return -1;
+
+    if (attach_pq_mmap(&(*client)->pq, INGEST_QUEUE_FILE) != 0 ||
+        ingest_ring_attach(&(*client)->ring, INGEST_RING_FILE) != 0)
+    {
+        dipp_client_close(*client);
+        *client = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Fields a producer cannot know are reset, so DIPP treats the batch as new
+static void prepare_batch(ImageBatch *batch)
+{
+    batch->data = NULL;
+    batch->progress = -1;
+    batch->completed_nodes = 0;
+    batch->storage_mode = STORAGE_NOT_SET;
+    batch->enqueued_ms = 0;
+}
+
+// The ring keeps producers off the queue lock; only when DIPP falls behind far
+// enough to fill it does a producer take the lock and enqueue into the heap itself
+static int enqueue_one(DippClient *client, ImageBatch *batch)
+{
+    prepare_batch(batch);
+    if (ingest_ring_push(client->ring, batch) == 0)
+        return 0;
+    return priority_queue_mmap.enqueue(client->pq, *batch);
+}
+
+int dipp_client_enqueue(DippClient *client, ImageBatch *batch)
+{
+    ImageBatch item = *batch;
+    int res = enqueue_one(client, &item);
+    if (res == 0)
+        pq_notify(client->pq);
+    return res;
+}
+
+int dipp_client_enqueue_bulk(DippClient *client, ImageBatch *batches, size_t count)
+{
+    int enqueued = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (enqueue_one(client, &batches[i]) == 0)
+            enqueued++;
+    }
+    if (enqueued)
+        pq_notify(client->pq);
+    return enqueued;
+}
+
+void dipp_client_close(DippClient *client)
+{
+    if (client)
+    {
+        if (client->pq)
+            priority_queue_mmap.clean_up(client->pq);
+        ingest_ring_clean_up(client->ring);
+        free(client);
+    }
+}
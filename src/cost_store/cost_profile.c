@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <string.h>
+#include "cost_profile.h"
+
+void cost_profile_write_header(FILE *fp)
+{
+    fprintf(fp, "# dipp cost profile %d\n", COST_PROFILE_VERSION);
+}
+
+void cost_profile_write_record(FILE *fp, const CostProfileRecord *record)
+{
+    fprintf(fp, "profile %u %d %d %d %u %u %u %u %f\n",
+            record->seed,
+            record->fingerprint.num_images,
+            record->fingerprint.batch_size,
+            record->fingerprint.pipeline_id,
+            record->samples,
+            record->latency_mean,
+            record->latency_min,
+            record->latency_max,
+            record->energy_mean);
+}
+
+int cost_profile_import(CostStoreImpl *impl, CostStore *store, const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        printf("Could not open cost profile %s\n", path);
+        return -1;
+    }
+
+    char line[256];
+    int version = -1;
+    if (fgets(line, sizeof(line), fp) == NULL || sscanf(line, "# dipp cost profile %d", &version) != 1 || version != COST_PROFILE_VERSION)
+    {
+        printf("Unsupported cost profile %s (version %d)\n", path, version);
+        fclose(fp);
+        return -1;
+    }
+
+    int imported = 0;
+    int line_no = 1;
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        line_no++;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        CostKey key;
+        unsigned int size_bucket;
+        unsigned int images_bucket;
+        uint32_t latency;
+        float energy;
+        CostProfileRecord record;
+        if (sscanf(line, "profile %u %d %d %d %u %u %u %u %f",
+                   &record.seed,
+                   &record.fingerprint.num_images,
+                   &record.fingerprint.batch_size,
+                   &record.fingerprint.pipeline_id,
+                   &record.samples,
+                   &record.latency_mean,
+                   &record.latency_min,
+                   &record.latency_max,
+                   &record.energy_mean) == 9)
+        {
+            if (record.samples == 0)
+                continue;
+            // bucketed with the current resolution, like the executor keys batches
+            key = cost_store_key(record.seed, &record.fingerprint);
+            latency = record.latency_mean;
+            energy = record.energy_mean;
+        }
+        else if (sscanf(line, "entry %u %u %u %u %u %f", &key.seed, &key.hash, &size_bucket, &images_bucket, &latency, &energy) == 6 &&
+                 size_bucket <= UINT8_MAX && images_bucket <= UINT8_MAX)
+        {
+            key.size_bucket = size_bucket;
+            key.images_bucket = images_bucket;
+        }
+        else
+        {
+            printf("Skipping malformed line %d in cost profile %s\n", line_no, path);
+            continue;
+        }
+
+        uint32_t known_latency;
+        float known_energy;
+        if (impl->lookup(store, key.hash, &known_latency, &known_energy) != -1)
+            continue;
+
+        // profiles do not record the conditions they were measured under
+        impl->insert(store, &key, latency, energy, NULL);
+        imported++;
+    }
+
+    fclose(fp);
+    return imported;
+}
+
+int cost_profile_export(CostStore *store, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        printf("Could not create cost export %s\n", path);
+        return -1;
+    }
+
+    cost_profile_write_header(fp);
+    int exported = 0;
+    for (int i = 0; i < MAX_ENTRIES; i++)
+    {
+        // copy first, the entry may be replaced while we write
+        CostEntry entry = store->items[i];
+        if (!entry.valid)
+            continue;
+        fprintf(fp, "entry %u %u %u %u %u %f\n", entry.seed, entry.hash, entry.size_bucket, entry.images_bucket, entry.latency, entry.energy);
+        exported++;
+    }
+
+    if (fclose(fp) != 0)
+        return -1;
+    return exported;
+}
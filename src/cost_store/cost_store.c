@@ -1,8 +1,21 @@
 #include "cost_store.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+#include "crc32c.h"
+#include "murmur_hash.h"
+#include "dipp_cost_store_param.h"
 
 uint64_t global_time = 0;
+int cost_store_write_through = 0;
+
+// Sorted seeds of the configured module implementations, empty until configs are loaded
+static uint32_t *live_seeds = NULL;
+static size_t num_live_seeds = 0;
+static pthread_mutex_t live_seeds_lock = PTHREAD_MUTEX_INITIALIZER;
 
 CostStoreImpl *get_cost_store_impl(StorageMode storage_type)
 {
@@ -19,13 +32,42 @@ CostStoreImpl *get_cost_store_impl(StorageMode storage_type)
     }
 }
 
-// Find existing hash in the CostStore's statically allocated items
+// Checksum the fields that drive decisions. The LRU timestamp is left out,
+// so lookups can bump it without re-sealing the entry.
+static uint32_t cost_entry_checksum(const CostEntry *entry)
+{
+    uint32_t crc = 0;
+    crc = crc32c(crc, &entry->hash, sizeof(entry->hash));
+    crc = crc32c(crc, &entry->latency, sizeof(entry->latency));
+    crc = crc32c(crc, &entry->energy, sizeof(entry->energy));
+    crc = crc32c(crc, &entry->seed, sizeof(entry->seed));
+    crc = crc32c(crc, &entry->valid, sizeof(entry->valid));
+    crc = crc32c(crc, &entry->size_bucket, sizeof(entry->size_bucket));
+    crc = crc32c(crc, &entry->images_bucket, sizeof(entry->images_bucket));
+    crc = crc32c(crc, &entry->context, sizeof(entry->context));
+    return crc;
+}
+
+void cost_entry_seal(CostEntry *entry)
+{
+    entry->checksum = cost_entry_checksum(entry);
+}
+
+// Find existing hash in the CostStore's statically allocated items.
+// The matching entry is verified before use; a corrupt entry is invalidated
+// and reported as a miss so it gets re-measured.
 int find_entry(CostStore *store, uint32_t hash)
 {
     for (int i = 0; i < MAX_ENTRIES; ++i)
     {
         if (store->items[i].valid && store->items[i].hash == hash)
         {
+            if (store->items[i].checksum != cost_entry_checksum(&store->items[i]))
+            {
+                printf("Invalidating corrupt cost entry %d (checksum mismatch)\n", i);
+                store->items[i].valid = 0;
+                return -1;
+            }
             return i;
         }
     }
@@ -60,4 +102,190 @@ int cache_lookup(CostStore *store, uint32_t hash, uint32_t *latency, float *ener
         return idx;
     }
     return -1;
+}
+
+static int compare_seeds(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+void cost_store_set_live_seeds(const uint32_t *seeds, size_t count)
+{
+    uint32_t *sorted = NULL;
+    if (count)
+    {
+        sorted = malloc(count * sizeof(uint32_t));
+        if (sorted == NULL)
+            return; // keep the previous set, eviction just stays LRU-only
+        memcpy(sorted, seeds, count * sizeof(uint32_t));
+        qsort(sorted, count, sizeof(uint32_t), compare_seeds);
+    }
+
+    pthread_mutex_lock(&live_seeds_lock);
+    free(live_seeds);
+    live_seeds = sorted;
+    num_live_seeds = count;
+    pthread_mutex_unlock(&live_seeds_lock);
+}
+
+// Index of the first entry whose seed is no longer configured, or -1
+static int find_obsolete_index(CostStore *store)
+{
+    int index = -1;
+    pthread_mutex_lock(&live_seeds_lock);
+    for (int i = 0; num_live_seeds && i < MAX_ENTRIES; i++)
+    {
+        if (store->items[i].valid &&
+            bsearch(&store->items[i].seed, live_seeds, num_live_seeds, sizeof(uint32_t), compare_seeds) == NULL)
+        {
+            index = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&live_seeds_lock);
+    return index;
+}
+
+static void write_entry(CostEntry *entry, const CostKey *key, uint32_t latency, float energy, const ExecutionContext *context)
+{
+    entry->hash = key->hash;
+    entry->seed = key->seed;
+    entry->size_bucket = key->size_bucket;
+    entry->images_bucket = key->images_bucket;
+    entry->latency = latency;
+    entry->energy = energy;
+    if (context)
+    {
+        entry->context = *context;
+    }
+    else
+    {
+        memset(&entry->context, 0, sizeof(entry->context));
+        entry->context.temp_decic = EXEC_CONTEXT_TEMP_UNKNOWN;
+    }
+    entry->valid = 1;
+    entry->timestamp = global_time;
+    cost_entry_seal(entry);
+}
+
+// insert is shared by the backends, they differ only in how the written entry is persisted
+int cache_insert(CostStore *store, const CostKey *key, uint32_t latency, float energy, const ExecutionContext *context)
+{
+    global_time++;
+    int idx = find_entry(store, key->hash);
+    if (idx == -1)
+    {
+        for (int i = 0; i < MAX_ENTRIES; i++)
+        {
+            if (!store->items[i].valid)
+            {
+                idx = i;
+                break;
+            }
+        }
+    }
+    if (idx == -1)
+        idx = find_obsolete_index(store);
+    if (idx == -1)
+        idx = find_lru_index(store);
+
+    if (idx != -1)
+        write_entry(&store->items[idx], key, latency, energy, context);
+    return idx;
+}
+
+uint32_t cost_store_flush_interval_ms()
+{
+    uint32_t interval_ms = param_get_uint32(&cost_flush_interval_ms);
+    return interval_ms ? interval_ms : DEFAULT_COST_FLUSH_INTERVAL_MS;
+}
+
+static uint32_t buckets_per_octave()
+{
+    uint8_t buckets = param_get_uint8(&cost_buckets_per_octave);
+    if (buckets == 0)
+        return DEFAULT_COST_BUCKETS_PER_OCTAVE;
+    return buckets < MAX_COST_BUCKETS_PER_OCTAVE ? buckets : MAX_COST_BUCKETS_PER_OCTAVE;
+}
+
+// Log-scale bucket of a size: 0 for values up to 1, then per_octave buckets per doubling
+static uint8_t size_to_bucket(int value, uint32_t per_octave)
+{
+    if (value <= 1)
+        return 0;
+    return 1 + (uint8_t)(log2((double)value) * per_octave);
+}
+
+CostKey cost_store_bucket_key(uint32_t seed, uint8_t size_bucket, uint8_t images_bucket, int pipeline_id)
+{
+    CostKey key;
+    key.seed = seed;
+    key.size_bucket = size_bucket;
+    key.images_bucket = images_bucket;
+
+    ImageBatchFingerprint bucketed = {
+        .num_images = images_bucket,
+        .batch_size = size_bucket,
+        .pipeline_id = pipeline_id,
+    };
+    key.hash = murmur3_32((const uint8_t *)&bucketed, sizeof(bucketed), seed);
+    return key;
+}
+
+CostKey cost_store_key(uint32_t seed, const ImageBatchFingerprint *fingerprint)
+{
+    uint32_t per_octave = buckets_per_octave();
+    return cost_store_bucket_key(seed, size_to_bucket(fingerprint->batch_size, per_octave),
+                                 size_to_bucket(fingerprint->num_images, per_octave), fingerprint->pipeline_id);
+}
+
+CostKey cost_store_batch_key(uint32_t seed, const ImageBatch *batch)
+{
+    ImageBatchFingerprint fingerprint = {
+        .num_images = batch->num_images,
+        .batch_size = batch->batch_size,
+        .pipeline_id = batch->pipeline_id,
+    };
+    return cost_store_key(seed, &fingerprint);
+}
+
+int cost_store_estimate(CostStore *store, const CostKey *key, const ExecutionContext *current, uint32_t *latency, float *energy)
+{
+    int max_distance = COST_ESTIMATE_MAX_OCTAVES * buckets_per_octave();
+    const CostEntry *lower = NULL;
+    const CostEntry *upper = NULL;
+    for (int i = 0; i < MAX_ENTRIES; i++)
+    {
+        const CostEntry *entry = &store->items[i];
+        if (!entry->valid || entry->seed != key->seed || entry->images_bucket != key->images_bucket ||
+            entry->checksum != cost_entry_checksum(entry))
+            continue;
+
+        int distance = (int)entry->size_bucket - (int)key->size_bucket;
+        if (distance < 0 && -distance <= max_distance && (lower == NULL || entry->size_bucket > lower->size_bucket))
+            lower = entry;
+        else if (distance > 0 && distance <= max_distance && (upper == NULL || entry->size_bucket < upper->size_bucket))
+            upper = entry;
+    }
+
+    if (lower && upper)
+    {
+        // linear in the bucket index, i.e. in log(batch_size)
+        float t = (float)(key->size_bucket - lower->size_bucket) / (float)(upper->size_bucket - lower->size_bucket);
+        float lower_latency = exec_context_scale_latency(lower->latency, &lower->context, current);
+        float upper_latency = exec_context_scale_latency(upper->latency, &upper->context, current);
+        *latency = (uint32_t)(lower_latency + t * (upper_latency - lower_latency));
+        *energy = lower->energy + t * (upper->energy - lower->energy);
+        return 1;
+    }
+
+    // only one side is known: take the nearest neighbour as is
+    const CostEntry *nearest = lower ? lower : upper;
+    if (nearest == NULL)
+        return 0;
+    *latency = exec_context_scale_latency(nearest->latency, &nearest->context, current);
+    *energy = nearest->energy;
+    return 1;
 }
\ No newline at end of file
@@ -44,44 +44,10 @@ int cost_store_init_mem(CostStore **store, char *filename)
     return 0;
 }
 
-// mem-specific insert (same behavior as previous cache_insert)
-void insert_mem(CostStore *store, uint32_t hash, uint32_t latency, float energy)
+// mem-specific insert: nothing to persist
+void insert_mem(CostStore *store, const CostKey *key, uint32_t latency, float energy, const ExecutionContext *context)
 {
-    global_time++;
-    int idx = find_entry(store, hash);
-    if (idx != -1)
-    {
-        store->items[idx].latency = latency;
-        store->items[idx].energy = energy;
-        store->items[idx].timestamp = global_time;
-        // printf("Updated existing entry.\n");
-        return;
-    }
-
-    for (int i = 0; i < MAX_ENTRIES; i++)
-    {
-        if (!store->items[i].valid)
-        {
-            store->items[i].hash = hash;
-            store->items[i].latency = latency;
-            store->items[i].energy = energy;
-            store->items[i].valid = 1;
-            store->items[i].timestamp = global_time;
-            // printf("Inserted into free slot.\n");
-            return;
-        }
-    }
-
-    int evict = find_lru_index(store);
-    if (evict != -1)
-    {
-        store->items[evict].hash = hash;
-        store->items[evict].latency = latency;
-        store->items[evict].energy = energy;
-        store->items[evict].valid = 1;
-        store->items[evict].timestamp = global_time;
-        // printf("Evicted LRU and inserted.\n");
-    }
+    cache_insert(store, key, latency, energy, context);
 }
 
 // mem clean up: free allocated outer CostStore
@@ -1,19 +1,168 @@
 #include <fcntl.h>
 #include <unistd.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
 #include "cost_store.h"
+#include "utils/minitrace.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
-// mmap the file into memory and point the caller's pointer to the mapped region.
-// If file doesn't exist, create it, ftruncate to size and zero the contents before using.
+// File-backed CostStore with write-behind persistence. The table lives in memory;
+// inserts only mark their record dirty and a background flusher writes the dirty
+// records to the cache file every flush interval and once more on clean shutdown.
+// Cost entries are advisory, so samples from the last interval may be lost on a crash.
+#define RECORD_OFFSET(index) ((off_t)COST_STORE_HEADER_SIZE + (off_t)(index) * sizeof(CostEntry))
+
+static int cache_fd = -1;
+static CostStore *file_store = NULL; // the store whose records cache_fd holds
+static uint8_t dirty[MAX_ENTRIES];
+static int num_dirty = 0;
+
+// guards the table and the dirty set between the executor and the flusher
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t flusher_handle;
+static int flusher_running = 0;
+
+// Write the dirty records and make them durable. Records are copied out under the lock
+// and written without it, so a flash stall never blocks an insert.
+static void flush_dirty()
+{
+    CostEntry records[MAX_ENTRIES];
+    int indices[MAX_ENTRIES];
+    int count = 0;
+
+    pthread_mutex_lock(&store_lock);
+    if (num_dirty == 0 || file_store == NULL)
+    {
+        pthread_mutex_unlock(&store_lock);
+        return;
+    }
+    for (int i = 0; i < MAX_ENTRIES; i++)
+    {
+        if (dirty[i])
+        {
+            records[count] = file_store->items[i];
+            indices[count++] = i;
+            dirty[i] = 0;
+        }
+    }
+    num_dirty = 0;
+    pthread_mutex_unlock(&store_lock);
+
+    MTR_BEGIN_FUNC();
+    for (int i = 0; i < count; i++)
+    {
+        if (pwrite(cache_fd, &records[i], sizeof(CostEntry), RECORD_OFFSET(indices[i])) != sizeof(CostEntry))
+        {
+            printf("Error writing cost entry %d (%s)\n", indices[i], strerror(errno));
+        }
+    }
+    fdatasync(cache_fd);
+    MTR_COUNTER(__FILE__, "cost_entries_flushed", count);
+    MTR_END_FUNC();
+}
+
+static void *flusher_task(void *param)
+{
+    (void)param;
+    pthread_mutex_lock(&store_lock);
+    while (flusher_running)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint32_t interval_ms = cost_store_flush_interval_ms();
+        deadline.tv_sec += interval_ms / 1000;
+        deadline.tv_nsec += (long)(interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&flusher_cond, &store_lock, &deadline);
+
+        pthread_mutex_unlock(&store_lock);
+        flush_dirty();
+        pthread_mutex_lock(&store_lock);
+    }
+    pthread_mutex_unlock(&store_lock);
+    return NULL;
+}
+
+static void stop_flusher()
+{
+    pthread_mutex_lock(&store_lock);
+    int running = flusher_running;
+    flusher_running = 0;
+    pthread_cond_signal(&flusher_cond);
+    pthread_mutex_unlock(&store_lock);
+
+    if (running)
+        pthread_join(flusher_handle, NULL);
+}
+
+// exit() is the clean shutdown path (e.g. the SIGINT handler), flush what is pending
+static pid_t exit_hook_pid;
+
+static void flush_at_exit()
+{
+    // a forked child holds a stale copy of the table and maybe a lock taken by the flusher
+    if (getpid() != exit_hook_pid)
+        return;
+    stop_flusher();
+    flush_dirty();
+}
+
+static int write_file_header(int fd)
+{
+    uint8_t page[COST_STORE_HEADER_SIZE];
+    memset(page, 0, sizeof(page));
+    CostStoreFileHeader *header = (CostStoreFileHeader *)page;
+    header->magic = COST_STORE_FILE_MAGIC;
+    header->version = COST_STORE_FILE_VERSION;
+    header->header_size = COST_STORE_HEADER_SIZE;
+    header->entry_size = sizeof(CostEntry);
+    header->capacity = MAX_ENTRIES;
+    return pwrite(fd, page, sizeof(page), 0) == sizeof(page) ? 0 : -1;
+}
+
+// Load the records of the cache file into store. Returns the number of records that
+// have to be rewritten, i.e. all of them when the file was missing or in another format.
+static int load_cache_file(int fd, CostStore *store)
+{
+    struct stat st;
+    CostStoreFileHeader header;
+    memset(&header, 0, sizeof(header));
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(header))
+        pread(fd, &header, sizeof(header), 0);
+
+    if (header.magic == COST_STORE_FILE_MAGIC && header.version == COST_STORE_FILE_VERSION &&
+        header.entry_size == sizeof(CostEntry))
+    {
+        size_t count = header.capacity < MAX_ENTRIES ? header.capacity : MAX_ENTRIES;
+        ssize_t res = pread(fd, store->items, count * sizeof(CostEntry), header.header_size);
+        if (res < 0)
+            res = 0;
+        // a short file leaves the remaining entries zeroed, i.e. invalid
+        return (size_t)res == MAX_ENTRIES * sizeof(CostEntry) ? 0 : MAX_ENTRIES;
+    }
+
+    if (st.st_size > 0)
+    {
+        // includes raw tables of earlier builds, whose keys predate module build ids
+        printf("Discarding cost cache in an incompatible format (version %u)\n", header.version);
+    }
+    return MAX_ENTRIES;
+}
+
+// Open the cache file and load it into a freshly allocated in-memory store.
+// Unless writes go through, a background thread persists later changes.
 int cost_store_init_mmap(CostStore **store, char *filename)
 {
     const char *file = filename ? filename : CACHE_FILE;
-    size_t cache_size = sizeof(CostStore);
-    struct stat st;
 
     if (store == NULL)
     {
@@ -21,9 +170,6 @@ int cost_store_init_mmap(CostStore **store, char *filename)
         return -1;
     }
 
-    // Check if file exists
-    int exists = (stat(file, &st) == 0);
-
     int fd = open(file, O_RDWR | O_CREAT, 0644);
     if (fd < 0)
     {
@@ -31,104 +177,115 @@ int cost_store_init_mmap(CostStore **store, char *filename)
         return -1;
     }
 
-    // Ensure file is large enough
-    if (ftruncate(fd, (off_t)cache_size) == -1)
+    CostStore *loaded = calloc(1, sizeof(CostStore));
+    if (loaded == NULL)
     {
-        printf("Error resizing cache file: %s (%s)\n", file, strerror(errno));
+        printf("Error allocating memory for CostStore\n");
         close(fd);
         return -1;
     }
 
-    // Memory map the file (map whole CostStore). Keep the mapping live — we will work on it directly.
-    void *mapped = mmap(NULL, cache_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (mapped == MAP_FAILED)
+    if (load_cache_file(fd, loaded) != 0)
     {
-        printf("Error mapping cache file: %s (%s)\n", file, strerror(errno));
-        close(fd);
-        return -1;
+        // rewrite the whole file in the current format
+        if (ftruncate(fd, 0) == -1 || ftruncate(fd, RECORD_OFFSET(MAX_ENTRIES)) == -1 ||
+            write_file_header(fd) != 0 ||
+            pwrite(fd, loaded->items, sizeof(loaded->items), COST_STORE_HEADER_SIZE) != sizeof(loaded->items))
+        {
+            printf("Error writing cache file: %s (%s)\n", file, strerror(errno));
+            free(loaded);
+            close(fd);
+            return -1;
+        }
+        fdatasync(fd);
     }
 
-    // If the file was newly created (didn't exist), zero the contents so the file holds zeros
-    if (!exists)
+    // Recalculate max timestamp to continue LRU order
+    for (int i = 0; i < MAX_ENTRIES; i++)
     {
-        memset(mapped, 0, cache_size);
-        // persist zeros
-        msync(mapped, cache_size, MS_SYNC);
+        if (loaded->items[i].valid && loaded->items[i].timestamp > global_time)
+        {
+            global_time = loaded->items[i].timestamp;
+        }
     }
 
-    // Set the caller's pointer to the mapped (persisted) memory; operate on it directly thereafter.
-    *store = (CostStore *)mapped;
+    pthread_mutex_lock(&store_lock);
+    cache_fd = fd;
+    file_store = loaded;
+    memset(dirty, 0, sizeof(dirty));
+    num_dirty = 0;
+    pthread_mutex_unlock(&store_lock);
 
-    // Recalculate max timestamp to continue LRU order
-    for (int i = 0; i < MAX_ENTRIES; i++)
+    if (!cost_store_write_through && !flusher_running)
     {
-        if ((*store)->items[i].valid && (*store)->items[i].timestamp > global_time)
+        flusher_running = 1;
+        if (pthread_create(&flusher_handle, NULL, &flusher_task, NULL) != 0)
         {
-            global_time = (*store)->items[i].timestamp;
+            printf("Failed to start cost store flusher, writing through\n");
+            flusher_running = 0;
+            cost_store_write_through = 1;
         }
     }
 
-    // Keep mapping alive; close FD (mapping remains valid)
-    close(fd);
+    static int exit_hook_registered = 0;
+    if (!exit_hook_registered)
+    {
+        exit_hook_pid = getpid();
+        atexit(flush_at_exit);
+        exit_hook_registered = 1;
+    }
+
+    *store = loaded;
     return 0;
 }
 
-// mmap-specific insert: same as mem but persist to disk
-void insert_mmap(CostStore *store, uint32_t hash, uint32_t latency, float energy)
+// file-specific insert: update the table and mark the record for the flusher
+void insert_mmap(CostStore *store, const CostKey *key, uint32_t latency, float energy, const ExecutionContext *context)
 {
-    global_time++;
-    int idx = find_entry(store, hash);
-    if (idx != -1)
+    pthread_mutex_lock(&store_lock);
+    int idx = cache_insert(store, key, latency, energy, context);
+    if (idx != -1 && store == file_store && !dirty[idx])
     {
-        store->items[idx].latency = latency;
-        store->items[idx].energy = energy;
-        store->items[idx].timestamp = global_time;
-        // persist change
-        msync(store, sizeof(CostStore), MS_SYNC);
-        // printf("Updated existing entry (mmap, synced).\n");
-        return;
+        dirty[idx] = 1;
+        num_dirty++;
     }
+    pthread_mutex_unlock(&store_lock);
 
-    for (int i = 0; i < MAX_ENTRIES; i++)
-    {
-        if (!store->items[i].valid)
-        {
-            store->items[i].hash = hash;
-            store->items[i].latency = latency;
-            store->items[i].energy = energy;
-            store->items[i].valid = 1;
-            store->items[i].timestamp = global_time;
-            msync(store, sizeof(CostStore), MS_SYNC);
-            // printf("Inserted into free slot (mmap, synced).\n");
-            return;
-        }
-    }
+    if (cost_store_write_through)
+        flush_dirty();
+}
 
-    int evict = find_lru_index(store);
-    if (evict != -1)
-    {
-        store->items[evict].hash = hash;
-        store->items[evict].latency = latency;
-        store->items[evict].energy = energy;
-        store->items[evict].valid = 1;
-        store->items[evict].timestamp = global_time;
-        msync(store, sizeof(CostStore), MS_SYNC);
-        // printf("Evicted LRU and inserted (mmap, synced).\n");
-    }
+// lookup bumps the LRU timestamp, so it takes the lock the flusher copies records under
+int lookup_mmap(CostStore *store, uint32_t hash, uint32_t *latency, float *energy)
+{
+    pthread_mutex_lock(&store_lock);
+    int idx = cache_lookup(store, hash, latency, energy);
+    pthread_mutex_unlock(&store_lock);
+    return idx;
 }
 
-// mmap clean up: unmap the mapped CostStore
+// file clean up: stop the flusher, persist pending records and release the store
 int clean_up_mmap(CostStore *store)
 {
-    if (store)
+    stop_flusher();
+    flush_dirty();
+
+    pthread_mutex_lock(&store_lock);
+    if (store == file_store)
     {
-        munmap(store, sizeof(CostStore));
+        file_store = NULL;
+        if (cache_fd != -1)
+            close(cache_fd);
+        cache_fd = -1;
     }
+    pthread_mutex_unlock(&store_lock);
+
+    free(store);
     return 0;
 }
 
 CostStoreImpl cost_store_mmap = {
     .init = cost_store_init_mmap,
     .insert = insert_mmap,
-    .lookup = cache_lookup,
-    .clean_up = clean_up_mmap};
\ No newline at end of file
+    .lookup = lookup_mmap,
+    .clean_up = clean_up_mmap};
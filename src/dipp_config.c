@@ -1,4 +1,3 @@
-#include <dlfcn.h>
 #include <stdio.h>
 #include <string.h>
 #include <param/param.h>
@@ -11,12 +10,100 @@
 #include "module_config.pb-c.h"
 #include "pipeline_config.pb-c.h"
 #include "murmur_hash.h"
+#include "crc32c.h"
+#include "module_registry.h"
+#include "module_params.h"
 #include "utils/minitrace.h"
 
-Pipeline pipelines[MAX_PIPELINES];
-ModuleParameterList module_parameter_lists[MAX_MODULES];
+// Registries indexed by pipeline id - 1 and module config id - 1. They start with the
+// entries of the config params and grow as the config index adds entries.
+Pipeline *pipelines = NULL;
+size_t num_pipelines = 0;
+ModuleParameterList *module_parameter_lists = NULL;
+size_t num_module_configs = 0;
+
+// Where a registry entry was last parsed from
+typedef struct ConfigEntryState
+{
+    // CRC32C of the param slot (or index entry) the entry was parsed from. A config set
+    // again with the same content or blob reference is not decoded and parsed again.
+    uint32_t source;
+    uint8_t indexed; // entry comes from the config index
+} ConfigEntryState;
+
+static ConfigEntryState *pipeline_states = NULL;
+static ConfigEntryState *module_states = NULL;
 
 static int is_setup = 0;
+static uint32_t setup_generation = 0;
+
+// Entries whose param changed since they were last loaded, one bit per pipeline/module
+// config. Set by the param callbacks and applied by setup_cache_if_needed.
+static uint32_t pending_pipelines = 0;
+static uint32_t pending_modules = 0;
+// Entries to reload even if their param still holds what they were parsed from,
+// e.g. to retry loading a module binary
+static uint32_t forced_pipelines = 0;
+static uint32_t forced_modules = 0;
+// Same for the config index, which reloads its entries that changed. A forced index
+// reloads all of its entries, forced_indexed_pipelines only the marked ones, one bit per
+// pipeline id - 1.
+static uint32_t pending_index = 0;
+static uint32_t forced_index = 0;
+static uint64_t forced_indexed_pipelines = 0;
+static uint32_t index_source = 0;
+_Static_assert(MAX_PIPELINE_ID <= 64, "forced_indexed_pipelines has one bit per pipeline id");
+
+// Grow the pipeline registry to count entries, new entries are empty
+static int ensure_pipelines(size_t count)
+{
+    if (count <= num_pipelines)
+        return 0;
+    Pipeline *grown = realloc(pipelines, count * sizeof(Pipeline));
+    if (grown)
+        pipelines = grown;
+    ConfigEntryState *grown_states = realloc(pipeline_states, count * sizeof(ConfigEntryState));
+    if (grown_states)
+        pipeline_states = grown_states;
+    if (!grown || !grown_states)
+    {
+        set_error_param(MEMORY_MALLOC);
+        return -1;
+    }
+    memset(&pipelines[num_pipelines], 0, (count - num_pipelines) * sizeof(Pipeline));
+    memset(&pipeline_states[num_pipelines], 0, (count - num_pipelines) * sizeof(ConfigEntryState));
+    num_pipelines = count;
+    return 0;
+}
+
+// Grow the module config registry to count entries, new entries are empty configs
+static int ensure_module_configs(size_t count)
+{
+    if (count <= num_module_configs)
+        return 0;
+    ModuleParameterList *grown = realloc(module_parameter_lists, count * sizeof(ModuleParameterList));
+    if (grown)
+        module_parameter_lists = grown;
+    ConfigEntryState *grown_states = realloc(module_states, count * sizeof(ConfigEntryState));
+    if (grown_states)
+        module_states = grown_states;
+    if (!grown || !grown_states)
+    {
+        set_error_param(MEMORY_MALLOC);
+        return -1;
+    }
+    memset(&module_parameter_lists[num_module_configs], 0, (count - num_module_configs) * sizeof(ModuleParameterList));
+    memset(&module_states[num_module_configs], 0, (count - num_module_configs) * sizeof(ConfigEntryState));
+    num_module_configs = count;
+    return 0;
+}
+
+Pipeline *get_pipeline(int pipeline_id)
+{
+    if (pipeline_id < 1 || (size_t)pipeline_id > num_pipelines || pipelines[pipeline_id - 1].pipeline_id != pipeline_id)
+        return NULL;
+    return &pipelines[pipeline_id - 1];
+}
 
 int is_buffer_empty(uint8_t *buffer, size_t size)
 {
@@ -30,71 +117,215 @@ int is_buffer_empty(uint8_t *buffer, size_t size)
     return 1; // Buffer contains only 0 values
 }
 
-size_t get_param_buffer(uint8_t **out, param_t *param)
+// Streaming Brotli decode of length compressed bytes, taken from data, or from the
+// configs vmem at offset when data is NULL. The input is read chunk by chunk, so a blob
+// is never held in memory compressed; crc receives the CRC32C of the bytes read.
+static int decode_config(const uint8_t *data, uint32_t offset, uint32_t length, uint8_t **out, size_t *size, uint32_t *crc)
 {
-    uint8_t buf[DATA_PARAM_SIZE];
-    param_get_data(param, buf, DATA_PARAM_SIZE);
+    BrotliDecoderState *state = BrotliDecoderCreateInstance(NULL, NULL, NULL);
+    size_t capacity = CONFIG_BLOB_CHUNK;
+    uint8_t *decoded = malloc(capacity);
+    if (!state || !decoded)
+    {
+        set_error_param(MEMORY_MALLOC);
+        BrotliDecoderDestroyInstance(state);
+        free(decoded);
+        return -1;
+    }
 
-    if (is_buffer_empty(buf, DATA_PARAM_SIZE))
-        return 0;
+    uint8_t chunk[CONFIG_BLOB_CHUNK];
+    size_t decoded_size = 0;
+    uint32_t consumed = 0;
+    *crc = 0;
+    BrotliDecoderResult result = BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT;
+    while (result == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT && consumed < length)
+    {
+        uint32_t len = length - consumed < CONFIG_BLOB_CHUNK ? length - consumed : CONFIG_BLOB_CHUNK;
+        if (data)
+            memcpy(chunk, data + consumed, len);
+        else
+            vmem_configs.read(&vmem_configs, offset + consumed, chunk, len);
+        *crc = crc32c(*crc, chunk, len);
+        consumed += len;
+
+        size_t avail_in = len;
+        const uint8_t *next_in = chunk;
+        do
+        {
+            if (decoded_size == capacity)
+            {
+                uint8_t *grown = capacity < CONFIG_MAX_DECODED_SIZE ? realloc(decoded, capacity * 2) : NULL;
+                if (!grown)
+                {
+                    result = BROTLI_DECODER_RESULT_ERROR;
+                    break;
+                }
+                decoded = grown;
+                capacity *= 2;
+            }
+            size_t avail_out = capacity - decoded_size;
+            uint8_t *next_out = decoded + decoded_size;
+            result = BrotliDecoderDecompressStream(state, &avail_in, &next_in, &avail_out, &next_out, NULL);
+            decoded_size = next_out - decoded;
+        } while (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+    }
+    BrotliDecoderDestroyInstance(state);
 
-    size_t decoded_size = DATA_PARAM_SIZE;
-    uint8_t decoded_buffer[decoded_size];
-    if (BrotliDecoderDecompress((size_t)buf[0], buf + 1, &decoded_size, decoded_buffer) != BROTLI_DECODER_RESULT_SUCCESS)
+    // the stream has to end exactly at the end of the input
+    if (result != BROTLI_DECODER_RESULT_SUCCESS || consumed != length)
     {
         set_error_param(INTERNAL_BROTLI_DECODE);
-        return 0;
+        free(decoded);
+        return -1;
     }
 
-    *out = malloc(decoded_size * sizeof(uint8_t));
-    if (!*out)
-    {
-        set_error_param(MEMORY_MALLOC);
+    *out = decoded;
+    *size = decoded_size;
+    return 0;
+}
+
+// Decode the config held by a param slot, inline or as a reference to a blob. An empty
+// slot yields an empty config. Returns -1 if the config cannot be decoded.
+static int get_param_buffer(const uint8_t *slot, uint8_t **out, size_t *size)
+{
+    *out = NULL;
+    *size = 0;
+    if (is_buffer_empty((uint8_t *)slot, DATA_PARAM_SIZE))
         return 0;
-    }
 
-    // Copy the data from the original buffer to the new buffer
-    for (size_t i = 0; i < decoded_size; i++)
+    uint32_t crc;
+    if (slot[0] != CONFIG_BLOB_MARKER)
     {
-        (*out)[i] = decoded_buffer[i];
+        if (slot[0] > DATA_PARAM_SIZE - 1)
+        {
+            set_error_param(INTERNAL_BROTLI_DECODE);
+            return -1;
+        }
+        return decode_config(slot + 1, 0, slot[0], out, size, &crc);
     }
 
-    return decoded_size;
+    ConfigBlobRef ref;
+    memcpy(&ref, slot, sizeof(ref));
+    if (ref.length == 0 || ref.offset > CONFIG_BLOB_VMEM_SIZE || ref.length > CONFIG_BLOB_VMEM_SIZE - ref.offset)
+    {
+        printf("Config blob at %u (%u bytes) lies outside the configs vmem\n", ref.offset, ref.length);
+        set_error_param(INTERNAL_BROTLI_DECODE);
+        return -1;
+    }
+    if (decode_config(NULL, ref.offset, ref.length, out, size, &crc) != 0)
+        return -1;
+    if (crc != ref.crc)
+    {
+        // the blob was not (completely) uploaded before its reference was set
+        printf("Config blob at %u does not match its checksum\n", ref.offset);
+        set_error_param(INTERNAL_CHECKSUM_MISMATCH);
+        free(*out);
+        *out = NULL;
+        return -1;
+    }
+    return 0;
 }
 
-// Function to load a module and parameter from a configuration file
-void *load_module(char *moduleName)
+// Release what a module config entry owns
+static void free_module_parameters(ModuleParameterList *list)
 {
-    char filename[256]; // Adjust the buffer size as needed
-    snprintf(filename, sizeof(filename), "/usr/share/pipeline/%s.so", moduleName);
-
-    printf("Loading module from %s\r\n", filename);
+    free(list->parameters);
+    list->parameters = NULL;
+    list->n_parameters = 0;
+    list->key_index = NULL;
+    list->n_key_index = 0;
+}
 
-    // Load the external library dynamically
-    void *handle = dlopen(filename, RTLD_LAZY);
-    if (handle == NULL)
+// Compile an unpacked config into the table modules read: the parameter pointers, the
+// parameters, the key index and the string values are laid out in one allocation, and
+// keys point at their interned copy, so lookups by key id are a single index.
+static int compile_module_parameters(ModuleParameterList *list, ModuleConfig *mcon)
+{
+    size_t n = mcon->n_parameters;
+    int max_key_id = -1;
+    size_t strings_size = 0;
+    for (size_t i = 0; i < n; i++)
     {
-        printf("Error loading module: %s\r\n", dlerror());
-        set_error_param(INTERNAL_SO_NOT_FOUND);
-        return NULL;
+        int key_id = module_param_key(mcon->parameters[i]->key);
+        if (key_id < 0)
+        {
+            printf("Too many distinct module parameter keys, cannot add %s\n", mcon->parameters[i]->key);
+            return -1;
+        }
+        if (key_id > max_key_id)
+            max_key_id = key_id;
+        if (mcon->parameters[i]->value_case == CONFIG_PARAMETER__VALUE_STRING_VALUE)
+            strings_size += strlen(mcon->parameters[i]->string_value) + 1;
     }
 
-    // Get a function pointer to the external function
-    void *functionPointer = dlsym(handle, "run");
-    if (functionPointer == NULL)
+    size_t n_key_index = max_key_id + 1;
+    uint8_t *arena = malloc(n * (sizeof(ModuleParameter *) + sizeof(ModuleParameter)) +
+                            n_key_index * sizeof(uint16_t) + strings_size + 1);
+    if (!arena)
+        return -1;
+
+    ModuleParameter **slots = (ModuleParameter **)arena;
+    ModuleParameter *parameters = (ModuleParameter *)(slots + n);
+    uint16_t *key_index = (uint16_t *)(parameters + n);
+    char *strings = (char *)(key_index + n_key_index);
+    for (size_t k = 0; k < n_key_index; k++)
+        key_index[k] = PARAM_SLOT_NONE;
+
+    for (size_t i = 0; i < n; i++)
     {
-        set_error_param(INTERNAL_RUN_NOT_FOUND);
-        dlclose(handle);
-        return NULL;
+        ConfigParameter *cparam = mcon->parameters[i];
+        ModuleParameter *parameter = &parameters[i];
+        int key_id = module_param_key(cparam->key); // interned by the first pass
+        slots[i] = parameter;
+        parameter->key = (char *)module_param_key_name(key_id);
+        parameter->value_case = cparam->value_case;
+        // the first occurrence of a key wins, as with a linear search
+        if (key_index[key_id] == PARAM_SLOT_NONE)
+            key_index[key_id] = i;
+
+        switch (cparam->value_case)
+        {
+        case CONFIG_PARAMETER__VALUE_BOOL_VALUE:
+            parameter->bool_value = cparam->bool_value;
+            break;
+        case CONFIG_PARAMETER__VALUE_INT_VALUE:
+            parameter->int_value = cparam->int_value;
+            break;
+        case CONFIG_PARAMETER__VALUE_FLOAT_VALUE:
+            parameter->float_value = cparam->float_value;
+            break;
+        case CONFIG_PARAMETER__VALUE_STRING_VALUE:
+        {
+            size_t len = strlen(cparam->string_value) + 1;
+            memcpy(strings, cparam->string_value, len);
+            parameter->string_value = strings;
+            strings += len;
+            break;
+        }
+        default:
+            break;
+        }
     }
 
-    return functionPointer;
+    list->n_parameters = n;
+    list->parameters = slots;
+    list->key_index = key_index;
+    list->n_key_index = n_key_index;
+    return 0;
 }
 
-void setup_pipeline(param_t *param, int index)
+// Rebuild one pipeline from its param. Modules come from the module registry, so a
+// binary already loaded for this or another pipeline is not loaded again.
+static void load_pipeline(int pipeline_idx, const uint8_t *slot, int forced)
 {
+    uint32_t source = crc32c(0, slot, DATA_PARAM_SIZE);
+    if (!forced && source == pipeline_states[pipeline_idx].source)
+        return; // unchanged, keep the parsed pipeline
+
     uint8_t *buffer = NULL;
-    size_t buf_size = get_param_buffer(&buffer, param);
+    size_t buf_size = 0;
+    if (get_param_buffer(slot, &buffer, &buf_size) != 0)
+        return; // keep the previous pipeline
 
     PipelineDefinition *pdef = pipeline_definition__unpack(NULL, buf_size, buffer);
     free(buffer);
@@ -104,9 +335,10 @@ void setup_pipeline(param_t *param, int index)
     {
         return; // Skip this pipeline if unpacking fails
     }
+    pipeline_states[pipeline_idx].source = source;
 
     // print the pipeline definition for debugging
-    printf("Pipeline Definition: ID=%d, Num Modules=%zu\n", param->id - PIPELINE_PARAMID_OFFSET, pdef->n_modules);
+    printf("Pipeline Definition: ID=%d, Num Modules=%zu\n", pipeline_idx, pdef->n_modules);
     for (size_t i = 0; i < pdef->n_modules; i++)
     {
         ModuleDefinition *mdef = pdef->modules[i];
@@ -118,58 +350,127 @@ void setup_pipeline(param_t *param, int index)
         }
     }
 
-    int pipeline_id = param->id - PIPELINE_PARAMID_OFFSET;
+    int pipeline_id = pipeline_idx;
+    size_t num_modules = pdef->n_modules < MAX_MODULES ? pdef->n_modules : MAX_MODULES;
     pipelines[pipeline_id].pipeline_id = pipeline_id + 1;
-    pipelines[pipeline_id].num_modules = pdef->n_modules;
 
-    printf("Setting up pipeline ID %d with %zu modules\r\n", pipeline_id + 1, pdef->n_modules);
+    printf("Setting up pipeline ID %d with %zu modules\r\n", pipeline_id + 1, num_modules);
 
-    for (size_t module_idx = 0; module_idx < pdef->n_modules; module_idx++)
+    // drop modules past the new end
+    for (size_t module_idx = num_modules; module_idx < pipelines[pipeline_id].num_modules; module_idx++)
     {
-        ModuleDefinition *mdef = pdef->modules[module_idx];
+        free(pipelines[pipeline_id].modules[module_idx].module_name);
+        module_registry_release(pipelines[pipeline_id].modules[module_idx].loaded);
+        memset(&pipelines[pipeline_id].modules[module_idx], 0, sizeof(Module));
+    }
+    pipelines[pipeline_id].num_modules = num_modules;
 
-        pipelines[pipeline_id].modules[module_idx].module_name = strdup(mdef->name);
-        pipelines[pipeline_id].modules[module_idx].module_function = load_module(mdef->name);
+    for (size_t module_idx = 0; module_idx < num_modules; module_idx++)
+    {
+        ModuleDefinition *mdef = pdef->modules[module_idx];
+        Module *module = &pipelines[pipeline_id].modules[module_idx];
+
+        // acquire before releasing, so a module that stays is not unloaded in between;
+        // a binary replaced on disk is picked up here
+        LoadedModule *loaded = module_registry_acquire(mdef->name);
+        module_registry_release(module->loaded);
+        free(module->module_name);
+        module->module_name = strdup(mdef->name);
+        module->loaded = loaded;
+        module->module_function = loaded ? loaded->run : NULL;
+        module->build_id = loaded ? loaded->build_id : 0;
 
         // set the default param id (not available == -1)
-        pipelines[pipeline_id].modules[module_idx].default_effort_param_id = -1;
-        pipelines[pipeline_id].modules[module_idx].low_effort_param_id = -1;
-        pipelines[pipeline_id].modules[module_idx].medium_effort_param_id = -1;
-        pipelines[pipeline_id].modules[module_idx].high_effort_param_id = -1;
+        module->default_effort_param_id = -1;
+        module->low_effort_param_id = -1;
+        module->medium_effort_param_id = -1;
+        module->high_effort_param_id = -1;
 
         // Set the param ids for available implementations
         for (size_t impl_idx = 0; impl_idx < mdef->n_implementations; impl_idx++)
         {
             Implementation *impl = mdef->implementations[impl_idx];
+            // the config registry covers every config a pipeline refers to
+            if (impl->param_id < 1 || impl->param_id > MAX_MODULE_CONFIG_ID || ensure_module_configs(impl->param_id) != 0)
+            {
+                printf("Ignoring implementation with module config id %d\n", impl->param_id);
+                continue;
+            }
             switch (impl->effort_level)
             {
             case EFFORT_LEVEL__DEFAULT:
-                pipelines[pipeline_id].modules[module_idx].default_effort_param_id = impl->param_id - 1; // Minus 1 to convert to zero-based index
+                module->default_effort_param_id = impl->param_id - 1; // Minus 1 to convert to zero-based index
                 break;
             case EFFORT_LEVEL__LOW:
-                pipelines[pipeline_id].modules[module_idx].low_effort_param_id = impl->param_id - 1;
+                module->low_effort_param_id = impl->param_id - 1;
                 break;
             case EFFORT_LEVEL__MEDIUM:
-                pipelines[pipeline_id].modules[module_idx].medium_effort_param_id = impl->param_id - 1;
+                module->medium_effort_param_id = impl->param_id - 1;
                 break;
             case EFFORT_LEVEL__HIGH:
-                pipelines[pipeline_id].modules[module_idx].high_effort_param_id = impl->param_id - 1;
+                module->high_effort_param_id = impl->param_id - 1;
                 break;
             default:
                 // Handle unknown effort level
                 break;
             }
         }
+
+        // without explicit dependencies a module follows the one before it
+        module->depends_on = module_idx > 0 ? 1u << (module_idx - 1) : 0;
+        module->input_module = (int)module_idx - 1;
+        for (size_t dep_idx = 0; dep_idx < mdef->n_depends_on; dep_idx++)
+        {
+            int dep = mdef->depends_on[dep_idx] - 1; // Minus 1 to convert to zero-based index, -1 is the pipeline input
+            if (dep_idx == 0)
+            {
+                module->depends_on = 0;
+                module->input_module = -1;
+            }
+            if (dep < -1 || dep >= (int)module_idx)
+            {
+                // only earlier modules, which also rules out cycles
+                printf("Ignoring dependency of module %zu on module %d, not an earlier module\n", module_idx + 1, dep + 1);
+                continue;
+            }
+            if (dep >= 0)
+                module->depends_on |= 1u << dep;
+            if (dep_idx == 0)
+                module->input_module = dep;
+        }
     }
 
+    // products and linearity follow from the dependencies
+    uint32_t consumed = 0;
+    int is_linear = 1;
+    for (size_t module_idx = 0; module_idx < num_modules; module_idx++)
+    {
+        Module *module = &pipelines[pipeline_id].modules[module_idx];
+        consumed |= module->depends_on;
+        if (module->input_module != (int)module_idx - 1 ||
+            module->depends_on != (module_idx > 0 ? 1u << (module_idx - 1) : 0))
+            is_linear = 0;
+    }
+    pipelines[pipeline_id].products = ((1u << num_modules) - 1) & ~consumed;
+    pipelines[pipeline_id].is_linear = is_linear;
+
+    pipelines[pipeline_id].generation++;
+
     /* Free the unpacked pipeline definition data */
     pipeline_definition__free_unpacked(pdef, NULL);
 }
 
-void setup_module_config(param_t *param, int index)
+// Rebuild one module config from its param, releasing the previous parameters
+static void load_module_config(int module_idx, const uint8_t *slot, int forced)
 {
+    uint32_t source = crc32c(0, slot, DATA_PARAM_SIZE);
+    if (!forced && source == module_states[module_idx].source)
+        return; // unchanged, keep the compiled parameters
+
     uint8_t *buffer = NULL;
-    size_t buf_size = get_param_buffer(&buffer, param);
+    size_t buf_size = 0;
+    if (get_param_buffer(slot, &buffer, &buf_size) != 0)
+        return; // keep the previous config
     uint32_t hash = murmur3_32(buffer, buf_size, 42);
 
     ModuleConfig *mcon = module_config__unpack(NULL, buf_size, buffer);
@@ -180,10 +481,11 @@ void setup_module_config(param_t *param, int index)
     {
         return; // Skip this module if unpacking fails
     }
+    module_states[module_idx].source = source;
 
     // print the module config for debugging
     printf("Module Config: ID=%d, Num Parameters=%zu, Latency Cost=%d, Energy Cost=%d, Hash=%u\n",
-           param->id - MODULE_PARAMID_OFFSET,
+           module_idx,
            mcon->n_parameters,
            mcon->latency_cost,
            mcon->energy_cost,
@@ -212,100 +514,236 @@ void setup_module_config(param_t *param, int index)
         }
     }
 
-    int module_id = param->id - MODULE_PARAMID_OFFSET; // Minus 30 cause IDs are offset by 30 to accommodate pipeline ids (see pipeline.h)
-    module_parameter_lists[module_id].n_parameters = mcon->n_parameters;
+    int module_id = module_idx;
+    free_module_parameters(&module_parameter_lists[module_id]);
+    module_parameter_lists[module_id].generation++;
     module_parameter_lists[module_id].latency_cost = mcon->latency_cost;
     module_parameter_lists[module_id].energy_cost = mcon->energy_cost;
     module_parameter_lists[module_id].hash = hash;
-    module_parameter_lists[module_id].parameters = malloc(mcon->n_parameters * sizeof(ModuleParameter *));
-    if (!module_parameter_lists[module_id].parameters) // Check if malloc failed
+    if (mcon->n_parameters > PARAM_SLOT_NONE ||
+        compile_module_parameters(&module_parameter_lists[module_id], mcon) != 0)
     {
         set_error_param(MEMORY_MALLOC);
-        module_config__free_unpacked(mcon, NULL);
-        return;
     }
 
-    for (size_t i = 0; i < mcon->n_parameters; i++)
-    {
-        module_parameter_lists[module_id].parameters[i] = malloc(sizeof(ModuleParameter));
+    /* Free the unpacked module config data */
+    module_config__free_unpacked(mcon, NULL);
+}
 
-        if (!module_parameter_lists[module_id].parameters[i]) // Check if malloc failed
-        {
-            set_error_param(MEMORY_MALLOC);
-            // Cleanup previously allocated memory for parameters
-            for (size_t j = 0; j < i; j++)
-            {
-                if (module_parameter_lists[module_id].parameters[j]->value_case == STRING_VALUE)
-                {
-                    free(module_parameter_lists[module_id].parameters[j]->string_value);
-                }
-                free(module_parameter_lists[module_id].parameters[j]);
-            }
-            free(module_parameter_lists[module_id].parameters);
+// Remove a pipeline that is no longer in the config index
+static void clear_pipeline(int pipeline_idx)
+{
+    Pipeline *pipeline = &pipelines[pipeline_idx];
+    for (size_t module_idx = 0; module_idx < pipeline->num_modules; module_idx++)
+    {
+        free(pipeline->modules[module_idx].module_name);
+        module_registry_release(pipeline->modules[module_idx].loaded);
+    }
+    uint32_t generation = pipeline->generation;
+    memset(pipeline, 0, sizeof(Pipeline));
+    pipeline->generation = generation + 1;
+    memset(&pipeline_states[pipeline_idx], 0, sizeof(ConfigEntryState));
+}
 
-            module_config__free_unpacked(mcon, NULL); // Assume there's a way to free mcon
-            return;
-        }
+// Remove a module config that is no longer in the config index
+static void clear_module_config(int module_idx)
+{
+    free_module_parameters(&module_parameter_lists[module_idx]);
+    uint32_t generation = module_parameter_lists[module_idx].generation;
+    memset(&module_parameter_lists[module_idx], 0, sizeof(ModuleParameterList));
+    module_parameter_lists[module_idx].generation = generation + 1;
+    memset(&module_states[module_idx], 0, sizeof(ConfigEntryState));
+}
 
-        module_parameter_lists[module_id].parameters[i]->key = strdup(mcon->parameters[i]->key);
-        module_parameter_lists[module_id].parameters[i]->value_case = mcon->parameters[i]->value_case;
+// Apply the config index: load its entries that changed and remove the entries that
+// left it. Entries refer to blobs, so they are loaded exactly like a param holding the
+// reference. forced reloads every entry, pipelines_forced only the pipelines marked in it.
+static void load_config_index(int forced, uint64_t pipelines_forced)
+{
+    uint8_t slot[DATA_PARAM_SIZE];
+    param_get_data(&config_index, slot, DATA_PARAM_SIZE);
+    uint32_t source = crc32c(0, slot, DATA_PARAM_SIZE);
+    if (!forced && !pipelines_forced && source == index_source)
+        return;
 
-        switch (mcon->parameters[i]->value_case)
+    uint8_t *buffer = NULL;
+    size_t buf_size = 0;
+    if (get_param_buffer(slot, &buffer, &buf_size) != 0)
+        return; // keep the previous entries
+    index_source = source;
+
+    // entries still listed are marked 2, the ones left at 1 were removed
+    size_t num_entries = buf_size / sizeof(ConfigIndexEntry);
+    printf("Config index with %zu entries\n", num_entries);
+    for (size_t i = 0; i < num_entries; i++)
+    {
+        ConfigIndexEntry entry;
+        memcpy(&entry, buffer + i * sizeof(entry), sizeof(entry));
+        uint8_t entry_slot[DATA_PARAM_SIZE];
+        memset(entry_slot, 0, sizeof(entry_slot));
+        memcpy(entry_slot, &entry.ref, sizeof(entry.ref));
+
+        if (entry.kind == CONFIG_INDEX_PIPELINE && entry.id > MAX_PIPELINES && entry.id <= MAX_PIPELINE_ID &&
+            ensure_pipelines(entry.id) == 0)
         {
-        case CONFIG_PARAMETER__VALUE_BOOL_VALUE:
-            module_parameter_lists[module_id].parameters[i]->bool_value = mcon->parameters[i]->bool_value;
-            break;
-        case CONFIG_PARAMETER__VALUE_INT_VALUE:
-            module_parameter_lists[module_id].parameters[i]->int_value = mcon->parameters[i]->int_value;
-            break;
-        case CONFIG_PARAMETER__VALUE_FLOAT_VALUE:
-            module_parameter_lists[module_id].parameters[i]->float_value = mcon->parameters[i]->float_value;
-            break;
-        case CONFIG_PARAMETER__VALUE_STRING_VALUE:
-            module_parameter_lists[module_id].parameters[i]->string_value = strdup(mcon->parameters[i]->string_value);
-            break;
-        default:
-            break;
+            pipeline_states[entry.id - 1].indexed = 2;
+            load_pipeline(entry.id - 1, entry_slot, forced || ((pipelines_forced >> (entry.id - 1)) & 1));
+        }
+        else if (entry.kind == CONFIG_INDEX_MODULE && entry.id > MAX_MODULES && entry.id <= MAX_MODULE_CONFIG_ID &&
+                 ensure_module_configs(entry.id) == 0)
+        {
+            module_states[entry.id - 1].indexed = 2;
+            load_module_config(entry.id - 1, entry_slot, forced);
+        }
+        else
+        {
+            // ids of the config params are configured through the params
+            printf("Ignoring config index entry %zu (kind %u, id %u)\n", i, entry.kind, entry.id);
         }
     }
+    free(buffer);
 
-    /* Free the unpacked module config data */
-    module_config__free_unpacked(mcon, NULL);
+    for (size_t idx = 0; idx < num_pipelines; idx++)
+    {
+        if (pipeline_states[idx].indexed == 1)
+            clear_pipeline(idx);
+        else if (pipeline_states[idx].indexed == 2)
+            pipeline_states[idx].indexed = 1;
+    }
+    for (size_t idx = 0; idx < num_module_configs; idx++)
+    {
+        if (module_states[idx].indexed == 1)
+            clear_module_config(idx);
+        else if (module_states[idx].indexed == 2)
+            module_states[idx].indexed = 1;
+    }
 }
 
-void setup_all_pipelines()
+// Param callbacks: a new configuration was uploaded. Only the entry is marked; it is
+// reloaded by the next setup_cache_if_needed on the processing thread, so a batch never
+// sees a half-written pipeline and nothing else is reloaded.
+void setup_pipeline(param_t *param, int index)
 {
-    for (size_t pipeline_idx = 0; pipeline_idx < MAX_PIPELINES; pipeline_idx++)
-    {
-        setup_pipeline(pipeline_config_params[pipeline_idx], 0);
-    }
+    (void)index;
+    int pipeline_idx = param->id - PIPELINE_PARAMID_OFFSET;
+    if (pipeline_idx >= 0 && pipeline_idx < MAX_PIPELINES)
+        __atomic_or_fetch(&pending_pipelines, 1u << pipeline_idx, __ATOMIC_RELEASE);
 }
 
-void setup_all_module_configs()
+void setup_config_index(param_t *param, int index)
 {
-    for (size_t module_idx = 0; module_idx < MAX_MODULES; module_idx++)
-    {
-        setup_module_config(module_config_params[module_idx], 0);
-    }
+    (void)param;
+    (void)index;
+    __atomic_store_n(&pending_index, 1, __ATOMIC_RELEASE);
+}
+
+void setup_module_config(param_t *param, int index)
+{
+    (void)index;
+    int module_idx = param->id - MODULE_PARAMID_OFFSET; // Minus 30 cause IDs are offset by 30 to accommodate pipeline ids (see pipeline.h)
+    if (module_idx >= 0 && module_idx < MAX_MODULES)
+        __atomic_or_fetch(&pending_modules, 1u << module_idx, __ATOMIC_RELEASE);
 }
 
 void setup_cache_if_needed()
 {
     if (!is_setup)
     {
-        // Fetch and setup pipeline and module configurations if not done
-        printf("rebuilding cache \r\n");
-        MTR_BEGIN_FUNC();
-        setup_all_pipelines();
-        setup_all_module_configs();
-        MTR_END_FUNC();
+        // first use: size the registries for the config params and load every entry
+        if (ensure_pipelines(MAX_PIPELINES) != 0 || ensure_module_configs(MAX_MODULES) != 0)
+            return;
+        invalidate_cache();
         is_setup = 1;
     }
+
+    uint32_t pipelines_to_load = __atomic_exchange_n(&pending_pipelines, 0, __ATOMIC_ACQUIRE);
+    uint32_t modules_to_load = __atomic_exchange_n(&pending_modules, 0, __ATOMIC_ACQUIRE);
+    uint32_t pipelines_forced = __atomic_exchange_n(&forced_pipelines, 0, __ATOMIC_ACQUIRE);
+    uint32_t modules_forced = __atomic_exchange_n(&forced_modules, 0, __ATOMIC_ACQUIRE);
+    uint32_t index_to_load = __atomic_exchange_n(&pending_index, 0, __ATOMIC_ACQUIRE);
+    uint32_t index_forced = __atomic_exchange_n(&forced_index, 0, __ATOMIC_ACQUIRE);
+    uint64_t indexed_pipelines_forced = __atomic_exchange_n(&forced_indexed_pipelines, 0, __ATOMIC_ACQUIRE);
+    if (!pipelines_to_load && !modules_to_load && !index_to_load)
+        return;
+
+    MTR_BEGIN_FUNC();
+    uint8_t slot[DATA_PARAM_SIZE];
+    for (int pipeline_idx = 0; pipeline_idx < MAX_PIPELINES; pipeline_idx++)
+    {
+        if (pipelines_to_load & (1u << pipeline_idx))
+        {
+            param_get_data(pipeline_config_params[pipeline_idx], slot, DATA_PARAM_SIZE);
+            load_pipeline(pipeline_idx, slot, (pipelines_forced >> pipeline_idx) & 1);
+        }
+    }
+    for (int module_idx = 0; module_idx < MAX_MODULES; module_idx++)
+    {
+        if (modules_to_load & (1u << module_idx))
+        {
+            param_get_data(module_config_params[module_idx], slot, DATA_PARAM_SIZE);
+            load_module_config(module_idx, slot, (modules_forced >> module_idx) & 1);
+        }
+    }
+    if (index_to_load)
+        load_config_index(index_forced, indexed_pipelines_forced);
+    MTR_END_FUNC();
+    setup_generation++;
+}
+
+uint32_t config_generation()
+{
+    return setup_generation;
+}
+
+uint32_t module_cost_seed(const Module *module, const ModuleParameterList *config)
+{
+    return murmur3_32((const uint8_t *)&module->build_id, sizeof(module->build_id), config->hash);
+}
+
+size_t collect_cost_seeds(uint32_t *seeds, size_t max)
+{
+    size_t count = 0;
+    for (size_t p = 0; p < num_pipelines; p++)
+    {
+        for (size_t m = 0; m < pipelines[p].num_modules && m < MAX_MODULES; m++)
+        {
+            Module *module = &pipelines[p].modules[m];
+            int param_ids[] = {module->default_effort_param_id, module->low_effort_param_id,
+                               module->medium_effort_param_id, module->high_effort_param_id};
+            for (size_t e = 0; e < sizeof(param_ids) / sizeof(param_ids[0]); e++)
+            {
+                if (param_ids[e] >= 0 && (size_t)param_ids[e] < num_module_configs && count < max)
+                    seeds[count++] = module_cost_seed(module, &module_parameter_lists[param_ids[e]]);
+            }
+        }
+    }
+    return count;
 }
 
 void invalidate_cache()
 {
     printf("invalidating cache \r\n");
     MTR_INSTANT_FUNC();
-    is_setup = 0;
+    __atomic_or_fetch(&forced_pipelines, (1u << MAX_PIPELINES) - 1, __ATOMIC_RELEASE);
+    __atomic_or_fetch(&forced_modules, (1u << MAX_MODULES) - 1, __ATOMIC_RELEASE);
+    __atomic_or_fetch(&pending_pipelines, (1u << MAX_PIPELINES) - 1, __ATOMIC_RELEASE);
+    __atomic_or_fetch(&pending_modules, (1u << MAX_MODULES) - 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&forced_index, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&pending_index, 1, __ATOMIC_RELEASE);
+}
+
+void invalidate_pipeline(int pipeline_id)
+{
+    if (pipeline_id < 1 || pipeline_id > MAX_PIPELINE_ID)
+        return;
+    MTR_INSTANT_FUNC();
+    if (pipeline_id > MAX_PIPELINES)
+    {
+        // indexed pipelines are reloaded through the index, which forces only this entry
+        __atomic_or_fetch(&forced_indexed_pipelines, 1ull << (pipeline_id - 1), __ATOMIC_RELEASE);
+        __atomic_store_n(&pending_index, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    __atomic_or_fetch(&forced_pipelines, 1u << (pipeline_id - 1), __ATOMIC_RELEASE);
+    __atomic_or_fetch(&pending_pipelines, 1u << (pipeline_id - 1), __ATOMIC_RELEASE);
 }
@@ -14,23 +14,33 @@
 #include <glob.h>
 #include <time.h>
 #include "pipeline_executor.h"
+#include "pipeline_dry_run.h"
 #include "dipp_error.h"
 #include "dipp_config.h"
 #include "dipp_process.h"
 #include "dipp_paramids.h"
+#include "dipp_queue_param.h"
+#include "dipp_cost_profile_param.h"
 #include "priority_queue.h"
+#include "ingest_ring.h"
 #include "cost_store.h"
+#include "cost_profile.h"
+#include "energy_sensor.h"
+#include "telemetry.h"
 #include "vmem_storage.h"
 #include "heuristics.h"
+#include "scheduler.h"
 #include "process_module.h"
 #include "image_store.h"
 #include "image_batch.h"
 #include "vmem_upload_local.h"
+#include "upload_stage.h"
 #include "utils/minitrace.h"
 
 PriorityQueue *ingest_pq = NULL;
 PriorityQueue *partially_processed_pq = NULL;
 PriorityQueueImpl *pq_impl = NULL;
+IngestRing *ingest_ring = NULL;
 
 CostStoreImpl *cost_store_impl = NULL;
 CostStore *cost_store = NULL;
@@ -39,6 +49,37 @@ StorageMode global_storage_mode = STORAGE_MMAP;
 
 Heuristic *current_heuristic = NULL;
 
+SchedulingPolicy *current_policy = &fair_share_policy;
+
+// COST_PROFILE names a cost profile to warm-start the cost store from
+static const char *startup_cost_profile = NULL;
+
+// ENERGY_SENSOR selects the sensor module energy is measured with; without one the
+// configured energy costs are used
+static EnergySensorImpl *energy_sensor = NULL;
+
+// QUEUE_BACKEND=CALENDAR swaps the binary heap for the in-memory calendar queue
+static int use_calendar_queue = 0;
+
+// UPLOAD_MODE=SYNC uploads products on the processing thread instead of the upload stage
+static int upload_inline = 0;
+
+// Read a queue sizing parameter, falling back to the default when unset
+static uint32_t get_queue_param(param_t *param, uint32_t default_value)
+{
+    uint32_t value = param_get_uint32(param);
+    return value ? value : default_value;
+}
+
+// Batches waiting for ingest, including those still staged in the ring; both reads are wait-free
+static size_t get_ingest_depth()
+{
+    size_t depth = pq_impl->get_queue_size(ingest_pq);
+    if (ingest_ring != NULL)
+        depth += ingest_ring_depth(ingest_ring);
+    return depth;
+}
+
 // Process a single image batch, either fully or partially
 // It executes the pipeline, either fully or partially, depending
 // on the available resources. Based on this, it either uploads
@@ -48,6 +89,23 @@ void process(ImageBatch *input_batch)
 {
     MTR_BEGIN_FUNC_S("batch_uuid", input_batch->uuid);
     printf("Processing batch with pipeline ID %d, progress %d\n", input_batch->pipeline_id, input_batch->progress);
+
+    // batches enqueued directly by producers (see dipp_client.h) have not been persisted yet
+    if (input_batch->storage_mode == STORAGE_NOT_SET && image_batch_setup_storage(input_batch, global_storage_mode) == FAILURE)
+    {
+        printf("Dropping batch whose storage could not be set up\n");
+        MTR_END_FUNC();
+        return;
+    }
+
+    // batches recovered from disk are checked before any module touches them
+    if (input_batch->progress == -1 && image_batch_verify_data(input_batch) == FAILURE)
+    {
+        printf("Dropping batch with corrupt image data\n");
+        MTR_END_FUNC();
+        return;
+    }
+
     int pipeline_result = load_pipeline_and_execute(input_batch);
     printf("Pipeline execution returned %d\n", pipeline_result);
     printf("Current progress after execution: %d\n", input_batch->progress);
@@ -72,17 +130,12 @@ void process(ImageBatch *input_batch)
         {
             printf("Pipeline fully executed successfully\n");
 
-            image_batch_read_data(input_batch);
-            if (input_batch->data == NULL)
-            {
-                printf("Error reading image data\n");
-                MTR_END_FUNC();
-                return;
-            }
-
-            upload(input_batch->data, input_batch->num_images, input_batch->batch_size);
-
-            image_batch_cleanup(input_batch);
+            // every branch of a DAG pipeline ends in its own product; the upload
+            // stage reads, uploads and cleans them up while the next batch runs
+            ImageBatch products[MAX_MODULES];
+            size_t num_products = get_pipeline_products(input_batch, products, MAX_MODULES);
+            for (size_t i = 0; i < num_products; i++)
+                upload_stage_submit(&products[i]);
 
             // TODO: Uncomment the following lines to delete the files after processing
 
@@ -109,7 +162,8 @@ void process(ImageBatch *input_batch)
         {
             printf("Pipeline partially executed successfully\n");
 
-            // push the batch to the partial queue
+            // push the batch to the partial queue, where its wait starts over
+            input_batch->enqueued_ms = 0;
             if (pq_impl->enqueue(partially_processed_pq, *input_batch) != SUCCESS)
             {
                 printf("Error: Failed to enqueue batch to partially processed queue\n");
@@ -151,19 +205,18 @@ int get_message_from_queue(ImageBatch *datarcv, int do_wait)
         return FAILURE;
     }
 
-    MTR_BEGIN(__FILE__, "enqueue_onto_ingest");
-
     // Ensure that the received message size is not larger than the ImageBatch structure
     if (msg_size > sizeof(ImageBatch))
     {
         // set_error_param(MSGQ_EMPTY);
         printf("Received %ld bytes, expected %ld bytes\n", msg_size, sizeof(ImageBatch));
-        MTR_END(__FILE__, "enqueue_onto_ingest");
         return FAILURE;
     }
 
-    // Copy the data to the datarcv buffer
+    // Copy the data to the datarcv buffer; fields past what the producer sent stay zero
+    memset(datarcv, 0, sizeof(ImageBatch));
     memcpy(datarcv, &msg_buffer, msg_size);
+    datarcv->enqueued_ms = 0; // stamped when the batch enters the ingest queue
 
     // set storage attribute on the image batch
     image_batch_setup_storage(datarcv, global_storage_mode);
@@ -210,6 +263,156 @@ void get_env_vars()
             current_heuristic = &best_effort_heuristic;
         }
     }
+
+    const char *policy_str = getenv("SCHEDULING_POLICY");
+    if (policy_str != NULL)
+    {
+        if (strcmp(policy_str, "PARTIAL_FIRST") == 0)
+        {
+            current_policy = &partial_first_policy;
+        }
+        else if (strcmp(policy_str, "FAIR_SHARE") == 0)
+        {
+            current_policy = &fair_share_policy;
+        }
+        else
+        {
+            printf("Unknown SCHEDULING_POLICY '%s', defaulting to FAIR_SHARE\n", policy_str);
+            current_policy = &fair_share_policy;
+        }
+    }
+
+    const char *queue_backend_str = getenv("QUEUE_BACKEND");
+    if (queue_backend_str != NULL)
+    {
+        if (strcmp(queue_backend_str, "CALENDAR") == 0)
+        {
+            use_calendar_queue = 1;
+        }
+        else if (strcmp(queue_backend_str, "HEAP") != 0)
+        {
+            printf("Unknown QUEUE_BACKEND '%s', defaulting to HEAP\n", queue_backend_str);
+        }
+    }
+
+    const char *upload_mode_str = getenv("UPLOAD_MODE");
+    if (upload_mode_str != NULL)
+    {
+        if (strcmp(upload_mode_str, "SYNC") == 0)
+        {
+            upload_inline = 1;
+        }
+        else if (strcmp(upload_mode_str, "ASYNC") != 0)
+        {
+            printf("Unknown UPLOAD_MODE '%s', defaulting to ASYNC\n", upload_mode_str);
+        }
+    }
+
+    startup_cost_profile = getenv("COST_PROFILE");
+
+    const char *cost_write_str = getenv("COST_STORE_WRITE");
+    if (cost_write_str != NULL)
+    {
+        if (strcmp(cost_write_str, "THROUGH") == 0)
+        {
+            cost_store_write_through = 1;
+        }
+        else if (strcmp(cost_write_str, "BEHIND") != 0)
+        {
+            printf("Unknown COST_STORE_WRITE '%s', defaulting to BEHIND\n", cost_write_str);
+        }
+    }
+
+    const char *energy_sensor_str = getenv("ENERGY_SENSOR");
+    if (energy_sensor_str != NULL && strcmp(energy_sensor_str, "NONE") != 0)
+    {
+        energy_sensor = get_energy_sensor_impl(energy_sensor_str);
+        if (energy_sensor == NULL)
+        {
+            printf("Unknown ENERGY_SENSOR '%s', using configured energy costs\n", energy_sensor_str);
+        }
+    }
+}
+
+// Load the configurations if needed. After every rebuild the cost store learns which
+// module builds and configs are current, so entries of replaced ones are evicted first.
+static void setup_configs()
+{
+    static uint32_t seeds_generation = 0;
+
+    setup_cache_if_needed();
+    if (config_generation() != seeds_generation)
+    {
+        // four effort levels per module, the registry size varies with the config index
+        size_t max_seeds = num_pipelines * MAX_MODULES * 4;
+        uint32_t *seeds = malloc(max_seeds * sizeof(uint32_t));
+        if (seeds == NULL)
+            return; // retried with the next batch
+        cost_store_set_live_seeds(seeds, collect_cost_seeds(seeds, max_seeds));
+        free(seeds);
+        seeds_generation = config_generation();
+
+        // tell the operator now, not once batches miss their deadlines
+        pipeline_dry_run_changed(cost_store);
+    }
+}
+
+// Batches past their deadline cannot meet it anymore: take them out ahead of the
+// rest and finish them at the lowest effort, so they cost as little as possible
+static void process_expired_batches()
+{
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+        return;
+
+    ImageBatch expired[INGEST_DRAIN_BATCH];
+    PriorityQueue *queues[] = {partially_processed_pq, ingest_pq};
+    for (size_t q = 0; q < sizeof(queues) / sizeof(queues[0]); q++)
+    {
+        size_t num_expired = pq_impl->dequeue_expired(queues[q], now.tv_sec, expired, INGEST_DRAIN_BATCH);
+        if (!num_expired)
+            continue;
+
+        MTR_COUNTER(__FILE__, "expired_batches", (int)num_expired);
+        Heuristic *previous_heuristic = current_heuristic;
+        current_heuristic = &lowest_effort_heuristic;
+        for (size_t i = 0; i < num_expired; i++)
+        {
+            setup_configs();
+            process(&expired[i]);
+        }
+        current_heuristic = previous_heuristic;
+    }
+}
+
+// Run an import or export requested through cost_profile_cmd. It runs between batches
+// on the processing thread, so it never races with cost store updates.
+static void handle_cost_profile_command()
+{
+    uint8_t command = param_get_uint8(&cost_profile_cmd);
+    if (command == COST_PROFILE_IDLE)
+        return;
+
+    char path[COST_PROFILE_PATH_SIZE];
+    param_get_string(&cost_profile_path, path, sizeof(path));
+    path[sizeof(path) - 1] = '\0';
+
+    int result = -1;
+    if (command == COST_PROFILE_IMPORT)
+    {
+        result = cost_profile_import(cost_store_impl, cost_store, path[0] ? path : COST_PROFILE_FILE);
+        printf("Imported %d cost entries\n", result);
+    }
+    else if (command == COST_PROFILE_EXPORT)
+    {
+        result = cost_profile_export(cost_store, path[0] ? path : COST_EXPORT_FILE);
+        printf("Exported %d cost entries\n", result);
+    }
+
+    if (result < 0)
+        set_error_param(INTERNAL_COST_PROFILE);
+    MTR_INSTANT_I(__FILE__, "cost_profile_command", "entries", result);
+    param_set_uint8(&cost_profile_cmd, COST_PROFILE_IDLE);
 }
 
 void update_heuristic(int ingest_queue_depth, int partial_queue_depth)
@@ -220,7 +423,7 @@ void update_heuristic(int ingest_queue_depth, int partial_queue_depth)
     MTR_COUNTER(__FILE__, "partial_queue_depth", partial_queue_depth);
 
     int total_queue_depth = ingest_queue_depth + partial_queue_depth;
-    if (total_queue_depth < LOW_QUEUE_DEPTH_THRESHOLD
+    if (total_queue_depth < (int)get_queue_param(&low_queue_depth, LOW_QUEUE_DEPTH_THRESHOLD)
         // && partial_queue_depth < PARTIAL_QUEUE_SIZE_THRESHOLD
         )
     {
@@ -256,25 +459,83 @@ void process_images_loop()
     get_env_vars();
 
     pq_impl = get_priority_queue_impl(global_storage_mode);
+    if (use_calendar_queue)
+    {
+        // the calendar index is process-local, it cannot back the shared mmap queue files
+        if (global_storage_mode == STORAGE_MEM)
+            pq_impl = &priority_queue_calendar;
+        else
+            printf("QUEUE_BACKEND=CALENDAR requires STORAGE_MODE=MEM, using the heap\n");
+    }
+
+    size_t capacity = get_queue_param(&queue_capacity, DEFAULT_QUEUE_CAPACITY);
+    pq_impl->init(&ingest_pq, INGEST_QUEUE_FILE, capacity);
+    pq_impl->init(&partially_processed_pq, PARTIAL_QUEUE_FILE, capacity);
 
-    pq_impl->init(&ingest_pq, "/usr/share/dipp/queue_file");
-    pq_impl->init(&partially_processed_pq, "/usr/share/dipp/partially_processed_queue_file");
+    // direct-enqueue producers need the queues in shared files
+    if (global_storage_mode == STORAGE_MMAP && ingest_ring_init(&ingest_ring, INGEST_RING_FILE, INGEST_RING_CAPACITY) != 0)
+        ingest_ring = NULL;
+
+    // the heuristics read the battery level from the telemetry thread
+    telemetry_enable(TELEMETRY_SOURCE_BATTERY);
+    if (energy_sensor != NULL && energy_sensor_start(energy_sensor) != 0)
+        printf("Using configured energy costs\n");
 
     cost_store_impl = get_cost_store_impl(global_storage_mode);
     cost_store_impl->init(&cost_store, CACHE_FILE);
+    if (startup_cost_profile != NULL)
+    {
+        int imported = cost_profile_import(cost_store_impl, cost_store, startup_cost_profile);
+        printf("Imported %d cost entries from %s\n", imported, startup_cost_profile);
+    }
+
+    // load every referenced module now, not within the deadline of the first batch
+    setup_configs();
+
+    if (!upload_inline)
+        upload_stage_start();
 
     // Track last flush time to ensure mtr_flush is called at most once per 100ms
     struct timespec last_mtr_flush = {0, 0};
 
     while (1)
     {
-        // drain the message queue (nowait)
-        ImageBatch datarcv;
-        while (get_message_from_queue(&datarcv, 0) == SUCCESS)
+        // sampled before looking for work, so an enqueue racing with the checks below cuts the wait short
+        uint32_t wake_seq = pq_wake_seq(ingest_pq);
+
+        // drain the message queue (nowait), pushing the messages onto the
+        // ingest priority queue in bursts of up to INGEST_DRAIN_BATCH
+        ImageBatch drained[INGEST_DRAIN_BATCH];
+        size_t num_drained;
+        do
+        {
+            num_drained = 0;
+            while (num_drained < INGEST_DRAIN_BATCH && get_message_from_queue(&drained[num_drained], 0) == SUCCESS)
+            {
+                num_drained++;
+            }
+
+            if (num_drained)
+            {
+                MTR_BEGIN(__FILE__, "enqueue_onto_ingest");
+                pq_impl->enqueue_bulk(ingest_pq, drained, num_drained);
+                MTR_END(__FILE__, "enqueue_onto_ingest");
+            }
+        } while (num_drained == INGEST_DRAIN_BATCH);
+
+        // move batches published by direct-enqueue producers into the heap, one lock per burst
+        if (ingest_ring != NULL)
         {
-            // push data onto the ingest priority queue
-            pq_impl->enqueue(ingest_pq, datarcv);
-            MTR_END(__FILE__, "enqueue_onto_ingest");
+            do
+            {
+                num_drained = ingest_ring_pop_bulk(ingest_ring, drained, INGEST_DRAIN_BATCH);
+                if (num_drained)
+                {
+                    MTR_BEGIN(__FILE__, "drain_ingest_ring");
+                    pq_impl->enqueue_bulk(ingest_pq, drained, num_drained);
+                    MTR_END(__FILE__, "drain_ingest_ring");
+                }
+            } while (num_drained == INGEST_DRAIN_BATCH);
         }
 
         // // Only flush tracing if at least 100ms elapsed since last flush
@@ -291,60 +552,43 @@ void process_images_loop()
         //     }
         // }
 
-        // pull from the partially_processed_pq first
-        ImageBatch *batch = pq_impl->dequeue(partially_processed_pq);
-        if (batch == NULL)
-        {
-            // if empty, pull from the ingest_pq
-            batch = pq_impl->dequeue(ingest_pq);
-            if (batch == NULL)
-            {
-                // if empty, wait for new data
-                usleep(1000); // sleep for 1ms before continuing
-                continue;
-            }
-        }
-
-        setup_cache_if_needed();
+        handle_cost_profile_command();
 
-        update_heuristic(pq_impl->get_queue_size(ingest_pq), pq_impl->get_queue_size(partially_processed_pq));
-
-        // process the batch (maybe partially)
-        process(batch);
+        process_expired_batches();
 
-        if (batch != NULL)
+        // completed products queue up for the upload stage; while it is backed up no new
+        // batch is started, the queues keep draining meanwhile
+        if (upload_stage_full())
         {
-            free(batch);
+            upload_stage_wait_space(INGEST_POLL_INTERVAL_US);
+            continue;
         }
 
-        // // // if partial not full (size<10 by default), pull data from ingest_pq
-        ImageBatch *new_batch = NULL;
-        size_t queue_size = pq_impl->get_queue_size(partially_processed_pq);
-        if (queue_size < MAX_PARTIAL_QUEUE_SIZE)
+        // the scheduling policy decides between started and new batches and across pipelines
+        ImageBatch batch;
+        size_t partial_limit = get_queue_param(&partial_queue_limit, MAX_PARTIAL_QUEUE_SIZE);
+        if (!current_policy->next_batch(partially_processed_pq, ingest_pq, partial_limit, &batch))
         {
-            new_batch = pq_impl->dequeue(ingest_pq);
-            if (new_batch == NULL)
-            {
-                usleep(1000); // sleep for 1ms before continuing
-                continue;
-            }
+            // apply config updates while idle too, so their dry run does not wait for traffic
+            setup_configs();
 
-            setup_cache_if_needed();
+            // if empty, wait for a direct enqueue, or 1ms before polling the message queue again
+            pq_wait(ingest_pq, wake_seq, INGEST_POLL_INTERVAL_US);
+            continue;
+        }
 
-            update_heuristic(pq_impl->get_queue_size(ingest_pq), pq_impl->get_queue_size(partially_processed_pq));
+        setup_configs();
 
-            // process the batch (maybe partially)
-            process(new_batch);
+        update_heuristic(get_ingest_depth(), pq_impl->get_queue_size(partially_processed_pq));
 
-            if (new_batch != NULL)
-            {
-                free(new_batch);
-            }
-        }
+        // process the batch (maybe partially)
+        process(&batch);
     }
 
+    upload_stage_stop();
     pq_impl->clean_up(ingest_pq);
     pq_impl->clean_up(partially_processed_pq);
+    ingest_ring_clean_up(ingest_ring);
     cost_store_impl->clean_up(cost_store);
     MTR_END_FUNC();
 }
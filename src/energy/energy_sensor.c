@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "energy_sensor.h"
+
+// Latest two samples, written by the sampler and read by the executor
+typedef struct EnergySample
+{
+    double energy_uwh;
+    int64_t time_us;
+} EnergySample;
+
+static EnergySensorImpl *active_sensor = NULL;
+static EnergySample samples[2]; // [0] older, [1] newer
+static int num_samples = 0;
+
+static pthread_mutex_t sample_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sampler_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t sampler_handle;
+static int sampler_running = 0;
+
+static int64_t monotonic_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+EnergySensorImpl *get_energy_sensor_impl(const char *name)
+{
+    if (strcmp(name, "REMOTE") == 0)
+        return &energy_sensor_remote;
+    if (strcmp(name, "POWERCAP") == 0)
+        return &energy_sensor_powercap;
+    if (strcmp(name, "FILE") == 0)
+        return &energy_sensor_file;
+    return NULL;
+}
+
+static void *sampler_task(void *param)
+{
+    (void)param;
+    pthread_mutex_lock(&sample_lock);
+    while (sampler_running)
+    {
+        pthread_mutex_unlock(&sample_lock);
+        double energy_uwh;
+        int64_t time_us = monotonic_us();
+        int res = active_sensor->read(&energy_uwh, &time_us);
+        pthread_mutex_lock(&sample_lock);
+
+        // a reading that was already sampled adds nothing
+        if (res == 0 && (num_samples == 0 || time_us > samples[1].time_us))
+        {
+            samples[0] = samples[1];
+            samples[1].energy_uwh = energy_uwh;
+            samples[1].time_us = time_us;
+            if (num_samples < 2)
+                num_samples++;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += ENERGY_SAMPLE_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&sampler_cond, &sample_lock, &deadline);
+    }
+    pthread_mutex_unlock(&sample_lock);
+    return NULL;
+}
+
+int energy_sensor_start(EnergySensorImpl *sensor)
+{
+    if (sensor == NULL || sampler_running)
+        return -1;
+
+    if (sensor->init() != 0)
+    {
+        printf("Energy sensor %s is not available\n", sensor->name);
+        return -1;
+    }
+
+    active_sensor = sensor;
+    num_samples = 0;
+    sampler_running = 1;
+    if (pthread_create(&sampler_handle, NULL, &sampler_task, NULL) != 0)
+    {
+        printf("Failed to start energy sampler\n");
+        sampler_running = 0;
+        sensor->clean_up();
+        active_sensor = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void energy_sensor_stop()
+{
+    pthread_mutex_lock(&sample_lock);
+    int running = sampler_running;
+    sampler_running = 0;
+    pthread_cond_signal(&sampler_cond);
+    pthread_mutex_unlock(&sample_lock);
+
+    if (!running)
+        return;
+    pthread_join(sampler_handle, NULL);
+    active_sensor->clean_up();
+    active_sensor = NULL;
+    num_samples = 0;
+}
+
+int energy_sensor_now(double *energy_uwh)
+{
+    pthread_mutex_lock(&sample_lock);
+    if (num_samples < 2)
+    {
+        pthread_mutex_unlock(&sample_lock);
+        return -1;
+    }
+    EnergySample older = samples[0];
+    EnergySample newer = samples[1];
+    pthread_mutex_unlock(&sample_lock);
+
+    double rate = 0.0; // uWh per us
+    if (newer.time_us > older.time_us && newer.energy_uwh >= older.energy_uwh)
+        rate = (newer.energy_uwh - older.energy_uwh) / (double)(newer.time_us - older.time_us);
+    *energy_uwh = newer.energy_uwh + rate * (double)(monotonic_us() - newer.time_us);
+    return 0;
+}
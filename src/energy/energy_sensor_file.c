@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "energy_sensor.h"
+
+// Local stand-in for a power monitor: a file holding the cumulative energy in uWh,
+// updated by a test harness or simulator. ENERGY_SENSOR_PATH overrides the location.
+
+static const char *sensor_path = ENERGY_SENSOR_FILE;
+
+static int read_file(double *energy_uwh, int64_t *time_us)
+{
+    (void)time_us; // read synchronously, the preset time is the reading's
+    FILE *fp = fopen(sensor_path, "r");
+    if (fp == NULL)
+        return -1;
+    int res = fscanf(fp, "%lf", energy_uwh) == 1 ? 0 : -1;
+    fclose(fp);
+    return res;
+}
+
+static int init_file(void)
+{
+    const char *path = getenv("ENERGY_SENSOR_PATH");
+    if (path != NULL)
+        sensor_path = path;
+
+    double energy_uwh;
+    int64_t time_us;
+    return read_file(&energy_uwh, &time_us);
+}
+
+static void clean_up_file(void)
+{
+}
+
+EnergySensorImpl energy_sensor_file = {
+    .name = "FILE",
+    .init = init_file,
+    .read = read_file,
+    .clean_up = clean_up_file};
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "energy_sensor.h"
+
+// Linux powercap counter (RAPL on x86). The counter is in uJ and wraps at
+// max_energy_range_uj, so wraps are accumulated into a monotonic total.
+#define UJ_PER_UWH 3600.0
+
+static int energy_fd = -1;
+static uint64_t range_uj = 0;
+static uint64_t last_raw_uj = 0;
+static uint64_t total_uj = 0;
+static int have_raw = 0;
+
+static int read_counter(int fd, uint64_t *value)
+{
+    char buf[32];
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0)
+        return -1;
+    buf[len] = '\0';
+    *value = strtoull(buf, NULL, 10);
+    return 0;
+}
+
+static int init_powercap(void)
+{
+    energy_fd = open(POWERCAP_ENERGY_FILE, O_RDONLY);
+    if (energy_fd == -1)
+        return -1;
+
+    int range_fd = open(POWERCAP_RANGE_FILE, O_RDONLY);
+    if (range_fd == -1 || read_counter(range_fd, &range_uj) != 0)
+        range_uj = 0; // wraps cannot be corrected, they are skipped instead
+    if (range_fd != -1)
+        close(range_fd);
+
+    have_raw = 0;
+    total_uj = 0;
+    return 0;
+}
+
+static int read_powercap(double *energy_uwh, int64_t *time_us)
+{
+    (void)time_us; // read synchronously, the preset time is the reading's
+    uint64_t raw_uj;
+    if (read_counter(energy_fd, &raw_uj) != 0)
+        return -1;
+
+    if (have_raw)
+    {
+        if (raw_uj >= last_raw_uj)
+            total_uj += raw_uj - last_raw_uj;
+        else if (range_uj > last_raw_uj)
+            total_uj += range_uj - last_raw_uj + raw_uj;
+    }
+    last_raw_uj = raw_uj;
+    have_raw = 1;
+
+    *energy_uwh = (double)total_uj / UJ_PER_UWH;
+    return 0;
+}
+
+static void clean_up_powercap(void)
+{
+    if (energy_fd != -1)
+        close(energy_fd);
+    energy_fd = -1;
+}
+
+EnergySensorImpl energy_sensor_powercap = {
+    .name = "POWERCAP",
+    .init = init_powercap,
+    .read = read_powercap,
+    .clean_up = clean_up_powercap};
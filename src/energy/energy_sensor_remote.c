@@ -0,0 +1,31 @@
+#include "energy_sensor.h"
+#include "telemetry.h"
+
+// Energy reported by the power node over CSP. The telemetry thread polls the remote_energy
+// param, this backend only picks up its latest reading and never waits for the network.
+
+static int init_remote(void)
+{
+    return telemetry_enable(TELEMETRY_SOURCE_ENERGY);
+}
+
+static int read_remote(double *energy_uwh, int64_t *time_us)
+{
+    TelemetrySnapshot snapshot;
+    telemetry_snapshot(&snapshot);
+    if (!snapshot.energy_valid)
+        return -1;
+    *energy_uwh = snapshot.energy_uwh;
+    *time_us = snapshot.energy_time_us;
+    return 0;
+}
+
+static void clean_up_remote(void)
+{
+}
+
+EnergySensorImpl energy_sensor_remote = {
+    .name = "REMOTE",
+    .init = init_remote,
+    .read = read_remote,
+    .clean_up = clean_up_remote};
@@ -1,15 +1,14 @@
 #include "heuristics.h"
 #include "image_batch.h"
 #include "cost_store.h"
-#include "murmur_hash.h"
 #include "utils/minitrace.h"
 #include "battery_simulator.h"
 
-COST_MODEL_LOOKUP_RESULT get_default_implementation(Module *module, ImageBatch *data, uint32_t latency_requirement, float energy_requirement, int *module_param_id, uint32_t *picked_hash)
+COST_MODEL_LOOKUP_RESULT get_default_implementation(Module *module, ImageBatch *data, uint32_t latency_requirement, float energy_requirement, int *module_param_id, CostKey *picked_key)
 {
     MTR_BEGIN_FUNC_C("effort_level", "default");
-    uint32_t param_hash = module_parameter_lists[module->default_effort_param_id].hash;
-    *picked_hash = murmur3_batch_fingerprint(data, param_hash);
+    uint32_t seed = module_cost_seed(module, &module_parameter_lists[module->default_effort_param_id]);
+    *picked_key = cost_store_batch_key(seed, data);
 
     // For default effort, we only check energy requirement
     // This is our only option for a module, therefore we
@@ -17,7 +16,7 @@ COST_MODEL_LOOKUP_RESULT get_default_implementation(Module *module, ImageBatch *
 
     uint32_t latency;
     float energy;
-    if (cost_store_impl->lookup(cost_store, *picked_hash, &latency, &energy) != -1)
+    if (cost_store_impl->lookup(cost_store, picked_key->hash, &latency, &energy) != -1)
     {
         // printf("Found in cost store with latency=%u and energy=%f\r\n", latency, energy);
         // scale to fit simulation step size
@@ -32,10 +31,16 @@ COST_MODEL_LOOKUP_RESULT get_default_implementation(Module *module, ImageBatch *
     else
     {
         // printf("Did not find in cost store\r\n");
-        energy = (float)module_parameter_lists[module->default_effort_param_id].energy_cost;
+        // prefer costs interpolated from similar batches over the configured estimate
+        ExecutionContext now;
+        exec_context_read(&now);
+        if (!cost_store_estimate(cost_store, picked_key, &now, &latency, &energy))
+        {
+            energy = (float)module_parameter_lists[module->default_effort_param_id].energy_cost;
 
-        if (energy == 0.0f)
-            energy = (float)DEFAULT_EFFORT_ENERGY;
+            if (energy == 0.0f)
+                energy = (float)DEFAULT_EFFORT_ENERGY;
+        }
 
         // scale to fit simulation step size
         energy = energy * SIMULATION_STEPS_PER_UPDATE;
@@ -2,7 +2,6 @@
 #include "image_batch.h"
 #include "dipp_config.h"
 #include "cost_store.h"
-#include "murmur_hash.h"
 #include "pipeline_config.pb-c.h"
 #include "utils/minitrace.h"
 #include "battery_simulator.h"
@@ -13,7 +12,7 @@
 // the latency and energy requirements, FOUND_NOT_CACHED if no matching entry is found but the
 // default latency and energy values fit within the requirements, or NOT_FOUND in case the module
 // effort level was not found or does not fulfill the requirements.
-COST_MODEL_LOOKUP_RESULT judge_implementation(EffortLevel effort, Module *module, ImageBatch *data, uint32_t latency_requirement, float energy_requirement, int *module_param_id, uint32_t *picked_hash, bool is_lowest_effort)
+COST_MODEL_LOOKUP_RESULT judge_implementation(EffortLevel effort, Module *module, ImageBatch *data, uint32_t latency_requirement, float energy_requirement, int *module_param_id, CostKey *picked_key, bool is_lowest_effort)
 {
     MTR_BEGIN_FUNC_I("effort_level", effort);
     int32_t module_id = -1;
@@ -49,8 +48,7 @@ COST_MODEL_LOOKUP_RESULT judge_implementation(EffortLevel effort, Module *module
 
     ModuleParameterList *module_config = &module_parameter_lists[module_id];
 
-    uint32_t param_hash = module_config->hash;
-    *picked_hash = murmur3_batch_fingerprint(data, param_hash);
+    *picked_key = cost_store_batch_key(module_cost_seed(module, module_config), data);
 
     uint32_t latency;
     float energy;
@@ -62,9 +60,15 @@ COST_MODEL_LOOKUP_RESULT judge_implementation(EffortLevel effort, Module *module
         latency_requirement = UINT32_MAX;
     }
 
-    if (cost_store_impl->lookup(cost_store, *picked_hash, &latency, &energy) != -1)
+    // cached latencies are predicted for the current clock, load and throttling state
+    ExecutionContext now;
+    exec_context_read(&now);
+
+    int idx = cost_store_impl->lookup(cost_store, picked_key->hash, &latency, &energy);
+    if (idx != -1)
     {
         // printf("Found in cost store with latency=%u, energy=%f\r\n", latency, energy);
+        latency = exec_context_scale_latency(latency, &cost_store->items[idx].context, &now);
 
         // scale to fit simulation step size
         energy = energy * SIMULATION_STEPS_PER_UPDATE;
@@ -79,14 +83,18 @@ COST_MODEL_LOOKUP_RESULT judge_implementation(EffortLevel effort, Module *module
     else
     {
         // printf("Did not find in cost store\r\n");
-        latency = (uint32_t)module_config->latency_cost;
-        energy = (float)module_config->energy_cost;
+        // prefer costs interpolated from similar batches over the configured estimates
+        if (!cost_store_estimate(cost_store, picked_key, &now, &latency, &energy))
+        {
+            latency = (uint32_t)module_config->latency_cost;
+            energy = (float)module_config->energy_cost;
 
-        // if not provided by the user, use the default values
-        if (latency == 0)
-            latency = DEFAULT_EFFORT_LATENCY;
-        if (energy == 0.0f)
-            energy = DEFAULT_EFFORT_ENERGY;
+            // if not provided by the user, use the default values
+            if (latency == 0)
+                latency = DEFAULT_EFFORT_LATENCY;
+            if (energy == 0.0f)
+                energy = DEFAULT_EFFORT_ENERGY;
+        }
 
         // scale to fit simulation step size
         energy = energy * SIMULATION_STEPS_PER_UPDATE;
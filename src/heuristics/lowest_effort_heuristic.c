@@ -6,8 +6,9 @@
 #include <stdbool.h>
 #include "utils/minitrace.h"
 #include "battery_simulator.h"
+#include "telemetry.h"
 
-COST_MODEL_LOOKUP_RESULT get_lowest_effort_implementation_config(Module *module, ImageBatch *data, size_t num_modules, int *module_param_id, uint32_t *picked_hash)
+COST_MODEL_LOOKUP_RESULT get_lowest_effort_implementation_config(Module *module, ImageBatch *data, size_t num_modules, int *module_param_id, CostKey *picked_key)
 {
     MTR_BEGIN_FUNC();
     struct timespec time;
@@ -19,10 +20,14 @@ COST_MODEL_LOOKUP_RESULT get_lowest_effort_implementation_config(Module *module,
     }
 
     size_t num_modules_left = num_modules - (data->progress + 1); // number of modules left to process
+    if (num_modules_left == 0)
+        num_modules_left = 1; // the module being picked for gets the whole budget
 
     /* latency in microseconds per remaining module */
-    uint32_t latency_requirement = (uint32_t)(((data->priority - time.tv_sec) * 1e6) / (int64_t)num_modules_left); // time left in microseconds divided by number of modules left
-    float battery_level_wh = get_battery_level_wh();
+    // an expired deadline leaves no budget rather than wrapping around to a huge one
+    int64_t time_left = data->priority > time.tv_sec ? data->priority - time.tv_sec : 0;
+    uint32_t latency_requirement = (uint32_t)((time_left * 1e6) / (int64_t)num_modules_left); // time left in microseconds divided by number of modules left
+    float battery_level_wh = telemetry_battery_level_wh(); // cached by the telemetry thread
     float energy_requirement = (battery_level_wh - BATTERY_SAFETY_MARGIN_WH) * 1000000.0f; // current battery level minus safety margin (microwatt-hours)
 
     MTR_COUNTER("main", "battery_level_uwh", (int)(battery_level_wh * 1000000.0f));
@@ -36,7 +41,7 @@ COST_MODEL_LOOKUP_RESULT get_lowest_effort_implementation_config(Module *module,
     if (module->default_effort_param_id != -1)
     {
         MTR_END_FUNC();
-        return get_default_implementation(module, data, latency_requirement, energy_requirement, module_param_id, picked_hash);
+        return get_default_implementation(module, data, latency_requirement, energy_requirement, module_param_id, picked_key);
     }
     else
     {
@@ -53,21 +58,21 @@ COST_MODEL_LOOKUP_RESULT get_lowest_effort_implementation_config(Module *module,
         // start from the lightest and go up in the effort levels
         // (the first that fulfils the requiments is the one to use)
         // printf("Checking the low effort\r\n");
-        COST_MODEL_LOOKUP_RESULT result = judge_implementation(EFFORT_LEVEL__LOW, module, data, latency_requirement, energy_requirement, module_param_id, picked_hash, lowest_effort_level == EFFORT_LEVEL__LOW);
+        COST_MODEL_LOOKUP_RESULT result = judge_implementation(EFFORT_LEVEL__LOW, module, data, latency_requirement, energy_requirement, module_param_id, picked_key, lowest_effort_level == EFFORT_LEVEL__LOW);
         if (result == FOUND_NOT_CACHED || result == FOUND_CACHED)
         {
             MTR_END_FUNC();
             return result;
         }
         // printf("Checking the medium effort\r\n");
-        result = judge_implementation(EFFORT_LEVEL__MEDIUM, module, data, latency_requirement, energy_requirement, module_param_id, picked_hash, lowest_effort_level == EFFORT_LEVEL__MEDIUM);
+        result = judge_implementation(EFFORT_LEVEL__MEDIUM, module, data, latency_requirement, energy_requirement, module_param_id, picked_key, lowest_effort_level == EFFORT_LEVEL__MEDIUM);
         if (result == FOUND_NOT_CACHED || result == FOUND_CACHED)
         {
             MTR_END_FUNC();
             return result;
         }
         // printf("Checking the high effort\r\n");
-        result = judge_implementation(EFFORT_LEVEL__HIGH, module, data, latency_requirement, energy_requirement, module_param_id, picked_hash, lowest_effort_level == EFFORT_LEVEL__HIGH);
+        result = judge_implementation(EFFORT_LEVEL__HIGH, module, data, latency_requirement, energy_requirement, module_param_id, picked_key, lowest_effort_level == EFFORT_LEVEL__HIGH);
         if (result == FOUND_NOT_CACHED || result == FOUND_CACHED)
         {
             MTR_END_FUNC();
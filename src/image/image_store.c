@@ -11,6 +11,46 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <uuid/uuid.h>
+#include "crc32c.h"
+
+#define BATCH_TRAILER_MAGIC 0x43524342 // "BCRC"
+
+// Trailer appended after the batch data in files persisted by DIPP
+typedef struct BatchFileTrailer
+{
+    uint32_t magic;
+    uint32_t checksum;     // CRC32C of the batch data
+    uint32_t writer_nonce; // identifies the DIPP run that wrote the file
+} BatchFileTrailer;
+
+static uint32_t boot_nonce = 0;
+
+// Random per-run identifier, so files written by this run are not re-verified
+static uint32_t get_boot_nonce()
+{
+    while (boot_nonce == 0)
+    {
+        boot_nonce = (uint32_t)rand() ^ ((uint32_t)getpid() << 16);
+    }
+    return boot_nonce;
+}
+
+// Write the checksum trailer behind the mapped batch data
+static int write_batch_trailer(int fd, ImageBatch *batch)
+{
+    BatchFileTrailer trailer = {
+        .magic = BATCH_TRAILER_MAGIC,
+        .checksum = crc32c(0, batch->data, batch->batch_size),
+        .writer_nonce = get_boot_nonce(),
+    };
+
+    if (pwrite(fd, &trailer, sizeof(trailer), batch->batch_size) != sizeof(trailer))
+    {
+        set_error_param(MMAP_TRUNCATE);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
 
 int persist_data_if_necessary(ImageBatch *batch)
 {
@@ -46,8 +86,8 @@ int persist_data_if_necessary(ImageBatch *batch)
                 return FAILURE;
             }
 
-            // Ensure file is large enough for the mapping
-            if (ftruncate(fd, batch->batch_size) == -1)
+            // Ensure file is large enough for the mapping and the checksum trailer
+            if (ftruncate(fd, batch->batch_size + sizeof(BatchFileTrailer)) == -1)
             {
                 close(fd);
                 set_error_param(MMAP_OPEN);
@@ -55,10 +95,10 @@ int persist_data_if_necessary(ImageBatch *batch)
             }
 
             batch->data = mmap(NULL, batch->batch_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-            close(fd);
 
             if (batch->data == MAP_FAILED)
             {
+                close(fd);
                 set_error_param(MMAP_MAP);
                 return FAILURE;
             }
@@ -67,12 +107,21 @@ int persist_data_if_necessary(ImageBatch *batch)
             unsigned char *shm_data = shmat(batch->shmid, NULL, 0);
             if (shm_data == (void *)-1)
             {
+                close(fd);
                 set_error_param(SHM_ATTACH);
                 return FAILURE;
             }
 
             memcpy(batch->data, shm_data, batch->batch_size);
 
+            int trailer_result = write_batch_trailer(fd, batch);
+            close(fd);
+            if (trailer_result != SUCCESS)
+            {
+                shmdt(shm_data);
+                return FAILURE;
+            }
+
             // Detach from shared memory
             if (shmdt(shm_data) == -1)
             {
@@ -320,4 +369,56 @@ int image_batch_setup_storage(ImageBatch *batch, StorageMode storage_mode)
     batch->data = NULL; // Will be set in read_data
 
     return persist_data_if_necessary(batch);
+}
+
+int image_batch_verify_data(ImageBatch *batch)
+{
+    if (!batch)
+    {
+        return FAILURE;
+    }
+
+    // only persisted batch files carry a checksum
+    if (batch->storage_mode != STORAGE_MMAP || batch->filename[0] == '\0' || batch->batch_size <= 0)
+    {
+        return SUCCESS;
+    }
+
+    int fd = open(batch->filename, O_RDONLY);
+    if (fd == -1)
+    {
+        set_error_param(MMAP_OPEN);
+        return FAILURE;
+    }
+
+    // Files without a trailer were not written by DIPP, and files written by
+    // this run have not been through a restart; neither needs verification
+    BatchFileTrailer trailer;
+    if (pread(fd, &trailer, sizeof(trailer), batch->batch_size) != sizeof(trailer) ||
+        trailer.magic != BATCH_TRAILER_MAGIC ||
+        trailer.writer_nonce == get_boot_nonce())
+    {
+        close(fd);
+        return SUCCESS;
+    }
+
+    void *data = mmap(NULL, batch->batch_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        set_error_param(MMAP_MAP);
+        return FAILURE;
+    }
+
+    madvise(data, batch->batch_size, MADV_SEQUENTIAL);
+    uint32_t checksum = crc32c(0, data, batch->batch_size);
+    munmap(data, batch->batch_size);
+
+    if (checksum != trailer.checksum)
+    {
+        set_error_param(INTERNAL_CHECKSUM_MISMATCH);
+        return FAILURE;
+    }
+
+    return SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef DIPP_CLIENT_H
+#define DIPP_CLIENT_H
+
+#include "priority_queue.h"
+#include "ingest_ring.h"
+#include "image_batch.h"
+
+// Producer-side access to the ingest queue of a running DIPP instance (MMAP storage mode only).
+// Batches are published into the lock-free ingest ring, or pushed straight into the
+// memory-mapped queue under its process-shared lock when the ring is full, and DIPP is
+// woken through a futex, bypassing the SysV message queue and its polling delay.
+typedef struct DippClient
+{
+    PriorityQueue *pq;
+    IngestRing *ring;
+} DippClient;
+
+// Attach to the ingest queue. Fails if DIPP has not initialised the queue in this boot,
+// in which case the producer should fall back to the message queue.
+int dipp_client_open(DippClient **client);
+
+// Enqueue a batch whose image data is referenced by shmid, as for the message queue.
+// DIPP sets up storage for the batch when it dequeues it.
+int dipp_client_enqueue(DippClient *client, ImageBatch *batch);
+
+// Enqueue count batches and wake DIPP once; returns the number enqueued
+int dipp_client_enqueue_bulk(DippClient *client, ImageBatch *batches, size_t count);
+
+void dipp_client_close(DippClient *client);
+
+#endif // DIPP_CLIENT_H
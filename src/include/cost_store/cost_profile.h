@@ -0,0 +1,49 @@
+#ifndef COST_PROFILE_H
+#define COST_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cost_store.h"
+#include "image_batch.h"
+
+// Portable, line-based cost profile. Profiled costs are keyed by the module cost seed
+// (config hash and module build id, see module_cost_seed) and the batch fingerprint they
+// were measured on; learned entries exported from a running instance carry the cache key
+// and the size buckets it was derived from.
+//
+//   # dipp cost profile 3
+//   profile <seed> <num_images> <batch_size> <pipeline_id> <samples> <latency_mean_us> <latency_min_us> <latency_max_us> <energy_mean>
+//   entry <seed> <key> <size_bucket> <images_bucket> <latency_us> <energy>
+#define COST_PROFILE_VERSION 3
+#define COST_PROFILE_FILE "/usr/share/dipp/cost_profile.txt"
+#define COST_EXPORT_FILE "/usr/share/dipp/cost_export.txt"
+
+// Values of the cost_profile_cmd param, reset to COST_PROFILE_IDLE once handled
+typedef enum COST_PROFILE_COMMAND
+{
+    COST_PROFILE_IDLE = 0,
+    COST_PROFILE_IMPORT = 1,
+    COST_PROFILE_EXPORT = 2
+} COST_PROFILE_COMMAND;
+
+typedef struct CostProfileRecord
+{
+    uint32_t seed;
+    ImageBatchFingerprint fingerprint;
+    uint32_t samples;
+    uint32_t latency_mean; // microseconds
+    uint32_t latency_min;
+    uint32_t latency_max;
+    float energy_mean;
+} CostProfileRecord;
+
+void cost_profile_write_header(FILE *fp);
+void cost_profile_write_record(FILE *fp, const CostProfileRecord *record);
+
+// Fill the store from a profile. Entries already in the store were measured on this
+// device and are kept. Returns the number of entries imported, or -1 on error.
+int cost_profile_import(CostStoreImpl *impl, CostStore *store, const char *path);
+// Write the valid entries of the store as a profile; returns the number written, or -1
+int cost_profile_export(CostStore *store, const char *path);
+
+#endif // COST_PROFILE_H
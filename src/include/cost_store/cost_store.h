@@ -3,10 +3,27 @@
 
 #include <stdint.h>
 #include "image_batch.h"
+#include "utils/exec_context.h"
 
 #define MAX_ENTRIES 100
 #define CACHE_FILE "/usr/share/dipp/cost.cache"
 
+// Versioned on-disk layout of the cost cache: a header followed by MAX_ENTRIES records.
+// Files in any other format are discarded on init; costs are advisory and get re-measured.
+#define COST_STORE_FILE_MAGIC 0x54534344 // "DCST"
+#define COST_STORE_FILE_VERSION 5
+#define COST_STORE_HEADER_SIZE 64
+
+// Interval of the write-behind flusher, used when the runtime param is not set
+#define DEFAULT_COST_FLUSH_INTERVAL_MS 5000
+
+// Batch sizes and image counts are keyed by log-scale bucket, so similar batches share
+// costs. Resolution in buckets per doubling, used when the runtime param is not set.
+#define DEFAULT_COST_BUCKETS_PER_OCTAVE 4
+#define MAX_COST_BUCKETS_PER_OCTAVE 8 // keeps bucket indices of 32-bit values within a byte
+// On a miss, costs are estimated from known buckets at most this many doublings away
+#define COST_ESTIMATE_MAX_OCTAVES 2
+
 typedef enum COST_MODEL_LOOKUP_RESULT
 {
     FOUND_CACHED = 0,     // got the optimal implementation from cost model
@@ -19,10 +36,33 @@ typedef struct CostEntry
     uint32_t hash;
     uint32_t latency; // changed from uint16_t -> uint32_t for microsecond precision
     float energy;     // changed from uint16_t -> float
+    uint32_t seed;    // module_cost_seed the key was derived from, occupies former padding
     uint64_t timestamp;
     uint8_t valid;
+    uint8_t size_bucket;   // bucket of the batch_size the entry was measured on
+    uint8_t images_bucket; // bucket of the num_images the entry was measured on
+    ExecutionContext context; // conditions the latency was measured under
+    uint32_t checksum;        // CRC32C of the fields above
 } CostEntry;
 
+// Cache key of a batch for one module implementation
+typedef struct CostKey
+{
+    uint32_t hash; // hash of the buckets and pipeline id, seeded with seed
+    uint32_t seed; // module_cost_seed of the implementation
+    uint8_t size_bucket;
+    uint8_t images_bucket;
+} CostKey;
+
+typedef struct CostStoreFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size; // offset of the first record
+    uint32_t entry_size;  // sizeof(CostEntry) of the writer
+    uint32_t capacity;    // number of records following the header
+} CostStoreFileHeader;
+
 // New CostStore wrapper with statically allocated items (like PriorityQueue)
 typedef struct CostStore
 {
@@ -33,7 +73,9 @@ typedef struct CostStoreImpl
 {
     // init now takes CostStore ** so it can set the caller's pointer to mapped or allocated memory
     int (*init)(CostStore **store, char *filename);
-    void (*insert)(CostStore *store, uint32_t hash, uint32_t latency, float energy);
+    // entries whose key seed is no longer configured are evicted first once the store is full.
+    // context holds the conditions latency was measured under, NULL if unknown
+    void (*insert)(CostStore *store, const CostKey *key, uint32_t latency, float energy, const ExecutionContext *context);
     int (*lookup)(CostStore *store, uint32_t hash, uint32_t *latency, float *energy); // latency -> uint32_t*
     int (*clean_up)(CostStore *store);                                                // free/munmap backend resources
 } CostStoreImpl;
@@ -45,15 +87,37 @@ CostStoreImpl *get_cost_store_impl(StorageMode storage_type);
 
 // updated prototypes
 int cache_lookup(CostStore *store, uint32_t hash, uint32_t *latency, float *energy);
-void cache_insert(CostStore *store, uint32_t hash, uint32_t latency, float energy);
+// Insert or update the entry for the key. When full, an obsolete entry is replaced, or else
+// the LRU one; returns the index written or -1
+int cache_insert(CostStore *store, const CostKey *key, uint32_t latency, float energy, const ExecutionContext *context);
 int find_entry(CostStore *store, uint32_t hash);
 int find_lru_index(CostStore *store);
+// Replace the set of seeds in use after a configuration reload. Entries of other seeds
+// belong to replaced modules or configs; they never match again and are evicted lazily.
+void cost_store_set_live_seeds(const uint32_t *seeds, size_t count);
+// Key of a batch fingerprint for the implementation with the given module_cost_seed
+CostKey cost_store_key(uint32_t seed, const ImageBatchFingerprint *fingerprint);
+CostKey cost_store_batch_key(uint32_t seed, const ImageBatch *batch);
+// Key of a fingerprint that is already bucketed, e.g. the buckets of a stored entry
+CostKey cost_store_bucket_key(uint32_t seed, uint8_t size_bucket, uint8_t images_bucket, int pipeline_id);
+// Estimate the costs of a key that missed by interpolating between the nearest known
+// size buckets of the same implementation and image count, with their latencies scaled to
+// the current conditions; returns 1 if estimated, 0 if not
+int cost_store_estimate(CostStore *store, const CostKey *key, const ExecutionContext *current, uint32_t *latency, float *energy);
+// Flusher interval of the file backend, from the runtime param or the default
+uint32_t cost_store_flush_interval_ms();
+// Store the CRC32C of the entry in its checksum field
+void cost_entry_seal(CostEntry *entry);
 
 extern CostStoreImpl cost_store_mmap;
 extern CostStoreImpl cost_store_mem;
 
 extern CostStoreImpl *cost_store_impl;
 
+// When set, the file backend writes every insert through to disk before returning,
+// instead of leaving it to the background flusher (COST_STORE_WRITE=THROUGH)
+extern int cost_store_write_through;
+
 extern uint64_t global_time;
 
 #endif // COST_STORE_H
\ No newline at end of file
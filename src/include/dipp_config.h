@@ -5,16 +5,53 @@
 #include <stdint.h>
 
 #define MAX_MODULES 20
-#define MAX_PIPELINES 6
+#define MAX_PIPELINES 6 // pipelines with a config param, the config index adds more
+
+/* Upper bounds of the ids the config index may add (see ConfigIndexEntry) */
+#define MAX_PIPELINE_ID 64
+#define MAX_MODULE_CONFIG_ID 256
 
 #define PIPELINE_PARAMID_OFFSET 10
 #define MODULE_PARAMID_OFFSET 30
 
+/* A config param holds either the Brotli-compressed config inline, prefixed by its
+ * compressed length, or a ConfigBlobRef to a larger config uploaded to the configs vmem
+ * (see vmem_storage.h). Inline lengths are below the marker, so the two never clash. */
+#define CONFIG_BLOB_MARKER 0xFF
+#define CONFIG_BLOB_CHUNK 1024                  // bytes read from vmem per decode step
+#define CONFIG_MAX_DECODED_SIZE (1024 * 1024)   // refuse configs that expand beyond this
+
+typedef struct __attribute__((packed)) ConfigBlobRef
+{
+    uint8_t marker;  // CONFIG_BLOB_MARKER
+    uint32_t offset; // of the compressed config in the configs vmem
+    uint32_t length; // compressed size in bytes
+    uint32_t crc;    // CRC32C of the compressed bytes
+} ConfigBlobRef;
+
+/* The config index param holds (inline or as a blob) an array of these entries, one per
+ * pipeline or module config beyond the config params. Ids continue after the params,
+ * i.e. pipelines MAX_PIPELINES + 1.. and module configs MAX_MODULES + 1.. */
+#define CONFIG_INDEX_PIPELINE 1
+#define CONFIG_INDEX_MODULE 2
+
+typedef struct __attribute__((packed)) ConfigIndexEntry
+{
+    uint8_t kind;      // CONFIG_INDEX_PIPELINE or CONFIG_INDEX_MODULE
+    uint16_t id;       // pipeline id or module config id (param_id of an implementation)
+    ConfigBlobRef ref; // the compressed config in the configs vmem
+} ConfigIndexEntry;
+
+struct LoadedModule; // see module_registry.h
+
 /* Structs for storing module and pipeline configurations */
 typedef struct Module
 {
     char *module_name;
+    struct LoadedModule *loaded; // registry reference, NULL if the module failed to load
     void *module_function;
+    // identity of the loaded binary (ELF build-id, or inode/mtime/size), part of the cost key
+    uint32_t build_id;
     // default effort to be set in case there is only a single effort level
     int default_effort_param_id;
     // Distinct effort levels for the module,
@@ -22,13 +59,23 @@ typedef struct Module
     int low_effort_param_id;
     int medium_effort_param_id;
     int high_effort_param_id;
+    // modules that have to run before this one, one bit per module index
+    uint32_t depends_on;
+    // module whose output this one consumes, -1 for the pipeline input
+    int input_module;
 } Module;
 
+/* Pipelines are DAGs: every module runs once all modules it depends on have run, so
+ * independent branches may run concurrently. Modules are stored in a topological
+ * order, a module only depends on modules before it. */
 typedef struct Pipeline
 {
     int pipeline_id;
     Module modules[MAX_MODULES];
     size_t num_modules;
+    uint32_t generation; // bumped whenever the pipeline is reloaded
+    uint32_t products;   // modules no other module depends on, their outputs are downlinked
+    int is_linear;       // every module consumes the output of the one before it
 } Pipeline;
 
 /* Local structures for saving module parameter configurations (translated from Protobuf) */
@@ -61,14 +108,39 @@ typedef struct ModuleParameterList
     uint32_t latency_cost;
     uint32_t energy_cost;
     ModuleParameter **parameters;
+    uint32_t generation; // bumped whenever the config is reloaded
+    // slot in parameters of every key id (see module_params.h), PARAM_SLOT_NONE if unset.
+    // parameters, the parameters, this index and the string values share one allocation.
+    const uint16_t *key_index;
+    uint16_t n_key_index;
 } ModuleParameterList;
 
-/* Stashed pipelines and module parameters */
-extern Pipeline pipelines[];
-extern ModuleParameterList module_parameter_lists[];
+/* Stashed pipelines and module parameters, indexed by pipeline id - 1 and module config
+ * id - 1. The registries grow as configs are added, so do not keep pointers into them
+ * across setup_cache_if_needed. */
+extern Pipeline *pipelines;
+extern size_t num_pipelines;
+extern ModuleParameterList *module_parameter_lists;
+extern size_t num_module_configs;
 
-/* Preload all configurations if not done yet */
+/* The pipeline with that id, NULL if it is not configured */
+Pipeline *get_pipeline(int pipeline_id);
+
+/* Load all configurations on first use, afterwards only the entries whose params
+ * changed since (see setup_pipeline/setup_module_config/setup_config_index) */
 void setup_cache_if_needed();
+/* Reload every entry on the next setup_cache_if_needed */
 void invalidate_cache();
+/* Reload one pipeline (1-based id) on the next setup_cache_if_needed, e.g. to retry a
+ * module that failed to load */
+void invalidate_pipeline(int pipeline_id);
+/* Bumped whenever setup_cache_if_needed reloads any entry */
+uint32_t config_generation();
+
+/* Seed of the cost key of a module implementation: the config hash combined with the
+ * module build id, so a new build or config of a module never matches old costs */
+uint32_t module_cost_seed(const Module *module, const ModuleParameterList *config);
+/* Collect the cost seeds of all configured implementations; returns the number written */
+size_t collect_cost_seeds(uint32_t *seeds, size_t max);
 
 #endif
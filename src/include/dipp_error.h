@@ -51,6 +51,9 @@ typedef enum ERROR_CODE
 
     INTERNAL_BROTLI_DECODE = 516,
     INTERNAL_TIMESPEC_CLOCKGETTIME = 517,
+    INTERNAL_CHECKSUM_MISMATCH = 518,
+    INTERNAL_COST_PROFILE = 519,
+    INTERNAL_MODULE_INIT = 520,
 
     MODULE_EXIT_CRASH = 600,
     MODULE_EXIT_NORMAL = 601,
@@ -8,6 +8,11 @@
 
 #define MSG_QUEUE_KEY 71
 
+// Maximum number of messages moved onto the ingest queue per bulk enqueue
+#define INGEST_DRAIN_BATCH 32
+// Longest idle wait before the message queue is polled again
+#define INGEST_POLL_INTERVAL_US 1000
+
 // Return codes
 #define SUCCESS 0
 #define FAILURE -1
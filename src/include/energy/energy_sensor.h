@@ -0,0 +1,45 @@
+#ifndef ENERGY_SENSOR_H
+#define ENERGY_SENSOR_H
+
+#include <stdint.h>
+
+// Readings are cumulative energy in uWh, the unit of the cost store
+#define ENERGY_SAMPLE_INTERVAL_MS 10
+
+// Sysfs counter of the powercap backend (RAPL package domain on x86)
+#define POWERCAP_ENERGY_FILE "/sys/class/powercap/intel-rapl:0/energy_uj"
+#define POWERCAP_RANGE_FILE "/sys/class/powercap/intel-rapl:0/max_energy_range_uj"
+
+// Stand-in sensor for testing: a file holding a cumulative reading in uWh
+#define ENERGY_SENSOR_FILE "/usr/share/dipp/energy_uwh"
+
+typedef struct EnergySensorImpl
+{
+    const char *name;
+    // prepare the sensor; returns 0 if it can be read
+    int (*init)(void);
+    // read the cumulative energy in uWh; returns 0 on success. Only called from the sampler
+    // thread, so it may block without stalling execution. time_us comes preset to the
+    // CLOCK_MONOTONIC time of the call; backends reporting an older reading overwrite it.
+    int (*read)(double *energy_uwh, int64_t *time_us);
+    void (*clean_up)(void);
+} EnergySensorImpl;
+
+// Backend for a sensor name given in ENERGY_SENSOR (REMOTE, POWERCAP, FILE), NULL if unknown
+EnergySensorImpl *get_energy_sensor_impl(const char *name);
+
+// Start sampling sensor in the background every ENERGY_SAMPLE_INTERVAL_MS.
+// Returns 0 on success; without a running sampler energy_sensor_now reports no reading.
+int energy_sensor_start(EnergySensorImpl *sensor);
+void energy_sensor_stop();
+
+// Cumulative energy at this instant, extrapolated from the last two samples at the rate
+// between them, so spans shorter than the sample interval still get a share.
+// Returns 0 on success, -1 if no sensor is sampled or it has not produced two samples yet.
+int energy_sensor_now(double *energy_uwh);
+
+extern EnergySensorImpl energy_sensor_remote;
+extern EnergySensorImpl energy_sensor_powercap;
+extern EnergySensorImpl energy_sensor_file;
+
+#endif // ENERGY_SENSOR_H
@@ -30,14 +30,14 @@ typedef struct Heuristic
 {
     // Pick a module effort level based on the currently used heuristic.
     // The module_param_id will be populated with the ID of the picked module.
-    // The picked_hash will be populated with the hash of the image batch metadata
+    // The picked_key will be populated with the cost key of the bucketed image batch metadata
     // and module parameters. This is further used to populate cost model after the first execution
-    COST_MODEL_LOOKUP_RESULT (*heuristic_function)(Module *module, ImageBatch *data, size_t num_modules, int *module_param_id, uint32_t *picked_hash);
+    COST_MODEL_LOOKUP_RESULT (*heuristic_function)(Module *module, ImageBatch *data, size_t num_modules, int *module_param_id, CostKey *picked_key);
 } Heuristic;
 
 /* Updated prototypes: latency is uint32_t (microseconds), energy is float */
-COST_MODEL_LOOKUP_RESULT get_default_implementation(Module *module, ImageBatch *data, uint32_t latency_requirement, float energy_requirement, int *module_param_id, uint32_t *picked_hash);
-COST_MODEL_LOOKUP_RESULT judge_implementation(EffortLevel effort, Module *module, ImageBatch *data, uint32_t latency_requirement, float energy_requirement, int *module_param_id, uint32_t *picked_hash, bool is_lowest_effort);
+COST_MODEL_LOOKUP_RESULT get_default_implementation(Module *module, ImageBatch *data, uint32_t latency_requirement, float energy_requirement, int *module_param_id, CostKey *picked_key);
+COST_MODEL_LOOKUP_RESULT judge_implementation(EffortLevel effort, Module *module, ImageBatch *data, uint32_t latency_requirement, float energy_requirement, int *module_param_id, CostKey *picked_key, bool is_lowest_effort);
 
 extern Heuristic best_effort_heuristic;
 extern Heuristic lowest_effort_heuristic;
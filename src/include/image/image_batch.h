@@ -21,8 +21,11 @@ typedef struct ImageBatch
     char filename[111];       /* filename of the image data */
     int shmid;                /* shared memory id for the image data */
     char uuid[37];            /* uuid of the image data */
-    int progress;             /* index of the last processed module (-1 if not started) */
+    int progress;             /* number of processed modules minus one (-1 if not started) */
     StorageMode storage_mode; /* storage mode for the image data */
+    int64_t enqueued_ms;      /* CLOCK_REALTIME time (ms) the batch entered its current queue, 0 if not queued */
+    uint32_t checksum;        /* CRC32C of the other fields, set while the batch sits in a priority queue */
+    uint32_t completed_nodes; /* modules of the pipeline that have run, one bit per module index */
 } ImageBatch;
 
 typedef struct ImageBatchFingerprint
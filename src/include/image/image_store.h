@@ -25,4 +25,12 @@ int image_batch_cleanup(ImageBatch *batch);
  */
 int image_batch_setup_storage(ImageBatch *batch, StorageMode storage_mode);
 
+/**
+ * Verify the CRC32C trailer of a persisted batch file written by an earlier run.
+ * Batches without a trailer, or persisted during this run, are accepted as is.
+ * @param batch Pointer to ImageBatch structure
+ * @return status code
+ */
+int image_batch_verify_data(ImageBatch *batch);
+
 #endif // DIPP_IMAGE_STORE_H
\ No newline at end of file
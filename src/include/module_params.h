@@ -0,0 +1,61 @@
+#ifndef DIPP_MODULE_PARAMS_H
+#define DIPP_MODULE_PARAMS_H
+
+#include <stdint.h>
+#include "dipp_config.h"
+
+// Accessor API for module parameters. Every distinct parameter key gets a process-wide
+// key id, so a module resolves its keys once, typically in init(), and then reads any
+// config handed to run() by id without comparing strings:
+//
+//   static int width_key;
+//   int init(void) { width_key = module_param_key("width"); return width_key < 0; }
+//   ImageBatch run(ImageBatch *batch, ModuleParameterList *config, int *error_pipe)
+//   {
+//       int width = module_param_int(config, width_key, 640);
+//       ...
+//   }
+
+#define MAX_PARAM_KEYS 256
+#define PARAM_SLOT_NONE UINT16_MAX // key id not set in a config
+
+// Key id of key, interning it if it is new; -1 if the key table is full.
+// Exported by DIPP to modules; call it from the processing thread (init, config loading).
+int module_param_key(const char *key);
+
+// Interned copy of the key with the given id, NULL if unknown
+const char *module_param_key_name(int key_id);
+
+// Parameter of config with the given key id, NULL if the config does not set it
+static inline const ModuleParameter *module_param_get(const ModuleParameterList *config, int key_id)
+{
+    if (key_id < 0 || (uint32_t)key_id >= config->n_key_index || config->key_index[key_id] == PARAM_SLOT_NONE)
+        return NULL;
+    return config->parameters[config->key_index[key_id]];
+}
+
+static inline int module_param_bool(const ModuleParameterList *config, int key_id, int fallback)
+{
+    const ModuleParameter *parameter = module_param_get(config, key_id);
+    return parameter && parameter->value_case == BOOL_VALUE ? parameter->bool_value : fallback;
+}
+
+static inline int module_param_int(const ModuleParameterList *config, int key_id, int fallback)
+{
+    const ModuleParameter *parameter = module_param_get(config, key_id);
+    return parameter && parameter->value_case == INT_VALUE ? parameter->int_value : fallback;
+}
+
+static inline float module_param_float(const ModuleParameterList *config, int key_id, float fallback)
+{
+    const ModuleParameter *parameter = module_param_get(config, key_id);
+    return parameter && parameter->value_case == FLOAT_VALUE ? parameter->float_value : fallback;
+}
+
+static inline const char *module_param_string(const ModuleParameterList *config, int key_id, const char *fallback)
+{
+    const ModuleParameter *parameter = module_param_get(config, key_id);
+    return parameter && parameter->value_case == STRING_VALUE ? parameter->string_value : fallback;
+}
+
+#endif // DIPP_MODULE_PARAMS_H
@@ -39,6 +39,10 @@ PARAM_DEFINE_STATIC_VMEM(PARAMID_PIPELINE_CONFIG_4, pipeline_config_4, PARAM_TYP
 PARAM_DEFINE_STATIC_VMEM(PARAMID_PIPELINE_CONFIG_5, pipeline_config_5, PARAM_TYPE_DATA, DATA_PARAM_SIZE, 0, PM_CONF, setup_pipeline, NULL, storage, VMEM_CONF_PIPELINE_5, NULL);
 PARAM_DEFINE_STATIC_VMEM(PARAMID_PIPELINE_CONFIG_6, pipeline_config_6, PARAM_TYPE_DATA, DATA_PARAM_SIZE, 0, PM_CONF, setup_pipeline, NULL, storage, VMEM_CONF_PIPELINE_6, NULL);
 
+/* Define the config index, a blob reference listing the pipelines and module configs with higher ids */
+void setup_config_index(param_t *param, int index);
+PARAM_DEFINE_STATIC_VMEM(PARAMID_CONFIG_INDEX, config_index, PARAM_TYPE_DATA, DATA_PARAM_SIZE, 0, PM_CONF, setup_config_index, NULL, storage, VMEM_CONFIG_INDEX, NULL);
+
 param_t *module_config_params[] = {
     &module_param_1, &module_param_2, &module_param_3, &module_param_4, &module_param_5,
     &module_param_6, &module_param_7, &module_param_8, &module_param_9, &module_param_10,
@@ -0,0 +1,15 @@
+#ifndef DIPP_COST_PROFILE_PARAM_H
+#define DIPP_COST_PROFILE_PARAM_H
+
+#include <param/param.h>
+#include "dipp_paramids.h"
+
+#define COST_PROFILE_PATH_SIZE 64
+
+/* Cost profile import/export, see COST_PROFILE_COMMAND */
+static uint8_t _cost_profile_cmd = 0;
+PARAM_DEFINE_STATIC_RAM(PARAMID_COST_PROFILE_CMD, cost_profile_cmd, PARAM_TYPE_UINT8, -1, 0, PM_CONF, NULL, NULL, &_cost_profile_cmd, "Set to 1 to import a cost profile, 2 to export the cost store");
+static char _cost_profile_path[COST_PROFILE_PATH_SIZE] = "";
+PARAM_DEFINE_STATIC_RAM(PARAMID_COST_PROFILE_PATH, cost_profile_path, PARAM_TYPE_STRING, COST_PROFILE_PATH_SIZE, 0, PM_CONF, NULL, NULL, _cost_profile_path, "File used by cost_profile_cmd, empty for the default");
+
+#endif
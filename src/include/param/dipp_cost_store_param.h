@@ -0,0 +1,12 @@
+#ifndef DIPP_COST_STORE_PARAM_H
+#define DIPP_COST_STORE_PARAM_H
+
+#include <param/param.h>
+#include "dipp_paramids.h"
+#include "vmem_storage.h"
+
+/* Define cost store parameters (0 selects the compiled-in default) */
+PARAM_DEFINE_STATIC_VMEM(PARAMID_COST_FLUSH_INTERVAL_MS, cost_flush_interval_ms, PARAM_TYPE_UINT32, -1, 0, PM_CONF, NULL, NULL, storage, VMEM_COST_FLUSH_INTERVAL_MS, "Interval (ms) at which cost cache changes are written to disk");
+PARAM_DEFINE_STATIC_VMEM(PARAMID_COST_BUCKETS_PER_OCTAVE, cost_buckets_per_octave, PARAM_TYPE_UINT8, -1, 0, PM_CONF, NULL, NULL, storage, VMEM_COST_BUCKETS_PER_OCTAVE, "Cost cache buckets per doubling of batch size and image count (max 8)");
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef DIPP_DRY_RUN_PARAM_H
+#define DIPP_DRY_RUN_PARAM_H
+
+#include <param/param.h>
+#include "dipp_paramids.h"
+#include "dipp_config.h"
+
+/* Dry-run estimates per pipeline id, best case (cheapest implementations) then worst case
+ * (costliest implementations) over the typical fingerprints, 0 while not estimated */
+static uint32_t _dry_run_latency[MAX_PIPELINE_ID * 2];
+PARAM_DEFINE_STATIC_RAM(PARAMID_DRY_RUN_LATENCY, dry_run_latency, PARAM_TYPE_UINT32, MAX_PIPELINE_ID * 2, sizeof(uint32_t), PM_TELEM, NULL, NULL, _dry_run_latency, "Estimated best and worst case latency (us) of each pipeline");
+static float _dry_run_energy[MAX_PIPELINE_ID * 2];
+PARAM_DEFINE_STATIC_RAM(PARAMID_DRY_RUN_ENERGY, dry_run_energy, PARAM_TYPE_FLOAT, MAX_PIPELINE_ID * 2, sizeof(float), PM_TELEM, NULL, NULL, _dry_run_energy, "Estimated best and worst case energy (uWh) of each pipeline");
+
+#endif
@@ -12,6 +12,36 @@
 /* Module timeout parameter */
 #define PARAMID_MODULE_TIMEOUT 4
 
+/* Queue sizing parameters */
+#define PARAMID_QUEUE_CAPACITY 5
+#define PARAMID_PARTIAL_QUEUE_LIMIT 6
+#define PARAMID_LOW_QUEUE_DEPTH 7
+
+/* Scheduling parameters */
+#define PARAMID_PIPELINE_WEIGHTS 8
+#define PARAMID_PARTIAL_AGING_MS 9
+#define PARAMID_SCHED_WAIT_HIST 50
+
+/* Cost store parameters */
+#define PARAMID_COST_FLUSH_INTERVAL_MS 51
+#define PARAMID_COST_PROFILE_CMD 52
+#define PARAMID_COST_PROFILE_PATH 53
+#define PARAMID_COST_BUCKETS_PER_OCTAVE 54
+
+/* Telemetry parameters */
+#define PARAMID_TELEMETRY_POLL_INTERVAL_MS 55
+
+/* Config index: pipelines and module configs beyond the config params */
+#define PARAMID_CONFIG_INDEX 56
+
+/* Dry-run estimates of the configured pipelines */
+#define PARAMID_DRY_RUN_LATENCY 57
+#define PARAMID_DRY_RUN_ENERGY 58
+
+/* Downlink compression of each pipeline's products */
+#define PARAMID_DOWNLINK_CODEC 59
+#define PARAMID_DOWNLINK_LEVEL 60
+
 /* Pipeline ids starting at 10 */
 #define PARAMID_PIPELINE_CONFIG_1 10
 #define PARAMID_PIPELINE_CONFIG_2 11
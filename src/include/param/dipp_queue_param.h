@@ -0,0 +1,13 @@
+#ifndef DIPP_QUEUE_PARAM_H
+#define DIPP_QUEUE_PARAM_H
+
+#include <param/param.h>
+#include "dipp_paramids.h"
+#include "vmem_storage.h"
+
+/* Define queue sizing parameters (0 selects the compiled-in default) */
+PARAM_DEFINE_STATIC_VMEM(PARAMID_QUEUE_CAPACITY, queue_capacity, PARAM_TYPE_UINT32, -1, 0, PM_CONF, NULL, NULL, storage, VMEM_QUEUE_CAPACITY, "Initial capacity of the priority queues");
+PARAM_DEFINE_STATIC_VMEM(PARAMID_PARTIAL_QUEUE_LIMIT, partial_queue_limit, PARAM_TYPE_UINT32, -1, 0, PM_CONF, NULL, NULL, storage, VMEM_PARTIAL_QUEUE_LIMIT, "Partial queue depth above which no new batches are started");
+PARAM_DEFINE_STATIC_VMEM(PARAMID_LOW_QUEUE_DEPTH, low_queue_depth, PARAM_TYPE_UINT32, -1, 0, PM_CONF, NULL, NULL, storage, VMEM_LOW_QUEUE_DEPTH, "Total queue depth below which best effort is used");
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef DIPP_SCHEDULER_PARAM_H
+#define DIPP_SCHEDULER_PARAM_H
+
+#include <param/param.h>
+#include "dipp_paramids.h"
+#include "dipp_config.h"
+#include "scheduler.h"
+#include "vmem_storage.h"
+
+/* Define scheduling parameters (0 selects the compiled-in default) */
+PARAM_DEFINE_STATIC_VMEM(PARAMID_PIPELINE_WEIGHTS, pipeline_weights, PARAM_TYPE_UINT8, MAX_PIPELINE_ID, sizeof(uint8_t), PM_CONF, NULL, NULL, storage, VMEM_PIPELINE_WEIGHTS, "Fair-share weight of each pipeline id");
+PARAM_DEFINE_STATIC_VMEM(PARAMID_PARTIAL_AGING_MS, partial_aging_ms, PARAM_TYPE_UINT32, -1, 0, PM_CONF, NULL, NULL, storage, VMEM_PARTIAL_AGING_MS, "Wait (ms) after which a partially processed batch is taken first");
+
+/* Per-pipeline wait-time histograms, SCHED_HIST_BUCKETS log2 ms buckets per pipeline */
+static uint32_t _sched_wait_hist[MAX_PIPELINE_ID * SCHED_HIST_BUCKETS];
+PARAM_DEFINE_STATIC_RAM(PARAMID_SCHED_WAIT_HIST, sched_wait_hist, PARAM_TYPE_UINT32, MAX_PIPELINE_ID * SCHED_HIST_BUCKETS, sizeof(uint32_t), PM_TELEM, NULL, NULL, _sched_wait_hist, "Queue wait-time histogram per pipeline (log2 ms buckets)");
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef DIPP_TELEMETRY_PARAM_H
+#define DIPP_TELEMETRY_PARAM_H
+
+#include <param/param.h>
+#include "dipp_paramids.h"
+#include "vmem_storage.h"
+
+/* Define telemetry parameters (0 selects the compiled-in default) */
+PARAM_DEFINE_STATIC_VMEM(PARAMID_TELEMETRY_POLL_INTERVAL_MS, telemetry_poll_interval_ms, PARAM_TYPE_UINT32, -1, 0, PM_CONF, NULL, NULL, storage, VMEM_TELEMETRY_POLL_INTERVAL_MS, "Interval (ms) at which the telemetry thread polls remote sensors");
+
+#endif
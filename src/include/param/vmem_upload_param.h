@@ -4,8 +4,13 @@
 #include <param/param.h>
 #include "vmem_storage.h"
 #include "dipp_paramids.h"
+#include "dipp_config.h"
 
 /* Define CSP parameter for radio node ID */
 PARAM_DEFINE_STATIC_VMEM(PARAMID_RADIO_NODE_ID, radio_node_id, PARAM_TYPE_UINT8, -1, 0, PM_CONF, NULL, NULL, storage, VMEM_RADIO_NODE_ID, "Radio CSP node ID");
 
+/* Define downlink compression parameters per pipeline (codec 0 stores products as produced, level 0 selects the compiled-in default) */
+PARAM_DEFINE_STATIC_VMEM(PARAMID_DOWNLINK_CODEC, downlink_codec, PARAM_TYPE_UINT8, MAX_PIPELINES, sizeof(uint8_t), PM_CONF, NULL, NULL, storage, VMEM_DOWNLINK_CODEC, "Downlink compression codec of each pipeline (0 none, 1 Brotli)");
+PARAM_DEFINE_STATIC_VMEM(PARAMID_DOWNLINK_LEVEL, downlink_level, PARAM_TYPE_UINT8, MAX_PIPELINES, sizeof(uint8_t), PM_CONF, NULL, NULL, storage, VMEM_DOWNLINK_LEVEL, "Downlink compression level of each pipeline (1-11)");
+
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef DIPP_PIPELINE_DRY_RUN_H
+#define DIPP_PIPELINE_DRY_RUN_H
+
+#include <stdint.h>
+#include "dipp_config.h"
+#include "cost_store.h"
+
+// Distinct cost store fingerprints a pipeline is estimated for, at most
+#define DRY_RUN_MAX_FINGERPRINTS 16
+// Effort combinations estimated per fingerprint: every module at the same effort level
+// (default, low, medium, high), then every module at its cheapest and at its most
+// expensive implementation
+#define DRY_RUN_COMBINATIONS 6
+#define DRY_RUN_CHEAPEST 4
+#define DRY_RUN_COSTLIEST 5
+
+// Static estimate of a pipeline. Latencies follow the critical path through the module
+// dependencies, energies add up over all modules; both are in the units of the cost store.
+typedef struct PipelineEstimate
+{
+    int fingerprints;      // fingerprints estimated for, 0 if only configured costs were known
+    int measured;          // module costs taken from the cost store rather than the configs
+    uint32_t latency_min[DRY_RUN_COMBINATIONS]; // over the fingerprints, per combination
+    uint32_t latency_max[DRY_RUN_COMBINATIONS];
+    float energy_min[DRY_RUN_COMBINATIONS];
+    float energy_max[DRY_RUN_COMBINATIONS];
+    uint32_t slowest_latency; // costliest implementation of any single module
+    int slowest_module;       // index of that module
+    int problems;             // modules that cannot run as configured, see the log
+} PipelineEstimate;
+
+// Estimate the costs of the pipeline from the cost store statistics of its modules,
+// falling back to the configured latency_cost/energy_cost, and log problems that would
+// only show once batches run (unloaded modules, implementations past the module timeout).
+void pipeline_dry_run(CostStore *store, const Pipeline *pipeline, PipelineEstimate *estimate);
+
+// Dry-run every pipeline whose configuration changed since its last dry run, log the
+// estimates and publish them in the dry-run telemetry params
+void pipeline_dry_run_changed(CostStore *store);
+
+#endif // DIPP_PIPELINE_DRY_RUN_H
@@ -7,6 +7,11 @@
 
 extern Heuristic *current_heuristic;
 
+// Node outputs of a partially executed DAG pipeline, per batch uuid
+#define DAG_CHECKPOINT_FILE "/usr/share/dipp/data/nodes_%s"
+#define DAG_CHECKPOINT_MAGIC 0x4744504E // "NPDG"
+#define PATH_MAX_CHECKPOINT 96
+
 // Retrieve the pipeline assigned to the image batch and
 // process the batch using this pipeline
 int load_pipeline_and_execute(ImageBatch *input_batch);
@@ -15,4 +20,9 @@ int load_pipeline_and_execute(ImageBatch *input_batch);
 // These are distinct modules (multiple effort levels count as one).
 int get_pipeline_length(int pipeline_id);
 
+// Outputs of the modules no other module depends on, i.e. the products to downlink once
+// the batch executed last has completed its pipeline. A linear pipeline has a single
+// product, the batch itself. Returns the number of products written to products.
+size_t get_pipeline_products(ImageBatch *batch, ImageBatch *products, size_t max);
+
 #endif // DIPP_PIPELINE_EXECUTOR_H
\ No newline at end of file
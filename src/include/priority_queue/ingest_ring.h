@@ -0,0 +1,73 @@
+#ifndef DIPP_INGEST_RING_H
+#define DIPP_INGEST_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "image_batch.h"
+
+// Bounded lock-free MPMC ring (Vyukov) staging batches between producers and the
+// scheduler. Producers never take the priority queue lock; the scheduler drains
+// the ring into the ingest heap in bursts.
+#define INGEST_RING_FILE "/usr/share/dipp/ingest_ring"
+#define INGEST_RING_CAPACITY 256 // must be a power of two
+
+#define INGEST_RING_MAGIC 0x474E5244 // "DRNG"
+#define INGEST_RING_VERSION 2
+#define INGEST_RING_HEADER_SIZE 4096
+
+// A slot claimed but not written for this long is skipped by the consumer, so a
+// producer dying between claim and publish does not stall the ring. A slot whose
+// claimer is known to have exited is skipped right away, and a slot it has started
+// writing is only skipped then.
+#define INGEST_CLAIM_TIMEOUT_MS 5000
+
+// Set in seq while the claimer writes the item, the consumer can no longer skip the slot then
+#define INGEST_SLOT_WRITING (1ull << 63)
+
+typedef struct IngestRingSlot
+{
+    uint64_t seq; // pos | INGEST_SLOT_WRITING while the item for pos is written, pos + 1 once it
+                  // is published, pos + capacity once the slot is free again
+    uint64_t claim_pos; // pos the claimer below claimed the slot for
+    int32_t claim_pid;  // process that claimed the slot
+    ImageBatch item;
+} IngestRingSlot;
+
+// Positions sit on their own cache lines so producers and the consumer do not false-share
+typedef struct IngestRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t record_size;
+    uint32_t boot_id; // boot the ring was last reset in, see pq_boot_id
+    uint64_t enqueue_pos __attribute__((aligned(64)));
+    uint64_t dequeue_pos __attribute__((aligned(64)));
+} IngestRingHeader;
+
+typedef struct IngestRing
+{
+    IngestRingHeader *header;
+    IngestRingSlot *slots;
+    uint64_t mask;
+    int fd; // backing file, -1 for anonymous rings
+    uint64_t stalled_pos;     // unpublished slot the consumer is waiting on
+    int64_t stalled_since_ms; // when it was first seen, -1 if not waiting
+} IngestRing;
+
+// Create or reopen the ring; a NULL filename gives a process-local ring.
+// A ring left by an earlier boot is compacted, keeping all published batches.
+int ingest_ring_init(IngestRing **ring, const char *filename, size_t capacity);
+// Attach to a ring initialised by a running DIPP instance in this boot
+int ingest_ring_attach(IngestRing **ring, const char *filename);
+// Publish a copy of item; returns 0, or -1 if the ring is full or the consumer skipped
+// the slot because the producer took longer than INGEST_CLAIM_TIMEOUT_MS to start writing it
+int ingest_ring_push(IngestRing *ring, const ImageBatch *item);
+// Take up to max published batches in FIFO order, dropping corrupt ones and skipping
+// slots whose producer died before publishing; returns the number taken
+size_t ingest_ring_pop_bulk(IngestRing *ring, ImageBatch *out, size_t max);
+// Number of claimed slots, wait-free and possibly slightly stale
+size_t ingest_ring_depth(IngestRing *ring);
+void ingest_ring_clean_up(IngestRing *ring);
+
+#endif // DIPP_INGEST_RING_H
@@ -3,31 +3,88 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <pthread.h>
 #include "image_batch.h"
 
-// Define maximum size of the priority queue
-#define MAX_QUEUE_SIZE 100
+// Defaults for the initial capacity and scheduling thresholds, used when the runtime params are not set
+#define DEFAULT_QUEUE_CAPACITY 100
 #define MAX_PARTIAL_QUEUE_SIZE 10
 #define LOW_QUEUE_DEPTH_THRESHOLD 30
 #define PARTIAL_QUEUE_SIZE_THRESHOLD 5
 
-// Define PriorityQueue structure
+// Hard upper bound for runtime growth of a queue
+#define PQ_MAX_CAPACITY 65536
+
+// Marks queue files whose items carry CRC32C checksums
+#define PQ_CHECKSUM_MAGIC 0x50514331 // "PQC1"
+
+// Versioned on-disk layout: one header page followed by capacity records
+#define PQ_FILE_MAGIC 0x51505044 // "DPPQ"
+#define PQ_FILE_VERSION 3
+#define PQ_HEADER_SIZE 4096
+
+// Queue files shared between DIPP and producers that enqueue directly
+#define INGEST_QUEUE_FILE "/usr/share/dipp/queue_file"
+#define PARTIAL_QUEUE_FILE "/usr/share/dipp/partially_processed_queue_file"
+
+// Persisted queue header. For mmap queues it is mapped separately from the
+// items, so it keeps its address when the item array grows, and it holds the
+// lock shared by every process that has the queue mapped.
+typedef struct PriorityQueueHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;     // number of item slots following the header page
+    uint32_t record_size;  // sizeof(ImageBatch) of the writer
+    int32_t size;          // number of items currently in the heap
+    uint32_t wake_seq;     // futex word, bumped on every enqueue
+    uint32_t waiters;      // consumers currently sleeping on wake_seq
+    uint32_t boot_id;      // boot the lock was initialised in; a lock from an earlier boot is stale
+    uint32_t needs_repair; // set when a lock owner died mid-operation
+    pthread_mutex_t lock;  // process-shared and robust for mmap queues
+} PriorityQueueHeader;
+
+// Process-local handle to a queue
 typedef struct PriorityQueue
 {
-    ImageBatch items[MAX_QUEUE_SIZE];
-    int size;
-    pthread_mutex_t lock;
+    PriorityQueueHeader *header;
+    ImageBatch *items;
+    size_t mapped_capacity; // item slots mapped by this process, may lag behind header->capacity
+    int fd;                 // backing file of mmap queues, unused for mem queues
+    void *backend;          // backend-private index, e.g. the calendar buckets
 } PriorityQueue;
 
 typedef struct PriorityQueueImpl
 {
-    // init takes PriorityQueue ** so the implementation can allocate or mmap the outer struct and assign *pq
-    int (*init)(PriorityQueue **pq, char *filename);
+    // init takes PriorityQueue ** so the implementation can allocate the handle and assign *pq.
+    // capacity is the initial number of slots; an existing mmap queue keeps its larger capacity.
+    int (*init)(PriorityQueue **pq, char *filename, size_t capacity);
     int (*enqueue)(PriorityQueue *pq, ImageBatch item);
+    // dequeue the head into a malloc'ed copy the caller frees; NULL when empty.
+    // Prefer dequeue_into on hot paths, it does not allocate.
     ImageBatch *(*dequeue)(PriorityQueue *pq);
+    // copy the head into out and remove it; returns 1 if an item was taken, 0 when empty
+    int (*dequeue_into)(PriorityQueue *pq, ImageBatch *out);
+    // like dequeue_into, but only takes the head if predicate (when non-NULL) accepts it.
+    // The check and the removal happen under one lock, so the head cannot change in between.
+    int (*dequeue_if)(PriorityQueue *pq, int (*predicate)(const ImageBatch *head, void *ctx), void *ctx, ImageBatch *out);
+    // enqueue count items under a single lock and durability point; returns the number enqueued
+    int (*enqueue_bulk)(PriorityQueue *pq, ImageBatch *items, size_t count);
+    // dequeue up to max items in priority order into out; returns the number dequeued
+    size_t (*dequeue_bulk)(PriorityQueue *pq, ImageBatch *out, size_t max);
+    // dequeue the earliest item for which match returns non-zero into out; returns 1 if one was taken
+    int (*dequeue_match)(PriorityQueue *pq, int (*match)(const ImageBatch *item, void *ctx), void *ctx, ImageBatch *out);
+    // dequeue up to max items whose deadline (priority) lies before now, earliest first
+    size_t (*dequeue_expired)(PriorityQueue *pq, int64_t now, ImageBatch *out, size_t max);
+    // returns a pointer into the queue storage; it is only valid while no other
+    // operation runs on the queue, so use peek_into when the queue is shared
     ImageBatch *(*peek)(PriorityQueue *pq);
+    // copy the head into out without removing it; returns 1 if the queue was non-empty
+    int (*peek_into)(PriorityQueue *pq, ImageBatch *out);
     size_t (*get_queue_size)(PriorityQueue *pq);
+    // grow the queue to hold at least capacity items
+    int (*grow)(PriorityQueue *pq, size_t capacity);
     int (*clean_up)(PriorityQueue *pq);
 } PriorityQueueImpl;
 
@@ -35,10 +92,46 @@ PriorityQueueImpl *get_priority_queue_impl(StorageMode storage_type);
 ImageBatch *peek(PriorityQueue *pq);
 void heapifyDown(PriorityQueue *pq, int index);
 void heapifyUp(PriorityQueue *pq, int index);
+void heapify(PriorityQueue *pq);
+void heapify_appended(PriorityQueue *pq, int old_size);
+void heap_remove_at(PriorityQueue *pq, int index);
+int heap_find_match(PriorityQueue *pq, int (*match)(const ImageBatch *item, void *ctx), void *ctx);
 size_t get_queue_size(PriorityQueue *pq);
 
+// Identifies the current boot, so state left in shared files by an earlier boot
+// (locks, half-published slots) is never trusted. Returns 0 if unavailable.
+uint32_t pq_boot_id();
+
+// Take the queue lock. If the previous owner died holding it, the lock is made
+// consistent again and the header is flagged so the heap gets repaired.
+void pq_lock(PriorityQueue *pq);
+void pq_unlock(PriorityQueue *pq);
+
+// Wake consumers sleeping in pq_wait; call after items were enqueued
+void pq_notify(PriorityQueue *pq);
+// Current wakeup sequence; sample it before checking the queue for work
+uint32_t pq_wake_seq(PriorityQueue *pq);
+// Sleep until an enqueue moves the sequence past seq or timeout_us elapses
+void pq_wait(PriorityQueue *pq, uint32_t seq, long timeout_us);
+
+// Capacity to grow to when a queue of the given capacity is full, 0 if it may not grow
+size_t pq_next_capacity(size_t capacity);
+// Capacity reached by repeated growth from capacity that holds needed items, as far as allowed
+size_t pq_capacity_for(size_t capacity, size_t needed);
+
+// Record when the item entered a queue, unless it already carries a timestamp
+void pq_stamp_item(ImageBatch *item);
+// Store the CRC32C of the item in its checksum field
+void pq_seal_item(ImageBatch *item);
+// Returns 1 if the item checksum matches its contents, 0 otherwise
+int pq_verify_item(const ImageBatch *item);
+
+// Attach to a queue file initialised by a running DIPP instance without creating or converting it
+int attach_pq_mmap(PriorityQueue **pq, const char *filename);
+
 extern PriorityQueueImpl priority_queue_mmap;
 extern PriorityQueueImpl priority_queue_mem;
+extern PriorityQueueImpl priority_queue_calendar;
 
 extern PriorityQueueImpl *pq_impl;
 
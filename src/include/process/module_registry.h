@@ -0,0 +1,42 @@
+#ifndef DIPP_MODULE_REGISTRY_H
+#define DIPP_MODULE_REGISTRY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "image_batch.h"
+#include "dipp_config.h"
+
+#define MODULE_DIRECTORY "/usr/share/pipeline"
+#define MODULE_PATH_SIZE 256
+
+// A module may appear in every pipeline, but distinct binaries are far fewer
+#define MAX_LOADED_MODULES (MAX_PIPELINES * MAX_MODULES)
+
+// Optional module hook, called once in the parent after loading and before any batch is
+// forked off, so expensive setup (lookup tables etc.) is inherited by every run.
+// A non-zero return fails the load.
+typedef int (*ModuleInitFunction)(void);
+
+// One loaded module binary, shared by every pipeline that references it
+typedef struct LoadedModule
+{
+    char path[MODULE_PATH_SIZE];
+    void *handle;
+    ProcessFunction run;
+    uint32_t build_id; // ELF build-id, or file identity if the module has none
+    // identity of the file the handle was opened from, a replaced binary is loaded anew
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime_ns;
+    int refcount;
+} LoadedModule;
+
+// Return the loaded module of that name with its reference count increased, loading it
+// (RTLD_NOW, run resolved, init called) unless the file is unchanged since the last load.
+// Returns NULL and sets the error param if it cannot be loaded.
+LoadedModule *module_registry_acquire(const char *module_name);
+
+// Drop a reference; the module is unloaded when the last pipeline lets go of it
+void module_registry_release(LoadedModule *module);
+
+#endif // DIPP_MODULE_REGISTRY_H
@@ -1,11 +1,19 @@
 #ifndef DIPP_PROCESS_MODULE_H
 #define DIPP_PROCESS_MODULE_H
 
+#include <sys/types.h>
 #include "image_batch.h"
 #include "dipp_config.h"
 
-extern int output_pipe[2]; // Pipe for inter-process result communication
-extern int error_pipe[2];  // Pipe for inter-process error communication
+extern int error_pipe[2]; // Error pipe of the module running in this process, used by the timeout handler
+
+// A module running in its own process
+typedef struct ModuleProcess
+{
+    pid_t pid;
+    int output_pipe[2]; // Pipe for inter-process result communication
+    int error_pipe[2];  // Pipe for inter-process error communication
+} ModuleProcess;
 
 // Pipeline run codes
 typedef enum PIPELINE_PROCESS
@@ -17,8 +25,22 @@ typedef enum PIPELINE_PROCESS
     PROCESS_WAIT_ALL = 4
 } PIPELINE_PROCESS;
 
+// Module timeout in seconds from the module_timeout param, 0 if modules never time out
+uint32_t module_timeout_s();
+
 // Spawn a new process to isolate the module execution from the rest of the system.
 // It sets up a timeout handler to kill the process if it exceeds the allowed time.
-int execute_module_in_process(ProcessFunction func, ImageBatch *input, ModuleParameterList *config);
+// Returns without waiting, so several modules may run at once.
+int start_module_process(ModuleProcess *process, ProcessFunction func, ImageBatch *input, ModuleParameterList *config);
+
+// Collect a module process that exited with the given wait status: read its result or
+// its error, and close its pipes. Returns -1 if the module failed.
+int finish_module_process(ModuleProcess *process, int status, ImageBatch *result);
+
+// Kill a module process that is still running, reap it and close its pipes
+void kill_module_process(ModuleProcess *process);
+
+// Run a module in a new process and wait for it
+int execute_module_in_process(ProcessFunction func, ImageBatch *input, ModuleParameterList *config, ImageBatch *result);
 
 #endif // DIPP_PROCESS_MODULE_H
\ No newline at end of file
@@ -69,10 +69,12 @@ struct  Metadata
   char *camera;
   size_t n_items;
   MetadataItem **items;
+  int32_t codec;
+  int32_t original_size;
 };
 #define METADATA__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&metadata__descriptor) \
-    , 0, 0, 0, 0, 0, 0, 0, (char *)protobuf_c_empty_string, 0,NULL }
+    , 0, 0, 0, 0, 0, 0, 0, (char *)protobuf_c_empty_string, 0,NULL, 0, 0 }
 
 
 /* MetadataItem methods */
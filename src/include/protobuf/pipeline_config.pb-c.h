@@ -54,9 +54,11 @@ struct ModuleDefinition
   char *name;
   size_t n_implementations;
   Implementation **implementations;
+  size_t n_depends_on;
+  int32_t *depends_on;
 };
 #define MODULE_DEFINITION__INIT \
-  {PROTOBUF_C_MESSAGE_INIT(&module_definition__descriptor), (char *)protobuf_c_empty_string, 0, NULL}
+  {PROTOBUF_C_MESSAGE_INIT(&module_definition__descriptor), (char *)protobuf_c_empty_string, 0, NULL, 0, NULL}
 
 /*
  * Define a message type for pipeline configuration
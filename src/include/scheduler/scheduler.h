@@ -0,0 +1,36 @@
+#ifndef DIPP_SCHEDULER_H
+#define DIPP_SCHEDULER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "image_batch.h"
+#include "priority_queue.h"
+#include "dipp_config.h"
+
+// Wait-time histograms use log2 buckets of milliseconds: bucket 0 holds waits below 1ms,
+// bucket b waits in [2^(b-1), 2^b) ms, and the last bucket everything longer
+#define SCHED_HIST_BUCKETS 16
+
+#define DEFAULT_PIPELINE_WEIGHT 1
+#define DEFAULT_PARTIAL_AGING_MS 5000 // partial batches waiting longer than this are taken first
+
+typedef struct SchedulingPolicy
+{
+    // Take the next batch to process from the two queues into out.
+    // Returns 1 if a batch was taken, 0 if there is nothing to process.
+    int (*next_batch)(PriorityQueue *partial_pq, PriorityQueue *ingest_pq, size_t partial_limit, ImageBatch *out);
+} SchedulingPolicy;
+
+// Relative share of processing a pipeline gets under contention (pipeline_id 1..MAX_PIPELINE_ID)
+uint32_t scheduler_pipeline_weight(int pipeline_id);
+// How long a partially processed batch may wait before it is taken ahead of its pipeline's turn
+uint32_t scheduler_partial_aging_ms();
+// Milliseconds the batch has spent in its current queue
+int64_t scheduler_wait_ms(const ImageBatch *batch);
+// Add the wait of a batch that was just taken to its pipeline's histogram
+void scheduler_record_wait(const ImageBatch *batch);
+
+extern SchedulingPolicy partial_first_policy;
+extern SchedulingPolicy fair_share_policy;
+
+#endif // DIPP_SCHEDULER_H
@@ -6,6 +6,32 @@
 #define PARAMID_MEASUREMENT_FLAG 903
 #define PARAMID_LAST_RECORDED_ENERGY 905
 #define ENERGY_NODE_ADDR 5412
+#define ENERGY_PULL_TIMEOUT_MS 500
+
+// Poll interval of the telemetry thread, used when the runtime param is not set
+#define DEFAULT_TELEMETRY_POLL_INTERVAL_MS 100
+
+// A reading missing this many polls in a row is considered stale
+#define TELEMETRY_STALE_POLLS 5
+
+// Sources the telemetry thread polls, see telemetry_enable
+#define TELEMETRY_SOURCE_ENERGY 0x1  // remote_energy of the power node, over CSP
+#define TELEMETRY_SOURCE_BATTERY 0x2 // battery_level
+
+// Latest readings of the telemetry thread. A reading is only meaningful if its valid
+// flag is set; its age tells how long ago it was taken.
+typedef struct TelemetrySnapshot
+{
+    float energy_uwh;         // cumulative energy of the remote node
+    int64_t energy_time_us;   // CLOCK_MONOTONIC time the energy was read
+    int64_t energy_age_us;    // age of the energy reading when the snapshot was taken
+    uint8_t energy_valid;
+    float battery_level_wh;
+    int64_t battery_time_us;
+    int64_t battery_age_us;
+    uint8_t battery_valid;
+    uint32_t sequence; // number of polls published so far
+} TelemetrySnapshot;
 
 /*
 Initialize the telemetry system by setting up remote parameters for energy measurement.
@@ -19,12 +45,30 @@ Returns 0 on success, -1 on failure.
 int start_energy_measurement();
 
 /*
-Stop the energy measurement on the remote node by clearing the measurement flag.
-Waits for the energy reading to change and returns the latest reading.
-Returns the energy reading in joules, or -1.0f on failure.
+Pull the cumulative energy reading (uWh) of the remote node. Blocks for a CSP round trip,
+so only the telemetry thread calls it; everyone else reads telemetry_snapshot.
+Returns the energy reading, or -1.0f on failure.
 */
 float get_energy_reading();
 
+/*
+Start polling the given TELEMETRY_SOURCE_* flags on the telemetry thread, in addition to
+the ones already enabled. The thread is started on first use. Returns 0 on success.
+*/
+int telemetry_enable(uint32_t sources);
+
+/*
+Copy the latest published readings into snapshot. Never blocks on CSP or on the
+telemetry thread; readings from a source that is not polled are marked invalid.
+*/
+void telemetry_snapshot(TelemetrySnapshot *snapshot);
+
+/*
+Battery level for the heuristics: the polled reading while it is fresh, otherwise the
+local battery_level param. Never blocks.
+*/
+float telemetry_battery_level_wh();
+
 void telemetry_run_param_mode_tests(void);
 
 #endif // DIPP_TELEMETRY_H
\ No newline at end of file
@@ -0,0 +1,12 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Compute the CRC32C (Castagnoli) checksum of len bytes, continuing from crc.
+// Pass 0 as crc to start a new checksum. Uses the SSE4.2 or ARMv8 CRC
+// instructions when the CPU supports them, otherwise a table-driven fallback.
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif // CRC32C_H
@@ -0,0 +1,36 @@
+#ifndef EXEC_CONTEXT_H
+#define EXEC_CONTEXT_H
+
+#include <stdint.h>
+
+// Sysfs/procfs sources of the execution context, the thermal zone is the SoC sensor on most boards
+#define EXEC_CONTEXT_FREQ_FILE "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq"
+#define EXEC_CONTEXT_LOAD_FILE "/proc/loadavg"
+#define EXEC_CONTEXT_THERMAL_FILE "/sys/class/thermal/thermal_zone0/temp"
+
+// Readings younger than this are reused instead of going back to sysfs
+#define EXEC_CONTEXT_REFRESH_MS 100
+
+// Latency is rescaled by at most this factor in either direction, so one bad reading
+// cannot turn a cached cost into nonsense
+#define EXEC_CONTEXT_MAX_SCALE 4.0f
+
+#define EXEC_CONTEXT_TEMP_UNKNOWN INT16_MIN
+
+// Conditions a latency was measured under
+typedef struct ExecutionContext
+{
+    uint32_t cpu_freq_khz; // current frequency of the CPU we run on, 0 if unknown
+    uint16_t runnable;     // runnable tasks system-wide (run-queue length), 0 if unknown
+    int16_t temp_decic;    // thermal zone reading in 0.1 degrees C, EXEC_CONTEXT_TEMP_UNKNOWN if unknown
+} ExecutionContext;
+
+// Fill ctx with the current conditions; a missing source leaves its field unknown
+void exec_context_read(ExecutionContext *ctx);
+
+// Predict a latency measured under measured for the conditions in current. CPU-bound work
+// scales with the clock (throttling shows up as a lower frequency) and with run-queue
+// contention beyond one task per online CPU. Unknown fields do not scale.
+uint32_t exec_context_scale_latency(uint32_t latency, const ExecutionContext *measured, const ExecutionContext *current);
+
+#endif // EXEC_CONTEXT_H
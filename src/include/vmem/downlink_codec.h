@@ -0,0 +1,30 @@
+#ifndef DIPP_DOWNLINK_CODEC_H
+#define DIPP_DOWNLINK_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compression of the image bytes of a product before it is written to the image ring.
+// The codec is recorded in the codec field of the observation metadata.
+typedef enum DownlinkCodec
+{
+    DOWNLINK_CODEC_NONE = 0,
+    DOWNLINK_CODEC_BROTLI = 1,
+} DownlinkCodec;
+
+#define DOWNLINK_CODEC_COUNT 2
+#define DOWNLINK_DEFAULT_LEVEL 5 // Brotli quality, 1 (fastest) to 11
+#define DOWNLINK_MAX_LEVEL 11
+
+// Name of the codec for logs, "unknown" for values outside DownlinkCodec
+const char *downlink_codec_name(int codec);
+
+// Size of the output buffer downlink_compress needs for len input bytes
+size_t downlink_max_compressed_size(DownlinkCodec codec, size_t len);
+
+// Compress len bytes of input into output at the given level (0 selects the default).
+// Returns the compressed length, or 0 if compression failed or did not save any bytes,
+// in which case the product is stored as it is.
+size_t downlink_compress(DownlinkCodec codec, int level, const uint8_t *input, size_t len, uint8_t *output, size_t output_size);
+
+#endif // DIPP_DOWNLINK_CODEC_H
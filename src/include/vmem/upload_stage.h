@@ -0,0 +1,27 @@
+#ifndef DIPP_UPLOAD_STAGE_H
+#define DIPP_UPLOAD_STAGE_H
+
+#include "image_batch.h"
+
+// Completed products waiting for the upload thread, at most
+#define UPLOAD_QUEUE_CAPACITY 8
+
+// Start the upload thread. Until it runs (or if it could not be started), products are
+// uploaded inline by upload_stage_submit. Returns 0 if the thread runs.
+int upload_stage_start();
+
+// Hand a completed product over to the upload thread, which reads, uploads and cleans
+// up its data. Only the descriptor is copied, the image data stays where the pipeline
+// left it. Blocks while the queue is full.
+void upload_stage_submit(const ImageBatch *product);
+
+// Returns 1 while the queue is full, so the scheduler holds back new batches
+int upload_stage_full();
+
+// Sleep until the queue has room or timeout_us elapses
+void upload_stage_wait_space(long timeout_us);
+
+// Upload what is queued and stop the thread; later products are uploaded inline
+void upload_stage_stop();
+
+#endif // DIPP_UPLOAD_STAGE_H
@@ -3,6 +3,10 @@
 
 #include <vmem/vmem.h>
 extern vmem_t vmem_storage;
+extern vmem_t vmem_configs;
+
+/* Configs too large for their param are uploaded here and referenced by a ConfigBlobRef */
+#define CONFIG_BLOB_VMEM_SIZE 262144
 
 #define VMEM_CONF_PIPELINE_1 0x00
 #define VMEM_CONF_PIPELINE_2 0xBC   // 188 bytes apart from previous address
@@ -35,5 +39,16 @@ extern vmem_t vmem_storage;
 #define VMEM_ERROR_CODE 0x1318      // 188 bytes apart from previous address
 #define VMEM_RADIO_NODE_ID 0x131C   // 4 bytes apart from previous address
 #define VMEM_MODULE_TIMEOUT 0x131D   // 1 bytes apart from previous address
+#define VMEM_QUEUE_CAPACITY 0x1321   // 4 bytes apart from previous address
+#define VMEM_PARTIAL_QUEUE_LIMIT 0x1325 // 4 bytes apart from previous address
+#define VMEM_LOW_QUEUE_DEPTH 0x1329  // 4 bytes apart from previous address
+#define VMEM_PARTIAL_AGING_MS 0x1333 // 6 bytes apart from previous address
+#define VMEM_COST_FLUSH_INTERVAL_MS 0x1337 // 4 bytes apart from previous address
+#define VMEM_COST_BUCKETS_PER_OCTAVE 0x133B // 4 bytes apart from previous address
+#define VMEM_TELEMETRY_POLL_INTERVAL_MS 0x133C // 1 byte apart from previous address
+#define VMEM_CONFIG_INDEX 0x1340 // 4 bytes apart from previous address
+#define VMEM_DOWNLINK_CODEC 0x13FC // 188 bytes apart from previous address
+#define VMEM_DOWNLINK_LEVEL 0x1402 // 6 bytes apart from previous address
+#define VMEM_PIPELINE_WEIGHTS 0x1408 // 6 bytes apart from previous address
 
 #endif
\ No newline at end of file
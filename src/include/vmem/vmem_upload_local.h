@@ -11,8 +11,9 @@
  * @param data Image batch data to upload to radio. 
  * @param num Amount of images to upload.
  * @param len Length of data to upload.
+ * @param pipeline_id Pipeline that produced the data, selects the downlink compression.
 */
-void upload(unsigned char *data, int num, int len);
+void upload(unsigned char *data, int num, int len, int pipeline_id);
 
 
 #endif
\ No newline at end of file
@@ -184,6 +184,7 @@ int main(int argc, char *argv[])
 	csp_bind_callback(param_serve, PARAM_PORT_SERVER);
 
 	vmem_file_init(&vmem_storage);
+	vmem_file_init(&vmem_configs);
 	vmem_ring_init(&vmem_images);
 
 	// initialize_telemetry();
@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include <string.h>
+#include "module_params.h"
+#include "murmur_hash.h"
+
+// Interned keys, open addressing on the key hash. Keys are never removed, so key ids
+// and the interned strings stay valid for the lifetime of the process.
+#define KEY_TABLE_SIZE (MAX_PARAM_KEYS * 2)
+
+static char *key_names[MAX_PARAM_KEYS];
+static int num_keys = 0;
+static int16_t key_table[KEY_TABLE_SIZE]; // key id + 1, 0 for an empty slot
+
+int module_param_key(const char *key)
+{
+    size_t len = strlen(key);
+    uint32_t slot = murmur3_32((const uint8_t *)key, len, 42) % KEY_TABLE_SIZE;
+    while (key_table[slot] != 0)
+    {
+        int key_id = key_table[slot] - 1;
+        if (strcmp(key_names[key_id], key) == 0)
+            return key_id;
+        slot = (slot + 1) % KEY_TABLE_SIZE;
+    }
+
+    if (num_keys == MAX_PARAM_KEYS)
+        return -1;
+    char *name = strdup(key);
+    if (name == NULL)
+        return -1;
+
+    key_names[num_keys] = name;
+    key_table[slot] = num_keys + 1;
+    return num_keys++;
+}
+
+const char *module_param_key_name(int key_id)
+{
+    return key_id >= 0 && key_id < num_keys ? key_names[key_id] : NULL;
+}
@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <string.h>
+#include "pipeline_dry_run.h"
+#include "dipp_dry_run_param.h"
+#include "process_module.h"
+#include "heuristics.h"
+#include "murmur_hash.h"
+#include "utils/exec_context.h"
+#include "utils/minitrace.h"
+
+static const char *combination_names[DRY_RUN_COMBINATIONS] = {"default", "low", "medium", "high", "cheapest", "costliest"};
+
+// Configuration stamp of each pipeline when it was last dry-run, indexed by pipeline id - 1
+static uint32_t dry_run_stamps[MAX_PIPELINE_ID];
+
+typedef struct Fingerprint
+{
+    uint8_t size_bucket;
+    uint8_t images_bucket;
+} Fingerprint;
+
+static void effort_param_ids(const Module *module, int param_ids[4])
+{
+    param_ids[EFFORT_LEVEL__DEFAULT] = module->default_effort_param_id;
+    param_ids[EFFORT_LEVEL__LOW] = module->low_effort_param_id;
+    param_ids[EFFORT_LEVEL__MEDIUM] = module->medium_effort_param_id;
+    param_ids[EFFORT_LEVEL__HIGH] = module->high_effort_param_id;
+}
+
+static int valid_param_id(int param_id)
+{
+    return param_id >= 0 && (size_t)param_id < num_module_configs;
+}
+
+// Typical fingerprints of the pipeline: the distinct buckets its implementations were
+// measured on, whichever pipeline they ran in
+static int collect_fingerprints(CostStore *store, const Pipeline *pipeline, Fingerprint *fingerprints)
+{
+    int count = 0;
+    for (int i = 0; i < MAX_ENTRIES && count < DRY_RUN_MAX_FINGERPRINTS; i++)
+    {
+        const CostEntry *entry = &store->items[i];
+        if (!entry->valid)
+            continue;
+
+        int used = 0;
+        for (size_t m = 0; m < pipeline->num_modules && !used; m++)
+        {
+            int param_ids[4];
+            effort_param_ids(&pipeline->modules[m], param_ids);
+            for (int e = 0; e < 4 && !used; e++)
+                used = valid_param_id(param_ids[e]) &&
+                       module_cost_seed(&pipeline->modules[m], &module_parameter_lists[param_ids[e]]) == entry->seed;
+        }
+        if (!used)
+            continue;
+
+        int known = 0;
+        for (int f = 0; f < count && !known; f++)
+            known = fingerprints[f].size_bucket == entry->size_bucket && fingerprints[f].images_bucket == entry->images_bucket;
+        if (!known)
+        {
+            fingerprints[count].size_bucket = entry->size_bucket;
+            fingerprints[count].images_bucket = entry->images_bucket;
+            count++;
+        }
+    }
+    return count;
+}
+
+// Cost of one implementation on a fingerprint (NULL: configured costs only), looked up
+// like the heuristics do: cached entry, then interpolation, then the configured costs
+static void implementation_cost(CostStore *store, const Pipeline *pipeline, const Module *module, int param_id,
+                                const Fingerprint *fingerprint, const ExecutionContext *now,
+                                uint32_t *latency, float *energy, int *measured)
+{
+    ModuleParameterList *config = &module_parameter_lists[param_id];
+    if (fingerprint)
+    {
+        CostKey key = cost_store_bucket_key(module_cost_seed(module, config), fingerprint->size_bucket,
+                                            fingerprint->images_bucket, pipeline->pipeline_id);
+        // find_entry, unlike lookup, leaves the LRU order alone
+        int idx = find_entry(store, key.hash);
+        if (idx != -1)
+        {
+            *latency = exec_context_scale_latency(store->items[idx].latency, &store->items[idx].context, now);
+            *energy = store->items[idx].energy;
+            (*measured)++;
+            return;
+        }
+        if (cost_store_estimate(store, &key, now, latency, energy))
+        {
+            (*measured)++;
+            return;
+        }
+    }
+
+    *latency = config->latency_cost ? (uint32_t)config->latency_cost : DEFAULT_EFFORT_LATENCY;
+    *energy = config->energy_cost ? (float)config->energy_cost : DEFAULT_EFFORT_ENERGY;
+}
+
+// Estimate every combination for one fingerprint and fold it into the estimate
+static void estimate_fingerprint(CostStore *store, const Pipeline *pipeline, const Fingerprint *fingerprint,
+                                 const ExecutionContext *now, PipelineEstimate *estimate, int first)
+{
+    uint32_t latency[MAX_MODULES][DRY_RUN_COMBINATIONS];
+    float energy[MAX_MODULES][DRY_RUN_COMBINATIONS];
+    memset(latency, 0, sizeof(latency));
+    memset(energy, 0, sizeof(energy));
+
+    for (size_t m = 0; m < pipeline->num_modules; m++)
+    {
+        const Module *module = &pipeline->modules[m];
+        int param_ids[4];
+        effort_param_ids(module, param_ids);
+
+        uint32_t level_latency[4] = {0};
+        float level_energy[4] = {0};
+        int available[4] = {0};
+        for (int e = 0; e < 4; e++)
+        {
+            if (!valid_param_id(param_ids[e]))
+                continue;
+            implementation_cost(store, pipeline, module, param_ids[e], fingerprint, now,
+                                &level_latency[e], &level_energy[e], &estimate->measured);
+            available[e] = 1;
+        }
+
+        int any = 0;
+        for (int e = 0; e < 4; e++)
+        {
+            // a level the module does not implement runs its default implementation
+            int level = available[e] ? e : EFFORT_LEVEL__DEFAULT;
+            latency[m][e] = level_latency[level];
+            energy[m][e] = level_energy[level];
+            if (!available[e])
+                continue;
+            if (!any || level_latency[e] < latency[m][DRY_RUN_CHEAPEST])
+                latency[m][DRY_RUN_CHEAPEST] = level_latency[e];
+            if (!any || level_energy[e] < energy[m][DRY_RUN_CHEAPEST])
+                energy[m][DRY_RUN_CHEAPEST] = level_energy[e];
+            if (level_latency[e] > latency[m][DRY_RUN_COSTLIEST])
+                latency[m][DRY_RUN_COSTLIEST] = level_latency[e];
+            if (level_energy[e] > energy[m][DRY_RUN_COSTLIEST])
+                energy[m][DRY_RUN_COSTLIEST] = level_energy[e];
+            any = 1;
+        }
+        if (latency[m][DRY_RUN_COSTLIEST] > estimate->slowest_latency)
+        {
+            estimate->slowest_latency = latency[m][DRY_RUN_COSTLIEST];
+            estimate->slowest_module = (int)m;
+        }
+    }
+
+    for (int c = 0; c < DRY_RUN_COMBINATIONS; c++)
+    {
+        // modules run once their dependencies completed, independent branches concurrently
+        uint32_t finish[MAX_MODULES];
+        uint32_t total_latency = 0;
+        float total_energy = 0.0f;
+        for (size_t m = 0; m < pipeline->num_modules; m++)
+        {
+            uint32_t start = 0;
+            for (size_t d = 0; d < m; d++)
+            {
+                if ((pipeline->modules[m].depends_on & (1u << d)) && finish[d] > start)
+                    start = finish[d];
+            }
+            finish[m] = start + latency[m][c];
+            if (finish[m] > total_latency)
+                total_latency = finish[m];
+            total_energy += energy[m][c];
+        }
+
+        if (first || total_latency < estimate->latency_min[c])
+            estimate->latency_min[c] = total_latency;
+        if (first || total_latency > estimate->latency_max[c])
+            estimate->latency_max[c] = total_latency;
+        if (first || total_energy < estimate->energy_min[c])
+            estimate->energy_min[c] = total_energy;
+        if (first || total_energy > estimate->energy_max[c])
+            estimate->energy_max[c] = total_energy;
+    }
+}
+
+// Modules that would fail once batches arrive
+static int check_modules(const Pipeline *pipeline, const PipelineEstimate *estimate)
+{
+    int problems = 0;
+    uint32_t timeout_s = module_timeout_s();
+    for (size_t m = 0; m < pipeline->num_modules; m++)
+    {
+        const Module *module = &pipeline->modules[m];
+        int param_ids[4];
+        effort_param_ids(module, param_ids);
+        int implemented = 0;
+        for (int e = 0; e < 4; e++)
+            implemented |= valid_param_id(param_ids[e]);
+
+        if (module->module_function == NULL)
+        {
+            printf("  module %zu (%s) is not loaded\n", m + 1, module->module_name);
+            problems++;
+        }
+        if (!implemented)
+        {
+            printf("  module %zu (%s) has no implementation\n", m + 1, module->module_name);
+            problems++;
+        }
+    }
+    if (timeout_s && estimate->slowest_latency > timeout_s * 1000000u)
+    {
+        const Module *module = &pipeline->modules[estimate->slowest_module];
+        printf("  module %d (%s) may exceed the module timeout of %u s (%u us)\n", estimate->slowest_module + 1,
+               module->module_name, timeout_s, estimate->slowest_latency);
+        problems++;
+    }
+    return problems;
+}
+
+void pipeline_dry_run(CostStore *store, const Pipeline *pipeline, PipelineEstimate *estimate)
+{
+    MTR_BEGIN_FUNC();
+    memset(estimate, 0, sizeof(*estimate));
+
+    ExecutionContext now;
+    exec_context_read(&now);
+
+    Fingerprint fingerprints[DRY_RUN_MAX_FINGERPRINTS];
+    estimate->fingerprints = store ? collect_fingerprints(store, pipeline, fingerprints) : 0;
+    if (estimate->fingerprints == 0)
+    {
+        // nothing measured yet, estimate from the configured costs
+        estimate_fingerprint(store, pipeline, NULL, &now, estimate, 1);
+    }
+    for (int f = 0; f < estimate->fingerprints; f++)
+        estimate_fingerprint(store, pipeline, &fingerprints[f], &now, estimate, f == 0);
+
+    estimate->problems = check_modules(pipeline, estimate);
+    MTR_END_FUNC();
+}
+
+// Changes whenever the pipeline or one of the module configs it uses is reloaded
+static uint32_t pipeline_stamp(const Pipeline *pipeline)
+{
+    uint32_t stamp = murmur3_32((const uint8_t *)&pipeline->generation, sizeof(pipeline->generation), pipeline->pipeline_id);
+    for (size_t m = 0; m < pipeline->num_modules; m++)
+    {
+        int param_ids[4];
+        effort_param_ids(&pipeline->modules[m], param_ids);
+        for (int e = 0; e < 4; e++)
+        {
+            if (valid_param_id(param_ids[e]))
+                stamp = murmur3_32((const uint8_t *)&module_parameter_lists[param_ids[e]].generation, sizeof(uint32_t), stamp);
+        }
+    }
+    return stamp | 1; // 0 marks pipelines never dry-run
+}
+
+void pipeline_dry_run_changed(CostStore *store)
+{
+    for (size_t p = 0; p < num_pipelines && p < MAX_PIPELINE_ID; p++)
+    {
+        Pipeline *pipeline = &pipelines[p];
+        if (pipeline->pipeline_id == 0 || pipeline->num_modules == 0)
+        {
+            if (dry_run_stamps[p])
+            {
+                for (int i = 0; i < 2; i++)
+                {
+                    param_set_uint32_array(&dry_run_latency, p * 2 + i, 0);
+                    param_set_float_array(&dry_run_energy, p * 2 + i, 0.0f);
+                }
+            }
+            dry_run_stamps[p] = 0;
+            continue;
+        }
+        uint32_t stamp = pipeline_stamp(pipeline);
+        if (stamp == dry_run_stamps[p])
+            continue;
+        dry_run_stamps[p] = stamp;
+
+        printf("Dry run of pipeline %d:\n", pipeline->pipeline_id);
+        PipelineEstimate estimate;
+        pipeline_dry_run(store, pipeline, &estimate);
+        printf("  %d fingerprints, %d measured costs, %d problems\n", estimate.fingerprints, estimate.measured, estimate.problems);
+        for (int c = 0; c < DRY_RUN_COMBINATIONS; c++)
+        {
+            printf("  %-9s latency %u-%u us, energy %.2f-%.2f\n", combination_names[c],
+                   estimate.latency_min[c], estimate.latency_max[c], estimate.energy_min[c], estimate.energy_max[c]);
+        }
+
+        param_set_uint32_array(&dry_run_latency, p * 2, estimate.latency_min[DRY_RUN_CHEAPEST]);
+        param_set_uint32_array(&dry_run_latency, p * 2 + 1, estimate.latency_max[DRY_RUN_COSTLIEST]);
+        param_set_float_array(&dry_run_energy, p * 2, estimate.energy_min[DRY_RUN_CHEAPEST]);
+        param_set_float_array(&dry_run_energy, p * 2 + 1, estimate.energy_max[DRY_RUN_COSTLIEST]);
+        MTR_INSTANT_I(__FILE__, "pipeline_dry_run", "pipeline_id", pipeline->pipeline_id);
+    }
+}
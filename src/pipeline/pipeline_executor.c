@@ -1,224 +1,391 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <pthread.h>
+#include <sys/wait.h>
 #include "pipeline_executor.h"
 #include "process_module.h"
 #include "cost_store.h"
 #include "heuristics.h"
 #include "vmem_upload_local.h"
-#include "telemetry.h"
+#include "energy_sensor.h"
 #include "dipp_config.h"
 #include "image_batch.h"
 #include "dipp_error.h"
+#include "crc32c.h"
 #include "utils/minitrace.h"
 #include "battery_simulator.h"
 
-// Execute the pipeline on the given batch. It picks up from the possibly partially executed state,
-// and for each module it picks the best effort level that fulfills the requirements based on the current state.
-// If no such effort level is found, it stops the execution and returns an error.
-int execute_pipeline(Pipeline *pipeline, ImageBatch *data)
+// Module outputs of the batch executed last. A linear pipeline passes each output on
+// in the batch itself; a DAG keeps the batch pointing at the pipeline input and the
+// node outputs here, checkpointed to a file while the batch waits in the partial queue.
+typedef struct NodeOutputs
 {
-    MTR_BEGIN_FUNC();
-    /* Initiate communication pipes */
-    if (pipe(output_pipe) == -1 || pipe(error_pipe) == -1)
+    uint32_t magic;
+    uint32_t completed; // modules whose output is in outputs
+    ImageBatch outputs[MAX_MODULES];
+    uint32_t crc; // CRC32C of the fields above
+} NodeOutputs;
+
+static NodeOutputs node_outputs;
+static char node_outputs_uuid[37];
+
+// A module of the pipeline running in its own process
+typedef struct RunningModule
+{
+    ModuleProcess process;
+    int module_idx;
+    int module_param_id;
+    COST_MODEL_LOOKUP_RESULT lookup_result;
+    CostKey picked_key;
+    ExecutionContext context;
+    struct timespec start;
+    double start_energy;
+    int have_start_energy;
+    int overlapped; // other modules ran at the same time, so the energy reading is shared
+} RunningModule;
+
+static void checkpoint_path(const char *uuid, char *path, size_t size)
+{
+    snprintf(path, size, DAG_CHECKPOINT_FILE, uuid);
+}
+
+// Persist the node outputs, so the batch resumes at node granularity after a restart
+static void save_checkpoint(const char *uuid)
+{
+    char path[PATH_MAX_CHECKPOINT];
+    char tmp_path[PATH_MAX_CHECKPOINT + 4];
+    checkpoint_path(uuid, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    node_outputs.magic = DAG_CHECKPOINT_MAGIC;
+    node_outputs.crc = crc32c(0, &node_outputs, offsetof(NodeOutputs, crc));
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || write(fd, &node_outputs, sizeof(node_outputs)) != sizeof(node_outputs) ||
+        fdatasync(fd) == -1 || rename(tmp_path, path) == -1)
     {
-        set_error_param(PIPE_CREATE);
-        return -1;
+        printf("Failed to checkpoint batch %s (%s)\n", uuid, strerror(errno));
+        unlink(tmp_path);
     }
+    if (fd != -1)
+        close(fd);
+}
+
+static int load_checkpoint(const char *uuid, uint32_t completed)
+{
+    if (strncmp(node_outputs_uuid, uuid, sizeof(node_outputs_uuid)) == 0 && node_outputs.completed == completed)
+        return 0; // still in memory from the last run
 
-    printf("Starting pipeline execution from module %d out of %zu modules\n", data->progress + 1, pipeline->num_modules);
+    char path[PATH_MAX_CHECKPOINT];
+    checkpoint_path(uuid, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    ssize_t res = read(fd, &node_outputs, sizeof(node_outputs));
+    close(fd);
 
-    for (size_t i = data->progress + 1; i < pipeline->num_modules; ++i)
+    if (res != sizeof(node_outputs) || node_outputs.magic != DAG_CHECKPOINT_MAGIC ||
+        node_outputs.crc != crc32c(0, &node_outputs, offsetof(NodeOutputs, crc)) ||
+        node_outputs.completed != completed)
+        return -1;
+    return 0;
+}
+
+static void remove_checkpoint(const char *uuid)
+{
+    char path[PATH_MAX_CHECKPOINT];
+    checkpoint_path(uuid, path, sizeof(path));
+    unlink(path);
+}
+
+// Completed modules of the batch; queue records from before DAG pipelines only carry progress
+static uint32_t batch_completed_nodes(Pipeline *pipeline, ImageBatch *data)
+{
+    uint32_t all = (1u << pipeline->num_modules) - 1;
+    uint32_t completed = data->completed_nodes;
+    if (completed == 0 && data->progress >= 0)
+        completed = data->progress + 1 < MAX_MODULES ? (1u << (data->progress + 1)) - 1 : all;
+    return completed & all;
+}
+
+// Pick an effort level for the module and start it. Returns 1 if no effort level
+// fulfills the requirements, so the module is not started, and -1 on errors.
+static int start_module(Pipeline *pipeline, ImageBatch *data, ImageBatch *input, uint32_t started, RunningModule *run)
+{
+    Module *module = &pipeline->modules[run->module_idx];
+
+    // the heuristic splits the remaining budget over the modules not started yet
+    ImageBatch view = *input;
+    view.priority = data->priority;
+    view.progress = __builtin_popcount(started & ~(1u << run->module_idx)) - 1;
+
+    run->module_param_id = -1;
+    // pick the module effort level using the currently set heuristic
+    run->lookup_result = current_heuristic->heuristic_function(module, &view, pipeline->num_modules, &run->module_param_id, &run->picked_key);
+
+    // No new progress can be made on this branch, as no module fulfills the requirements
+    if (run->lookup_result == NOT_FOUND)
+        return 1;
+
+    err_current_module = run->module_idx + 1;
+    ProcessFunction module_function = module->module_function;
+    if (module_function == NULL)
     {
-        MTR_BEGIN_I(__FILE__, "execute_module_loop", "module_index", i);
-        int module_param_id = -1;
-        uint32_t picked_hash;
+        // the module failed to load, retry loading this pipeline before its next batch
+        set_error_param(INTERNAL_SO_NOT_FOUND);
+        invalidate_pipeline(pipeline->pipeline_id);
+        return -1;
+    }
+    // pick the module with selected effort level
+    ModuleParameterList *module_config = &module_parameter_lists[run->module_param_id];
 
-        printf("Starting the execution of %ldth module\n", i);
+    // the profiling information is not found, collect it here
+    if (run->lookup_result == FOUND_NOT_CACHED)
+    {
+        // conditions the sample is taken under, so lookups can rescale it later
+        exec_context_read(&run->context);
+        MTR_COUNTER(__FILE__, "cpu_freq_khz", run->context.cpu_freq_khz);
+        MTR_COUNTER(__FILE__, "runnable_tasks", run->context.runnable);
+        MTR_COUNTER(__FILE__, "temp_decic", run->context.temp_decic);
 
-        // printf("Looking up the best param_id using heuristic\r\n");
-        // pick the module effort level using the currently set heuristic
-        COST_MODEL_LOOKUP_RESULT lookup_result = current_heuristic->heuristic_function(&pipeline->modules[i], data, pipeline->num_modules, &module_param_id, &picked_hash);
-        // printf("Got back a param_id=%d\r\n", module_param_id);
+        clock_gettime(CLOCK_MONOTONIC, &run->start);
 
-        // No new progress can be made, as no module fulfills the requirements
-        if (lookup_result == NOT_FOUND)
-        {
-            // printf("No matching module found. No effort level fulfills the requirements\r\n");
-            /* Close all active pipes */
-            close(output_pipe[0]); // Close the read end of the pipe
-            close(output_pipe[1]); // Close the write end of the pipe
-            close(error_pipe[0]);
-            close(error_pipe[1]);
-            MTR_END(__FILE__, "execute_module_loop");
-            MTR_END_FUNC();
-            return 0;
-        }
+        // Get starting energy reading from the sampler, this never blocks on the sensor
+        run->have_start_energy = energy_sensor_now(&run->start_energy) == 0;
+    }
 
-        err_current_module = i + 1;
-        ProcessFunction module_function = pipeline->modules[i].module_function;
-        // pick the module with selected effort level
-        ModuleParameterList *module_config = &module_parameter_lists[module_param_id];
-
-        // printf("Here is the module config: Num params=%zu, Hash=%u, Latency=%u, Energy=%u\r\n",
-        //        module_config->n_parameters,
-        //        module_config->hash,
-        //        module_config->latency_cost,
-        //        module_config->energy_cost);
-        // for (size_t p = 0; p < module_config->n_parameters; ++p)
-        // {
-        //     ModuleParameter *param = module_config->parameters[p];
-        //     printf("Param %zu: Name=%s, Type=%d, Value=", p, param->key, param->value_case);
-        //     switch (param->value_case)
-        //     {
-        //     case BOOL_VALUE:
-        //         printf("%d\r\n", param->bool_value);
-        //         break;
-        //     case INT_VALUE:
-        //         printf("%d\r\n", param->int_value);
-        //         break;
-        //     case FLOAT_VALUE:
-        //         printf("%f\r\n", param->float_value);
-        //         break;
-        //     case STRING_VALUE:
-        //         printf("%s\r\n", param->string_value);
-        //         break;
-        //     default:
-        //         printf("Unknown parameter type\r\n");
-        //         break;
-        //     }
-        // }
-
-        // measure time to execute the module
-        struct timespec start, end;
-        uint32_t start_energy = 0, end_energy = 0;
-        long elapsed_us = 0;
-
-        // the profiling information is not found, collect it here
-        if (lookup_result == FOUND_NOT_CACHED)
-        {
-            clock_gettime(CLOCK_MONOTONIC, &start);
+    printf("Starting the execution of module %d\n", run->module_idx + 1);
+    MTR_INSTANT_I(__FILE__, "start_module", "module_index", run->module_idx);
+    return start_module_process(&run->process, module_function, input, module_config);
+}
 
-            // Get starting energy reading
-            start_energy = get_energy_reading();
-        }
+// Collect a finished module; on success its output is stored and the cost store updated
+static int finish_module(Pipeline *pipeline, ImageBatch *data, RunningModule *run, int status)
+{
+    ModuleParameterList *module_config = &module_parameter_lists[run->module_param_id];
+    struct timespec end;
+    double end_energy = 0;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    int have_end_energy = energy_sensor_now(&end_energy) == 0;
 
-        // printf("Starting execution in process\r\n");
-        int module_status = execute_module_in_process(module_function, data, module_config);
-        // printf("Finished execution\r\n");
+    ImageBatch result;
+    if (finish_module_process(&run->process, status, &result) != 0)
+    {
+        err_current_module = run->module_idx + 1;
+        return -1;
+    }
 
-        float energy_cost = 0;
+    if (run->lookup_result == FOUND_NOT_CACHED)
+    {
+        // Use the measured energy, or the estimate from the module config without a sensor
+        // or when concurrent modules drew from the same reading
+        float energy_cost;
+        if (!run->overlapped && run->have_start_energy && have_end_energy && end_energy >= run->start_energy)
+            energy_cost = (float)(end_energy - run->start_energy);
+        else
+            energy_cost = module_config->energy_cost;
 
-        // the profiling information is not found, collect it here
-        if (lookup_result == FOUND_NOT_CACHED)
-        {
-            // measure time to execute the module
-            clock_gettime(CLOCK_MONOTONIC, &end);
+        long elapsed_us = (end.tv_sec - run->start.tv_sec) * 1000000L + (end.tv_nsec - run->start.tv_nsec) / 1000L;
 
-            // Get ending energy reading
-            // end_energy = get_energy_reading();
+        // Store both latency and energy cost in cache
+        printf("Inserting into cache. Latency=%ld us, Energy=%.2f uWh\n", elapsed_us, energy_cost);
+        cost_store_impl->insert(cost_store, &run->picked_key, elapsed_us, energy_cost, &run->context);
+        MTR_INSTANT_I(__FILE__, "latency cache update", "latency_us", (int)elapsed_us);
+        MTR_INSTANT_I(__FILE__, "energy cache update", "energy_uwh", (int)(energy_cost * SIMULATION_STEPS_PER_UPDATE));
+        put_load_on_battery(energy_cost * SIMULATION_STEPS_PER_UPDATE); // scale to fit simulation step size
+    }
 
-            // Calculate energy cost (0 if readings failed)
-            // energy_cost = (start_energy && end_energy) ? (end_energy - start_energy) : 0;
-            energy_cost = module_config->energy_cost; // Use estimated energy cost from module config for now
+    // the module output, described like the batch it came from
+    ImageBatch *output = &node_outputs.outputs[run->module_idx];
+    *output = *data;
+    output->data = NULL;
+    output->num_images = result.num_images;
+    output->batch_size = result.batch_size;
+    output->pipeline_id = result.pipeline_id;
+    output->priority = result.priority;
+    output->shmid = result.shmid;
+    strcpy(output->uuid, result.uuid);
+    strcpy(output->filename, result.filename);
+    node_outputs.completed |= 1u << run->module_idx;
 
-            elapsed_us = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000L;
-        }
+    data->completed_nodes = node_outputs.completed;
+    data->progress = __builtin_popcount(node_outputs.completed) - 1;
+    if (pipeline->is_linear)
+    {
+        // update the image batch metadata before the next module
+        data->num_images = output->num_images;
+        data->batch_size = output->batch_size;
+        data->pipeline_id = output->pipeline_id;
+        data->priority = output->priority;
+        data->shmid = output->shmid;
+        strcpy(data->uuid, output->uuid);
+        strcpy(data->filename, output->filename);
+    }
+    return 0;
+}
 
-        // error encountered, clean up
-        if (module_status == -1)
-        {
-            /* Close all active pipes */
-            close(output_pipe[0]); // Close the read end of the pipe
-            close(output_pipe[1]); // Close the write end of the pipe
-            close(error_pipe[0]);
-            close(error_pipe[1]);
-            MTR_END(__FILE__, "execute_module_loop");
-            MTR_END_FUNC();
-            return -1;
-        }
+// Execute the pipeline on the given batch. It picks up from the possibly partially executed state
+// and runs every module whose dependencies have completed, independent branches concurrently.
+// For each module it picks the best effort level that fulfills the requirements based on the current
+// state; a module without one is skipped together with everything that depends on it.
+int execute_pipeline(Pipeline *pipeline, ImageBatch *data)
+{
+    MTR_BEGIN_FUNC();
+    uint32_t all = (1u << pipeline->num_modules) - 1;
+    uint32_t completed = batch_completed_nodes(pipeline, data);
+    const char *uuid = data->uuid;
 
-        if (lookup_result == FOUND_NOT_CACHED)
+    if (!pipeline->is_linear && completed != 0 && load_checkpoint(uuid, completed) != 0)
+    {
+        printf("No checkpoint for batch %s, restarting its pipeline\n", uuid);
+        completed = 0;
+    }
+    if (pipeline->is_linear || completed == 0)
+    {
+        memset(&node_outputs, 0, sizeof(node_outputs));
+        if (completed != 0)
+            node_outputs.outputs[31 - __builtin_clz(completed)] = *data; // the last output travels in the batch
+    }
+    node_outputs.completed = completed;
+    data->completed_nodes = completed;
+    data->progress = __builtin_popcount(completed) - 1;
+    strncpy(node_outputs_uuid, uuid, sizeof(node_outputs_uuid) - 1);
+    node_outputs_uuid[sizeof(node_outputs_uuid) - 1] = '\0';
+
+    printf("Starting pipeline execution with %d of %zu modules done\n", data->progress + 1, pipeline->num_modules);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_parallel = cpus < 1 ? 1 : cpus > MAX_MODULES ? MAX_MODULES : (int)cpus;
+
+    RunningModule running[MAX_MODULES];
+    int num_running = 0;
+    uint32_t started = completed; // completed, running or skipped
+    int failed = 0;
+    while (1)
+    {
+        // start every module whose dependencies are done while cores are free
+        for (size_t i = 0; !failed && i < pipeline->num_modules && num_running < max_parallel; i++)
         {
-            // Store both latency and energy cost in cache
-            printf("Inserting into cache. Latency=%ld us, Energy=%.2f uWh\n", elapsed_us, energy_cost);
-            cost_store_impl->insert(cost_store, picked_hash, elapsed_us, energy_cost);
-            MTR_INSTANT_I(__FILE__, "latency cache update", "latency_us", (int)elapsed_us);
-            MTR_INSTANT_I(__FILE__, "energy cache update", "energy_uwh", (int)(energy_cost * SIMULATION_STEPS_PER_UPDATE));
-            put_load_on_battery(energy_cost * SIMULATION_STEPS_PER_UPDATE); // scale to fit simulation step size
+            Module *module = &pipeline->modules[i];
+            if ((started & (1u << i)) || (module->depends_on & node_outputs.completed) != module->depends_on)
+                continue;
+
+            RunningModule *run = &running[num_running];
+            memset(run, 0, sizeof(*run));
+            run->module_idx = i;
+            ImageBatch *input = module->input_module < 0 ? data : &node_outputs.outputs[module->input_module];
+            int res = start_module(pipeline, data, input, started | (1u << i), run);
+            started |= 1u << i;
+            if (res == 1)
+                continue; // skipped, and so is everything depending on it
+            if (res == -1)
+            {
+                failed = 1;
+                break;
+            }
+
+            num_running++;
+            if (num_running > 1)
+            {
+                for (int r = 0; r < num_running; r++)
+                    running[r].overlapped = 1;
+            }
         }
 
-        ImageBatch result;
-        int res = read(output_pipe[0], &result, sizeof(result)); // Read the result from the pipe
-        if (res == -1)
+        if (num_running == 0)
+            break;
+
+        // wait for any of the modules, all children of this process are module runs
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid == -1)
         {
-            set_error_param(PIPE_READ);
-            MTR_END(__FILE__, "execute_module_loop");
+            if (errno == EINTR)
+                continue;
+            for (int r = 0; r < num_running; r++)
+                kill_module_process(&running[r].process);
+            set_error_param(MODULE_EXIT_CRASH);
             MTR_END_FUNC();
             return -1;
         }
-        if (res == 0)
+        for (int r = 0; r < num_running; r++)
         {
-            set_error_param(PIPE_EMPTY);
-            MTR_END(__FILE__, "execute_module_loop");
-            MTR_END_FUNC();
-            return -1;
+            if (running[r].process.pid != pid)
+                continue;
+            if (finish_module(pipeline, data, &running[r], status) != 0)
+                failed = 1;
+            running[r] = running[--num_running];
+            break;
         }
-
-        // update the image batch metadata before the next module
-        data->num_images = result.num_images;
-        data->batch_size = result.batch_size;
-        data->pipeline_id = result.pipeline_id;
-        data->priority = result.priority;
-        data->progress = result.progress;
-        data->shmid = result.shmid;
-        strcpy(data->uuid, result.uuid);
-        strcpy(data->filename, result.filename);
-
-        MTR_END(__FILE__, "execute_module_loop");
     }
 
-    /* Close communication pipes */
-    close(output_pipe[0]); // Close the read end of the pipe
-    close(output_pipe[1]); // Close the write end of the pipe
-    close(error_pipe[0]);
-    close(error_pipe[1]);
+    if (!pipeline->is_linear)
+    {
+        // a failed batch is dropped, so it does not need its checkpoint either
+        if (node_outputs.completed == all || failed)
+            remove_checkpoint(uuid);
+        else if (node_outputs.completed != 0)
+            save_checkpoint(uuid);
+    }
 
     MTR_END_FUNC();
 
-    return 0;
+    return failed ? -1 : 0;
 }
 
 // Retrieve a pointer to the pipeline with the given ID.
 // Set a corresponding error if pipeline ID not found.
 int get_pipeline_by_id(int pipeline_id, Pipeline **pipeline)
 {
-    for (size_t i = 0; i < MAX_PIPELINES; i++)
+    *pipeline = get_pipeline(pipeline_id);
+    if (*pipeline == NULL)
     {
-        if (pipelines[i].pipeline_id == pipeline_id)
-        {
-            *pipeline = &pipelines[i];
-            return 0;
-        }
+        set_error_param(INTERNAL_PID_NOT_FOUND);
+        return -1;
     }
-    set_error_param(INTERNAL_PID_NOT_FOUND);
-    return -1;
+    return 0;
 }
 
 int get_pipeline_length(int pipeline_id)
 {
-    for (size_t i = 0; i < MAX_PIPELINES; i++)
+    Pipeline *pipeline = get_pipeline(pipeline_id);
+    if (pipeline == NULL)
     {
-        if (pipelines[i].pipeline_id == pipeline_id)
-        {
-            return pipelines[i].num_modules;
-        }
+        set_error_param(INTERNAL_PID_NOT_FOUND);
+        return -1;
     }
-    set_error_param(INTERNAL_PID_NOT_FOUND);
-    return -1;
+    return pipeline->num_modules;
+}
+
+size_t get_pipeline_products(ImageBatch *batch, ImageBatch *products, size_t max)
+{
+    Pipeline *pipeline;
+    if (get_pipeline_by_id(batch->pipeline_id, &pipeline) == -1)
+        return 0;
+
+    if (pipeline->is_linear)
+    {
+        if (max == 0)
+            return 0;
+        products[0] = *batch;
+        return 1;
+    }
+
+    size_t count = 0;
+    if (strncmp(node_outputs_uuid, batch->uuid, sizeof(node_outputs_uuid)) != 0)
+        return 0;
+    for (size_t i = 0; i < pipeline->num_modules && count < max; i++)
+    {
+        if ((pipeline->products & (1u << i)) && (node_outputs.completed & (1u << i)))
+            products[count++] = node_outputs.outputs[i];
+    }
+    return count;
 }
 
 int load_pipeline_and_execute(ImageBatch *input_batch)
@@ -231,4 +398,4 @@ int load_pipeline_and_execute(ImageBatch *input_batch)
     err_current_pipeline = pipeline->pipeline_id;
 
     return execute_pipeline(pipeline, input_batch);
-}
\ No newline at end of file
+}
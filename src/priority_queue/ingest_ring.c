@@ -0,0 +1,357 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include "ingest_ring.h"
+#include "priority_queue.h"
+
+#define RING_SIZE(capacity) (INGEST_RING_HEADER_SIZE + (size_t)(capacity) * sizeof(IngestRingSlot))
+// A publish takes microseconds, the claimer of a slot unpublished for longer is looked up
+#define CLAIMER_CHECK_MS 100
+
+static size_t round_up_pow2(size_t capacity)
+{
+    size_t pow2 = 2;
+    while (pow2 < capacity)
+        pow2 <<= 1;
+    return pow2;
+}
+
+// Mark every slot free for the first lap and rewind both positions
+static void reset_ring(IngestRing *ring)
+{
+    for (uint64_t i = 0; i <= ring->mask; i++)
+    {
+        __atomic_store_n(&ring->slots[i].seq, i, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&ring->header->enqueue_pos, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->header->dequeue_pos, 0, __ATOMIC_RELEASE);
+}
+
+// A ring from an earlier boot may have holes where a producer claimed a slot and died
+// before publishing it. No producer can be attached yet, so keep the published batches
+// and rebuild the ring around them.
+static void compact_ring(IngestRing *ring)
+{
+    uint64_t start = ring->header->dequeue_pos;
+    uint64_t end = ring->header->enqueue_pos;
+    if (end - start > ring->mask + 1)
+        end = start; // positions are garbage, nothing to recover
+
+    ImageBatch *kept = malloc((end - start) * sizeof(ImageBatch) + 1);
+    size_t count = 0;
+    for (uint64_t pos = start; kept && pos != end; pos++)
+    {
+        IngestRingSlot *slot = &ring->slots[pos & ring->mask];
+        if (slot->seq == pos + 1)
+            kept[count++] = slot->item;
+    }
+
+    if (end - start != count)
+        printf("Ingest ring had %zu unpublished slots, skipping them\n", (size_t)(end - start) - count);
+
+    reset_ring(ring);
+    for (size_t i = 0; i < count; i++)
+    {
+        ring->slots[i].item = kept[i];
+        __atomic_store_n(&ring->slots[i].seq, i + 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&ring->header->enqueue_pos, count, __ATOMIC_RELEASE);
+    free(kept);
+}
+
+static IngestRing *map_ring(int fd, size_t capacity)
+{
+    int flags = fd == -1 ? MAP_SHARED | MAP_ANONYMOUS : MAP_SHARED;
+    void *base = mmap(NULL, RING_SIZE(capacity), PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        printf("Failed to memory map ingest ring (%s)\n", strerror(errno));
+        return NULL;
+    }
+
+    IngestRing *ring = malloc(sizeof(IngestRing));
+    if (!ring)
+    {
+        printf("Failed to allocate memory for ingest ring\n");
+        munmap(base, RING_SIZE(capacity));
+        return NULL;
+    }
+
+    ring->header = base;
+    ring->slots = (IngestRingSlot *)((uint8_t *)base + INGEST_RING_HEADER_SIZE);
+    ring->mask = capacity - 1;
+    ring->fd = fd;
+    ring->stalled_pos = 0;
+    ring->stalled_since_ms = -1;
+    return ring;
+}
+
+// Returns 1 if the header describes a ring this build can use in a file of file_size bytes
+static int ring_header_valid(const IngestRingHeader *header, off_t file_size)
+{
+    return header->magic == INGEST_RING_MAGIC && header->version == INGEST_RING_VERSION &&
+           header->record_size == sizeof(ImageBatch) && header->capacity >= 2 &&
+           (header->capacity & (header->capacity - 1)) == 0 &&
+           file_size >= (off_t)RING_SIZE(header->capacity);
+}
+
+int ingest_ring_init(IngestRing **ring, const char *filename, size_t capacity)
+{
+    if (ring == NULL)
+    {
+        printf("Error: provided IngestRing** is NULL\n");
+        return -1;
+    }
+
+    capacity = round_up_pow2(capacity ? capacity : INGEST_RING_CAPACITY);
+
+    int fd = -1;
+    int fresh = 1;
+    if (filename != NULL)
+    {
+        fd = open(filename, O_RDWR | O_CREAT, 0666);
+        struct stat st;
+        IngestRingHeader header;
+        memset(&header, 0, sizeof(header));
+        if (fd == -1 || fstat(fd, &st) == -1)
+        {
+            printf("Failed to open/create ingest ring: %s (%s)\n", filename, strerror(errno));
+            if (fd != -1)
+                close(fd);
+            return -1;
+        }
+        if (st.st_size >= (off_t)sizeof(header))
+            pread(fd, &header, sizeof(header), 0);
+
+        if (ring_header_valid(&header, st.st_size))
+        {
+            // an existing ring keeps its capacity and contents
+            capacity = header.capacity;
+            fresh = 0;
+        }
+        else if (ftruncate(fd, 0) == -1 || ftruncate(fd, RING_SIZE(capacity)) == -1)
+        {
+            printf("Failed to set file size: %s (%s)\n", filename, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    IngestRing *handle = map_ring(fd, capacity);
+    if (!handle)
+    {
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    uint32_t boot_id = pq_boot_id();
+    if (fresh)
+    {
+        handle->header->magic = INGEST_RING_MAGIC;
+        handle->header->version = INGEST_RING_VERSION;
+        handle->header->capacity = capacity;
+        handle->header->record_size = sizeof(ImageBatch);
+        reset_ring(handle);
+    }
+    else if (boot_id == 0 || handle->header->boot_id != boot_id)
+    {
+        compact_ring(handle);
+    }
+
+    // producers attach only once the boot id matches, i.e. after the ring is consistent
+    __atomic_store_n(&handle->header->boot_id, boot_id, __ATOMIC_RELEASE);
+
+    *ring = handle;
+    return 0;
+}
+
+int ingest_ring_attach(IngestRing **ring, const char *filename)
+{
+    if (ring == NULL || filename == NULL)
+    {
+        printf("Error: provided IngestRing** or filename is NULL\n");
+        return -1;
+    }
+
+    int fd = open(filename, O_RDWR);
+    struct stat st;
+    IngestRingHeader header;
+    memset(&header, 0, sizeof(header));
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(header) ||
+        pread(fd, &header, sizeof(header), 0) != sizeof(header))
+    {
+        printf("Failed to open ingest ring: %s\n", filename);
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    uint32_t boot_id = pq_boot_id();
+    if (!ring_header_valid(&header, st.st_size) || boot_id == 0 || header.boot_id != boot_id)
+    {
+        printf("Ingest ring %s has not been initialised by DIPP in this boot\n", filename);
+        close(fd);
+        return -1;
+    }
+
+    IngestRing *handle = map_ring(fd, header.capacity);
+    if (!handle)
+    {
+        close(fd);
+        return -1;
+    }
+
+    *ring = handle;
+    return 0;
+}
+
+int ingest_ring_push(IngestRing *ring, const ImageBatch *item)
+{
+    uint64_t pos = __atomic_load_n(&ring->header->enqueue_pos, __ATOMIC_RELAXED);
+    IngestRingSlot *slot;
+    while (1)
+    {
+        slot = &ring->slots[pos & ring->mask];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) & ~INGEST_SLOT_WRITING;
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0)
+        {
+            // the slot is free for this lap, claim it
+            if (__atomic_compare_exchange_n(&ring->header->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return -1; // full: the slot still holds an item from the previous lap
+        }
+        else
+        {
+            pos = __atomic_load_n(&ring->header->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    __atomic_store_n(&slot->claim_pid, (int32_t)getpid(), __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->claim_pos, pos, __ATOMIC_RELEASE);
+
+    // take the slot over before writing it; fails only if the consumer gave up on this
+    // slot, which may already be claimed for the next lap, so the caller enqueues elsewhere
+    uint64_t expected = pos;
+    if (!__atomic_compare_exchange_n(&slot->seq, &expected, pos | INGEST_SLOT_WRITING, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        return -1;
+
+    slot->item = *item;
+    slot->item.data = NULL;
+    pq_stamp_item(&slot->item);
+    pq_seal_item(&slot->item);
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int64_t monotonic_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Returns 1 if the slot claimed for pos will not be published: its claimer has exited,
+// or it has not started writing the slot for INGEST_CLAIM_TIMEOUT_MS
+static int claim_abandoned(IngestRing *ring, IngestRingSlot *slot, uint64_t pos, int writing)
+{
+    if (ring->stalled_since_ms < 0 || ring->stalled_pos != pos)
+    {
+        ring->stalled_pos = pos;
+        ring->stalled_since_ms = monotonic_ms();
+    }
+
+    int64_t stalled_ms = monotonic_ms() - ring->stalled_since_ms;
+    if (stalled_ms < CLAIMER_CHECK_MS)
+        return 0;
+
+    // the claimer is recorded just after its claim, and a reused pid looks alive
+    if (__atomic_load_n(&slot->claim_pos, __ATOMIC_ACQUIRE) == pos)
+    {
+        pid_t pid = __atomic_load_n(&slot->claim_pid, __ATOMIC_RELAXED);
+        if (pid > 0 && kill(pid, 0) == -1 && errno == ESRCH)
+            return 1;
+    }
+    // a claimer that is still writing may finish any time
+    return !writing && stalled_ms >= INGEST_CLAIM_TIMEOUT_MS;
+}
+
+size_t ingest_ring_pop_bulk(IngestRing *ring, ImageBatch *out, size_t max)
+{
+    size_t popped = 0;
+    uint64_t pos = __atomic_load_n(&ring->header->dequeue_pos, __ATOMIC_RELAXED);
+    while (popped < max)
+    {
+        IngestRingSlot *slot = &ring->slots[pos & ring->mask];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int writing = (seq & INGEST_SLOT_WRITING) != 0;
+        int64_t diff = (int64_t)((seq & ~INGEST_SLOT_WRITING) - (pos + 1));
+        if (diff == 0)
+        {
+            if (!__atomic_compare_exchange_n(&ring->header->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                continue; // another consumer took it, pos was reloaded
+
+            out[popped] = slot->item;
+            __atomic_store_n(&slot->seq, pos + ring->mask + 1, __ATOMIC_RELEASE);
+            pos++;
+
+            if (!pq_verify_item(&out[popped]))
+            {
+                printf("Dropping corrupt batch from ingest ring (checksum mismatch)\n");
+                continue;
+            }
+            popped++;
+        }
+        else if (diff < 0)
+        {
+            // empty, or the next slot is claimed but not yet published
+            if ((seq & ~INGEST_SLOT_WRITING) != pos || __atomic_load_n(&ring->header->enqueue_pos, __ATOMIC_ACQUIRE) == pos ||
+                !claim_abandoned(ring, slot, pos, writing))
+                break;
+
+            // take the slot away from its claimer, unless it started writing meanwhile;
+            // only the consumer freeing the slot moves dequeue_pos past it then
+            if (!__atomic_compare_exchange_n(&slot->seq, &seq, pos + ring->mask + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                continue;
+            __atomic_store_n(&ring->header->dequeue_pos, pos + 1, __ATOMIC_RELAXED);
+            printf("Skipping ingest ring slot %llu, its producer never published it\n", (unsigned long long)pos);
+            ring->stalled_since_ms = -1;
+            pos++;
+        }
+        else
+        {
+            pos = __atomic_load_n(&ring->header->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    return popped;
+}
+
+size_t ingest_ring_depth(IngestRing *ring)
+{
+    uint64_t dequeue_pos = __atomic_load_n(&ring->header->dequeue_pos, __ATOMIC_RELAXED);
+    uint64_t enqueue_pos = __atomic_load_n(&ring->header->enqueue_pos, __ATOMIC_RELAXED);
+    return enqueue_pos > dequeue_pos ? (size_t)(enqueue_pos - dequeue_pos) : 0;
+}
+
+void ingest_ring_clean_up(IngestRing *ring)
+{
+    if (ring)
+    {
+        munmap(ring->header, RING_SIZE(ring->mask + 1));
+        if (ring->fd != -1)
+            close(ring->fd);
+        free(ring);
+    }
+}
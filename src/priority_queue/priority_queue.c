@@ -1,6 +1,13 @@
 #include "image_batch.h"
 #include "priority_queue.h"
 #include "utils/minitrace.h"
+#include "crc32c.h"
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 PriorityQueueImpl *get_priority_queue_impl(StorageMode storage_type)
 {
@@ -27,17 +34,17 @@ void swap(ImageBatch *a, ImageBatch *b)
 // Define peek function to get the top item from the queue
 ImageBatch *peek(PriorityQueue *pq)
 {
-    pthread_mutex_lock(&pq->lock);
-    if (!pq->size)
+    pq_lock(pq);
+    if (!pq->header->size)
     {
-        pthread_mutex_unlock(&pq->lock);
+        pq_unlock(pq);
         printf("Priority queue is empty\n");
         return NULL;
     }
 
     ImageBatch *item = &pq->items[0];
 
-    pthread_mutex_unlock(&pq->lock);
+    pq_unlock(pq);
 
     return item;
 }
@@ -50,10 +57,10 @@ void heapifyDown(PriorityQueue *pq, int index)
     int left = 2 * index + 1;
     int right = 2 * index + 2;
 
-    if (left < pq->size && pq->items[left].priority < pq->items[smallest].priority)
+    if (left < pq->header->size && pq->items[left].priority < pq->items[smallest].priority)
         smallest = left;
 
-    if (right < pq->size && pq->items[right].priority < pq->items[smallest].priority)
+    if (right < pq->header->size && pq->items[right].priority < pq->items[smallest].priority)
         smallest = right;
 
     if (smallest != index)
@@ -75,12 +82,184 @@ void heapifyUp(PriorityQueue *pq, int index)
     }
 }
 
+// Remove the item at index by moving the last item into its place and sifting it
+void heap_remove_at(PriorityQueue *pq, int index)
+{
+    pq->items[index] = pq->items[--pq->header->size];
+    if (index < pq->header->size)
+    {
+        heapifyDown(pq, index);
+        heapifyUp(pq, index);
+    }
+}
+
+// Index of the earliest item for which match returns non-zero, -1 if there is none
+int heap_find_match(PriorityQueue *pq, int (*match)(const ImageBatch *item, void *ctx), void *ctx)
+{
+    int found = -1;
+    for (int i = 0; i < pq->header->size; i++)
+    {
+        if ((found == -1 || pq->items[i].priority < pq->items[found].priority) && match(&pq->items[i], ctx))
+            found = i;
+    }
+    return found;
+}
+
+// Restore the heap property over the whole array bottom-up in O(n)
+void heapify(PriorityQueue *pq)
+{
+    for (int i = pq->header->size / 2 - 1; i >= 0; i--)
+    {
+        heapifyDown(pq, i);
+    }
+}
+
+// Restore the heap property after items were appended behind old_size,
+// using either one sift-up per item or a single bottom-up heapify,
+// whichever is cheaper for the size of the burst
+void heapify_appended(PriorityQueue *pq, int old_size)
+{
+    int size = pq->header->size;
+    int appended = size - old_size;
+
+    int log_size = 0;
+    while ((1 << log_size) < size)
+        log_size++;
+
+    // k sift-ups cost about k*log2(n) swaps, a full heapify at most about 2n
+    if ((long)appended * log_size > 2L * size)
+    {
+        heapify(pq);
+        return;
+    }
+
+    for (int i = old_size; i < size; i++)
+    {
+        heapifyUp(pq, i);
+    }
+}
+
+// Wait-free depth read: the size is only written under the lock, a single aligned
+// load is enough for the scheduler's heuristics and keeps the lock off this path
 size_t get_queue_size(PriorityQueue *pq)
 {
-    MTR_BEGIN_FUNC();
-    pthread_mutex_lock(&pq->lock);
-    size_t size = pq->size;
-    pthread_mutex_unlock(&pq->lock);
-    MTR_END_FUNC();
-    return size;
+    int32_t size = __atomic_load_n(&pq->header->size, __ATOMIC_RELAXED);
+    return size > 0 ? (size_t)size : 0;
+}
+
+uint32_t pq_boot_id()
+{
+    char boot_id[64] = {0};
+    FILE *fp = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (!fp)
+        return 0;
+    size_t len = fread(boot_id, 1, sizeof(boot_id) - 1, fp);
+    fclose(fp);
+    return len ? crc32c(0, boot_id, len) : 0;
+}
+
+void pq_lock(PriorityQueue *pq)
+{
+    if (pthread_mutex_lock(&pq->header->lock) == EOWNERDEAD)
+    {
+        // the owner died mid-operation and may have left the heap half-updated
+        printf("Priority queue lock owner died, scheduling repair\n");
+        pq->header->needs_repair = 1;
+        pthread_mutex_consistent(&pq->header->lock);
+    }
+}
+
+void pq_unlock(PriorityQueue *pq)
+{
+    pthread_mutex_unlock(&pq->header->lock);
+}
+
+static long futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+// The sequence bump and the waiter check pair with the waiter registration and the
+// value check in FUTEX_WAIT, so either the waker sees the waiter or the waiter sees the new sequence
+void pq_notify(PriorityQueue *pq)
+{
+    __atomic_add_fetch(&pq->header->wake_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pq->header->waiters, __ATOMIC_SEQ_CST))
+        futex(&pq->header->wake_seq, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+uint32_t pq_wake_seq(PriorityQueue *pq)
+{
+    return __atomic_load_n(&pq->header->wake_seq, __ATOMIC_SEQ_CST);
+}
+
+void pq_wait(PriorityQueue *pq, uint32_t seq, long timeout_us)
+{
+    struct timespec timeout = {timeout_us / 1000000, (timeout_us % 1000000) * 1000};
+    __atomic_add_fetch(&pq->header->waiters, 1, __ATOMIC_SEQ_CST);
+    futex(&pq->header->wake_seq, FUTEX_WAIT, seq, &timeout);
+    __atomic_sub_fetch(&pq->header->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+size_t pq_next_capacity(size_t capacity)
+{
+    if (capacity >= PQ_MAX_CAPACITY)
+        return 0;
+
+    size_t next = capacity ? capacity * 2 : DEFAULT_QUEUE_CAPACITY;
+    return next > PQ_MAX_CAPACITY ? PQ_MAX_CAPACITY : next;
+}
+
+size_t pq_capacity_for(size_t capacity, size_t needed)
+{
+    while (capacity < needed)
+    {
+        size_t next = pq_next_capacity(capacity);
+        if (!next)
+            break;
+        capacity = next;
+    }
+    return capacity;
+}
+
+// Checksum the batch field by field so struct padding never takes part.
+// The data pointer is process-local and therefore excluded.
+static uint32_t image_batch_checksum(const ImageBatch *item)
+{
+    uint32_t crc = 0;
+    crc = crc32c(crc, &item->mtype, sizeof(item->mtype));
+    crc = crc32c(crc, &item->num_images, sizeof(item->num_images));
+    crc = crc32c(crc, &item->batch_size, sizeof(item->batch_size));
+    crc = crc32c(crc, &item->pipeline_id, sizeof(item->pipeline_id));
+    crc = crc32c(crc, &item->priority, sizeof(item->priority));
+    crc = crc32c(crc, item->filename, sizeof(item->filename));
+    crc = crc32c(crc, &item->shmid, sizeof(item->shmid));
+    crc = crc32c(crc, item->uuid, sizeof(item->uuid));
+    crc = crc32c(crc, &item->progress, sizeof(item->progress));
+    crc = crc32c(crc, &item->storage_mode, sizeof(item->storage_mode));
+    crc = crc32c(crc, &item->enqueued_ms, sizeof(item->enqueued_ms));
+    crc = crc32c(crc, &item->completed_nodes, sizeof(item->completed_nodes));
+    return crc;
+}
+
+// Wall-clock time, since the stamp persists in queue files across reboots and the
+// monotonic clock restarts with every boot
+void pq_stamp_item(ImageBatch *item)
+{
+    if (item->enqueued_ms == 0)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        item->enqueued_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    }
+}
+
+void pq_seal_item(ImageBatch *item)
+{
+    item->checksum = image_batch_checksum(item);
+}
+
+int pq_verify_item(const ImageBatch *item)
+{
+    return item->checksum == image_batch_checksum(item);
 }
\ No newline at end of file
@@ -0,0 +1,427 @@
+#include "priority_queue.h"
+#include <string.h>
+#include "utils/minitrace.h"
+
+// Calendar queue keyed by deadline second. Batch priorities are absolute deadlines
+// (CLOCK_MONOTONIC seconds) that cluster on a few SLO classes, so one bucket per second
+// gives O(1) amortised enqueue and dequeue: the cursor only ever moves forward over
+// buckets that were already drained. Items with the same deadline leave in FIFO order.
+// The queue lives in memory only; items are slots of pq->items linked per bucket.
+#define CALENDAR_BUCKETS 1024 // one lap covers ~17 minutes of deadlines
+#define CALENDAR_NIL -1
+
+typedef struct CalendarQueue
+{
+    int32_t heads[CALENDAR_BUCKETS];
+    int32_t tails[CALENDAR_BUCKETS];
+    int32_t *next;     // per slot: next slot in the same bucket, or in the free list
+    int32_t free_head; // first unused slot
+    int64_t cursor;    // never above the smallest deadline in the queue
+} CalendarQueue;
+
+#define CALENDAR(pq) ((CalendarQueue *)(pq)->backend)
+#define BUCKET(deadline) ((uint64_t)(deadline) & (CALENDAR_BUCKETS - 1))
+
+// Chain slots [from, to) onto the free list
+static void free_slots(CalendarQueue *cq, size_t from, size_t to)
+{
+    for (size_t i = from; i < to; i++)
+    {
+        cq->next[i] = i + 1 < to ? (int32_t)(i + 1) : cq->free_head;
+    }
+    if (from < to)
+        cq->free_head = from;
+}
+
+int init_pq_calendar(PriorityQueue **pq, char *filename, size_t capacity)
+{
+    (void)filename;
+    if (pq == NULL)
+    {
+        printf("Error: provided PriorityQueue** is NULL\n");
+        return -1;
+    }
+
+    if (capacity == 0 || capacity > PQ_MAX_CAPACITY)
+        capacity = DEFAULT_QUEUE_CAPACITY;
+
+    if (*pq == NULL)
+    {
+        *pq = malloc(sizeof(PriorityQueue));
+        if (!*pq)
+        {
+            printf("Failed to allocate memory for priority queue\n");
+            return -1;
+        }
+    }
+
+    CalendarQueue *cq = calloc(1, sizeof(CalendarQueue));
+    (*pq)->header = calloc(1, sizeof(PriorityQueueHeader));
+    (*pq)->items = calloc(capacity, sizeof(ImageBatch));
+    if (cq)
+        cq->next = malloc(capacity * sizeof(int32_t));
+    if (!cq || !cq->next || !(*pq)->header || !(*pq)->items)
+    {
+        printf("Failed to allocate memory for calendar queue\n");
+        if (cq)
+            free(cq->next);
+        free(cq);
+        free((*pq)->header);
+        free((*pq)->items);
+        return -1;
+    }
+
+    for (int i = 0; i < CALENDAR_BUCKETS; i++)
+    {
+        cq->heads[i] = CALENDAR_NIL;
+        cq->tails[i] = CALENDAR_NIL;
+    }
+    cq->free_head = CALENDAR_NIL;
+    free_slots(cq, 0, capacity);
+
+    (*pq)->header->magic = PQ_FILE_MAGIC;
+    (*pq)->header->version = PQ_FILE_VERSION;
+    (*pq)->header->capacity = capacity;
+    (*pq)->header->record_size = sizeof(ImageBatch);
+    (*pq)->header->size = 0;
+    (*pq)->mapped_capacity = capacity;
+    (*pq)->fd = -1;
+    (*pq)->backend = cq;
+    pthread_mutex_init(&(*pq)->header->lock, NULL);
+
+    return 0;
+}
+
+// Grow the slot pool; caller holds the lock
+static int grow_pq_calendar_locked(PriorityQueue *pq, size_t capacity)
+{
+    if (capacity <= pq->header->capacity)
+        return 0;
+    if (capacity > PQ_MAX_CAPACITY)
+        return -1;
+
+    CalendarQueue *cq = CALENDAR(pq);
+    ImageBatch *items = realloc(pq->items, capacity * sizeof(ImageBatch));
+    if (items)
+        pq->items = items;
+    int32_t *next = realloc(cq->next, capacity * sizeof(int32_t));
+    if (next)
+        cq->next = next;
+    if (!items || !next)
+    {
+        printf("Failed to grow priority queue to %zu items\n", capacity);
+        return -1;
+    }
+
+    free_slots(cq, pq->header->capacity, capacity);
+    pq->header->capacity = capacity;
+    pq->mapped_capacity = capacity;
+    return 0;
+}
+
+int grow_pq_calendar(PriorityQueue *pq, size_t capacity)
+{
+    pq_lock(pq);
+    int res = grow_pq_calendar_locked(pq, capacity);
+    pq_unlock(pq);
+    return res;
+}
+
+// Append item to the bucket of its deadline; caller holds the lock and ensured a free slot
+static void insert_locked(PriorityQueue *pq, ImageBatch *item)
+{
+    CalendarQueue *cq = CALENDAR(pq);
+    int32_t slot = cq->free_head;
+    cq->free_head = cq->next[slot];
+
+    item->data = NULL;
+    pq_stamp_item(item);
+    pq->items[slot] = *item;
+    cq->next[slot] = CALENDAR_NIL;
+
+    uint64_t bucket = BUCKET(item->priority);
+    if (cq->tails[bucket] == CALENDAR_NIL)
+        cq->heads[bucket] = slot;
+    else
+        cq->next[cq->tails[bucket]] = slot;
+    cq->tails[bucket] = slot;
+
+    if (pq->header->size == 0 || item->priority < cq->cursor)
+        cq->cursor = item->priority;
+    pq->header->size++;
+}
+
+// Find the earliest item and its predecessor in its bucket; caller holds the lock and the queue is not empty.
+// Walks at most one lap of buckets from the cursor; if every deadline is further out than
+// that, one full scan moves the cursor to the smallest deadline.
+static int32_t find_min_locked(PriorityQueue *pq, int32_t *prev_out)
+{
+    CalendarQueue *cq = CALENDAR(pq);
+    while (1)
+    {
+        for (int64_t deadline = cq->cursor; deadline < cq->cursor + CALENDAR_BUCKETS; deadline++)
+        {
+            int32_t prev = CALENDAR_NIL;
+            for (int32_t slot = cq->heads[BUCKET(deadline)]; slot != CALENDAR_NIL; prev = slot, slot = cq->next[slot])
+            {
+                if (pq->items[slot].priority == deadline)
+                {
+                    cq->cursor = deadline;
+                    *prev_out = prev;
+                    return slot;
+                }
+            }
+        }
+
+        int64_t earliest = INT64_MAX;
+        for (int i = 0; i < CALENDAR_BUCKETS; i++)
+        {
+            for (int32_t slot = cq->heads[i]; slot != CALENDAR_NIL; slot = cq->next[slot])
+            {
+                if (pq->items[slot].priority < earliest)
+                    earliest = pq->items[slot].priority;
+            }
+        }
+        cq->cursor = earliest;
+    }
+}
+
+// Unlink slot from its bucket and return it to the free list; caller holds the lock
+static void remove_locked(PriorityQueue *pq, int32_t slot, int32_t prev, ImageBatch *out)
+{
+    CalendarQueue *cq = CALENDAR(pq);
+    uint64_t bucket = BUCKET(pq->items[slot].priority);
+
+    *out = pq->items[slot];
+    if (prev == CALENDAR_NIL)
+        cq->heads[bucket] = cq->next[slot];
+    else
+        cq->next[prev] = cq->next[slot];
+    if (cq->tails[bucket] == slot)
+        cq->tails[bucket] = prev;
+
+    cq->next[slot] = cq->free_head;
+    cq->free_head = slot;
+    pq->header->size--;
+}
+
+int enqueue_calendar(PriorityQueue *pq, ImageBatch item)
+{
+    MTR_BEGIN_FUNC();
+    pq_lock(pq);
+
+    if (pq->header->size == pq->header->capacity &&
+        grow_pq_calendar_locked(pq, pq_next_capacity(pq->header->capacity)) != 0)
+    {
+        pq_unlock(pq);
+        printf("Priority queue is full\n");
+        MTR_END_FUNC();
+        return -1; // full
+    }
+
+    insert_locked(pq, &item);
+
+    pq_unlock(pq);
+    pq_notify(pq);
+    MTR_END_FUNC();
+    return 0; // success
+}
+
+// Take the earliest item into out only if predicate (when given) accepts it
+int dequeue_if_calendar(PriorityQueue *pq, int (*predicate)(const ImageBatch *head, void *ctx), void *ctx, ImageBatch *out)
+{
+    MTR_BEGIN_FUNC();
+    pq_lock(pq);
+
+    int taken = 0;
+    if (pq->header->size)
+    {
+        int32_t prev;
+        int32_t slot = find_min_locked(pq, &prev);
+        if (predicate == NULL || predicate(&pq->items[slot], ctx))
+        {
+            remove_locked(pq, slot, prev, out);
+            taken = 1;
+        }
+    }
+
+    pq_unlock(pq);
+    MTR_END_FUNC();
+    return taken;
+}
+
+int dequeue_into_calendar(PriorityQueue *pq, ImageBatch *out)
+{
+    return dequeue_if_calendar(pq, NULL, NULL, out);
+}
+
+ImageBatch *dequeue_calendar(PriorityQueue *pq)
+{
+    ImageBatch item;
+    if (!dequeue_into_calendar(pq, &item))
+        return NULL;
+
+    // allocate a stable copy for the caller
+    ImageBatch *res = malloc(sizeof(ImageBatch));
+    if (res)
+        *res = item;
+    return res;
+}
+
+int enqueue_bulk_calendar(PriorityQueue *pq, ImageBatch *items, size_t count)
+{
+    MTR_BEGIN_FUNC_I("count", (int)count);
+    pq_lock(pq);
+
+    // make room for the whole burst up front, as far as growth allows
+    grow_pq_calendar_locked(pq, pq_capacity_for(pq->header->capacity, pq->header->size + count));
+
+    size_t enqueued = 0;
+    while (enqueued < count && (uint32_t)pq->header->size < pq->header->capacity)
+    {
+        insert_locked(pq, &items[enqueued++]);
+    }
+
+    pq_unlock(pq);
+    if (enqueued)
+        pq_notify(pq);
+
+    if (enqueued < count)
+        printf("Priority queue is full, dropped %zu batches\n", count - enqueued);
+
+    MTR_END_FUNC();
+    return (int)enqueued;
+}
+
+size_t dequeue_bulk_calendar(PriorityQueue *pq, ImageBatch *out, size_t max)
+{
+    MTR_BEGIN_FUNC();
+    pq_lock(pq);
+
+    size_t dequeued = 0;
+    while (dequeued < max && pq->header->size)
+    {
+        int32_t prev;
+        int32_t slot = find_min_locked(pq, &prev);
+        remove_locked(pq, slot, prev, &out[dequeued++]);
+    }
+
+    pq_unlock(pq);
+    MTR_END_FUNC();
+    return dequeued;
+}
+
+// Matches can sit anywhere, so this scans every bucket for the earliest one
+int dequeue_match_calendar(PriorityQueue *pq, int (*match)(const ImageBatch *item, void *ctx), void *ctx, ImageBatch *out)
+{
+    MTR_BEGIN_FUNC();
+    pq_lock(pq);
+
+    CalendarQueue *cq = CALENDAR(pq);
+    int32_t found = CALENDAR_NIL;
+    int32_t found_prev = CALENDAR_NIL;
+    for (int i = 0; i < CALENDAR_BUCKETS; i++)
+    {
+        int32_t prev = CALENDAR_NIL;
+        for (int32_t slot = cq->heads[i]; slot != CALENDAR_NIL; prev = slot, slot = cq->next[slot])
+        {
+            if ((found == CALENDAR_NIL || pq->items[slot].priority < pq->items[found].priority) && match(&pq->items[slot], ctx))
+            {
+                found = slot;
+                found_prev = prev;
+            }
+        }
+    }
+
+    if (found != CALENDAR_NIL)
+        remove_locked(pq, found, found_prev, out);
+
+    pq_unlock(pq);
+    MTR_END_FUNC();
+    return found != CALENDAR_NIL;
+}
+
+// Expired deadlines all sit in the buckets between the cursor and now, so this walks
+// each of those seconds once rather than searching the whole queue
+size_t dequeue_expired_calendar(PriorityQueue *pq, int64_t now, ImageBatch *out, size_t max)
+{
+    MTR_BEGIN_FUNC();
+    pq_lock(pq);
+
+    CalendarQueue *cq = CALENDAR(pq);
+    size_t dequeued = 0;
+    while (dequeued < max && pq->header->size && cq->cursor < now)
+    {
+        int32_t prev;
+        int32_t slot = find_min_locked(pq, &prev);
+        if (pq->items[slot].priority >= now)
+            break;
+        remove_locked(pq, slot, prev, &out[dequeued++]);
+    }
+
+    pq_unlock(pq);
+    MTR_END_FUNC();
+    return dequeued;
+}
+
+// Copy the earliest item into out without removing it
+int peek_into_calendar(PriorityQueue *pq, ImageBatch *out)
+{
+    pq_lock(pq);
+    int found = pq->header->size > 0;
+    if (found)
+    {
+        int32_t prev;
+        *out = pq->items[find_min_locked(pq, &prev)];
+    }
+    pq_unlock(pq);
+    return found;
+}
+
+ImageBatch *peek_calendar(PriorityQueue *pq)
+{
+    pq_lock(pq);
+    if (!pq->header->size)
+    {
+        pq_unlock(pq);
+        printf("Priority queue is empty\n");
+        return NULL;
+    }
+
+    int32_t prev;
+    ImageBatch *item = &pq->items[find_min_locked(pq, &prev)];
+
+    pq_unlock(pq);
+
+    return item;
+}
+
+int clean_up_pq_calendar(PriorityQueue *pq)
+{
+    if (pq)
+    {
+        pthread_mutex_destroy(&pq->header->lock);
+        free(CALENDAR(pq)->next);
+        free(pq->backend);
+        free(pq->items);
+        free(pq->header);
+        free(pq);
+    }
+    return 0;
+}
+
+PriorityQueueImpl priority_queue_calendar = {
+    .init = init_pq_calendar,
+    .enqueue = enqueue_calendar,
+    .dequeue = dequeue_calendar,
+    .dequeue_into = dequeue_into_calendar,
+    .dequeue_if = dequeue_if_calendar,
+    .enqueue_bulk = enqueue_bulk_calendar,
+    .dequeue_bulk = dequeue_bulk_calendar,
+    .dequeue_match = dequeue_match_calendar,
+    .dequeue_expired = dequeue_expired_calendar,
+    .peek = peek_calendar,
+    .peek_into = peek_into_calendar,
+    .get_queue_size = get_queue_size,
+    .grow = grow_pq_calendar,
+    .clean_up = clean_up_pq_calendar};
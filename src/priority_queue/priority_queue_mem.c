@@ -5,8 +5,8 @@
 #include <string.h>
 #include "utils/minitrace.h"
 
-// Initialize in-memory priority queue: allocate outer PriorityQueue if *pq is NULL and init it
-int init_pq_mem(PriorityQueue **pq, char *filename)
+// Initialize in-memory priority queue: allocate the handle if *pq is NULL and give it capacity slots
+int init_pq_mem(PriorityQueue **pq, char *filename, size_t capacity)
 {
     (void)filename;
     if (pq == NULL)
@@ -15,6 +15,9 @@ int init_pq_mem(PriorityQueue **pq, char *filename)
         return -1;
     }
 
+    if (capacity == 0 || capacity > PQ_MAX_CAPACITY)
+        capacity = DEFAULT_QUEUE_CAPACITY;
+
     if (*pq == NULL)
     {
         *pq = malloc(sizeof(PriorityQueue));
@@ -25,23 +28,69 @@ int init_pq_mem(PriorityQueue **pq, char *filename)
         }
     }
 
+    (*pq)->header = calloc(1, sizeof(PriorityQueueHeader));
+    (*pq)->items = calloc(capacity, sizeof(ImageBatch));
+    if (!(*pq)->header || !(*pq)->items)
+    {
+        printf("Failed to allocate memory for priority queue items\n");
+        free((*pq)->header);
+        free((*pq)->items);
+        return -1;
+    }
+
     // initialize fields
-    memset((*pq)->items, 0, sizeof((*pq)->items));
-    (*pq)->size = 0;
-    pthread_mutex_init(&(*pq)->lock, NULL);
+    (*pq)->header->magic = PQ_FILE_MAGIC;
+    (*pq)->header->version = PQ_FILE_VERSION;
+    (*pq)->header->capacity = capacity;
+    (*pq)->header->record_size = sizeof(ImageBatch);
+    (*pq)->header->size = 0;
+    (*pq)->mapped_capacity = capacity;
+    (*pq)->fd = -1;
+    (*pq)->backend = NULL;
+    pthread_mutex_init(&(*pq)->header->lock, NULL);
 
     return 0;
 }
 
+// Grow the item array; caller holds the lock
+static int grow_pq_mem_locked(PriorityQueue *pq, size_t capacity)
+{
+    if (capacity <= pq->header->capacity)
+        return 0;
+    if (capacity > PQ_MAX_CAPACITY)
+        return -1;
+
+    ImageBatch *items = realloc(pq->items, capacity * sizeof(ImageBatch));
+    if (!items)
+    {
+        printf("Failed to grow priority queue to %zu items\n", capacity);
+        return -1;
+    }
+
+    pq->items = items;
+    pq->header->capacity = capacity;
+    pq->mapped_capacity = capacity;
+    return 0;
+}
+
+int grow_pq_mem(PriorityQueue *pq, size_t capacity)
+{
+    pq_lock(pq);
+    int res = grow_pq_mem_locked(pq, capacity);
+    pq_unlock(pq);
+    return res;
+}
+
 // Define enqueue function to add an item to the queue
 int enqueue_mem(PriorityQueue *pq, ImageBatch item)
 {
     MTR_BEGIN_FUNC();
-    pthread_mutex_lock(&pq->lock);
+    pq_lock(pq);
 
-    if (pq->size == MAX_QUEUE_SIZE)
+    if (pq->header->size == pq->header->capacity &&
+        grow_pq_mem_locked(pq, pq_next_capacity(pq->header->capacity)) != 0)
     {
-        pthread_mutex_unlock(&pq->lock);
+        pq_unlock(pq);
         printf("Priority queue is full\n");
         MTR_END_FUNC();
         return -1; // full
@@ -49,6 +98,7 @@ int enqueue_mem(PriorityQueue *pq, ImageBatch item)
 
     // each process will later memory-map the contents into this pointer
     item.data = NULL;
+    pq_stamp_item(&item);
 
     // printf("New item arrived in pq: \r\n");
     // printf("Number of images: %i\r\n", item.num_images);
@@ -60,11 +110,11 @@ int enqueue_mem(PriorityQueue *pq, ImageBatch item)
     // printf("Progress: %i\r\n", item.progress);
     // printf("Storage mode: %i\r\n", item.storage_mode);
 
-    pq->items[pq->size++] = item;
-    heapifyUp(pq, pq->size - 1);
+    pq->items[pq->header->size++] = item;
+    heapifyUp(pq, pq->header->size - 1);
 
     // printf("Item enqueued. Here is the queue.\r\n");
-    // for (int i = 0; i < pq->size; i++)
+    // for (int i = 0; i < pq->header->size; i++)
     // {
     //     // print data inside each item
     //     printf("Item %i:\r\n", i);
@@ -79,49 +129,156 @@ int enqueue_mem(PriorityQueue *pq, ImageBatch item)
     //     printf("----\r\n");
     // }
 
-    pthread_mutex_unlock(&pq->lock);
+    pq_unlock(pq);
+    pq_notify(pq);
     MTR_END_FUNC();
     return 0; // success
 }
 
-// Define dequeue function to remove an item from the queue
-ImageBatch *dequeue_mem(PriorityQueue *pq)
+// Take the head into out only if predicate (when given) accepts it, deciding and
+// removing under one lock so the head cannot change in between
+int dequeue_if_mem(PriorityQueue *pq, int (*predicate)(const ImageBatch *head, void *ctx), void *ctx, ImageBatch *out)
 {
     MTR_BEGIN_FUNC();
-    pthread_mutex_lock(&pq->lock);
+    pq_lock(pq);
 
-    if (!pq->size)
+    int taken = 0;
+    if (pq->header->size && (predicate == NULL || predicate(&pq->items[0], ctx)))
     {
-        pthread_mutex_unlock(&pq->lock);
-        // printf("Priority queue is empty\n");
-        MTR_END_FUNC();
-        return NULL;
+        *out = pq->items[0]; // shallow copy of the item
+        heap_remove_at(pq, 0);
+        taken = 1;
     }
 
+    pq_unlock(pq);
+    MTR_END_FUNC();
+    return taken;
+}
+
+int dequeue_into_mem(PriorityQueue *pq, ImageBatch *out)
+{
+    return dequeue_if_mem(pq, NULL, NULL, out);
+}
+
+// Copy the head into out without removing it
+int peek_into_mem(PriorityQueue *pq, ImageBatch *out)
+{
+    pq_lock(pq);
+    int found = pq->header->size > 0;
+    if (found)
+        *out = pq->items[0];
+    pq_unlock(pq);
+    return found;
+}
+
+// Define dequeue function to remove an item from the queue
+ImageBatch *dequeue_mem(PriorityQueue *pq)
+{
+    ImageBatch item;
+    if (!dequeue_into_mem(pq, &item))
+        return NULL;
+
     // allocate a stable copy for the caller
     ImageBatch *res = malloc(sizeof(ImageBatch));
-    if (!res)
+    if (res)
+        *res = item;
+    return res;
+}
+
+// Append a burst of items and restore the heap once
+int enqueue_bulk_mem(PriorityQueue *pq, ImageBatch *items, size_t count)
+{
+    MTR_BEGIN_FUNC_I("count", (int)count);
+    pq_lock(pq);
+
+    // make room for the whole burst up front, as far as growth allows
+    grow_pq_mem_locked(pq, pq_capacity_for(pq->header->capacity, pq->header->size + count));
+
+    int old_size = pq->header->size;
+    size_t enqueued = 0;
+    while (enqueued < count && (uint32_t)pq->header->size < pq->header->capacity)
     {
-        pthread_mutex_unlock(&pq->lock);
-        MTR_END_FUNC();
-        return NULL;
+        ImageBatch item = items[enqueued++];
+        item.data = NULL;
+        pq_stamp_item(&item);
+        pq->items[pq->header->size++] = item;
     }
+    heapify_appended(pq, old_size);
 
-    *res = pq->items[0];                  // shallow copy of the item
-    pq->items[0] = pq->items[--pq->size]; // move last into root
-    heapifyDown(pq, 0);
+    pq_unlock(pq);
+    if (enqueued)
+        pq_notify(pq);
 
-    pthread_mutex_unlock(&pq->lock);
+    if (enqueued < count)
+        printf("Priority queue is full, dropped %zu batches\n", count - enqueued);
 
     MTR_END_FUNC();
-    return res;
+    return (int)enqueued;
+}
+
+// Pop up to max items in priority order
+size_t dequeue_bulk_mem(PriorityQueue *pq, ImageBatch *out, size_t max)
+{
+    MTR_BEGIN_FUNC();
+    pq_lock(pq);
+
+    size_t dequeued = 0;
+    while (dequeued < max && pq->header->size)
+    {
+        out[dequeued++] = pq->items[0];
+        pq->items[0] = pq->items[--pq->header->size];
+        heapifyDown(pq, 0);
+    }
+
+    pq_unlock(pq);
+    MTR_END_FUNC();
+    return dequeued;
+}
+
+// Scan for the earliest matching item in O(n) and remove it in O(log n)
+int dequeue_match_mem(PriorityQueue *pq, int (*match)(const ImageBatch *item, void *ctx), void *ctx, ImageBatch *out)
+{
+    MTR_BEGIN_FUNC();
+    pq_lock(pq);
+
+    int index = heap_find_match(pq, match, ctx);
+    if (index != -1)
+    {
+        *out = pq->items[index];
+        heap_remove_at(pq, index);
+    }
+
+    pq_unlock(pq);
+    MTR_END_FUNC();
+    return index != -1;
+}
+
+// The root holds the earliest deadline, so expired items are popped from the top
+size_t dequeue_expired_mem(PriorityQueue *pq, int64_t now, ImageBatch *out, size_t max)
+{
+    MTR_BEGIN_FUNC();
+    pq_lock(pq);
+
+    size_t dequeued = 0;
+    while (dequeued < max && pq->header->size && pq->items[0].priority < now)
+    {
+        out[dequeued++] = pq->items[0];
+        pq->items[0] = pq->items[--pq->header->size];
+        heapifyDown(pq, 0);
+    }
+
+    pq_unlock(pq);
+    MTR_END_FUNC();
+    return dequeued;
 }
 
 int clean_up_pq_mem(PriorityQueue *pq)
 {
-    pthread_mutex_destroy(&pq->lock);
     if (pq)
     {
+        pthread_mutex_destroy(&pq->header->lock);
+        free(pq->items);
+        free(pq->header);
         free(pq);
     }
     return 0;
@@ -131,6 +288,14 @@ PriorityQueueImpl priority_queue_mem = {
     .init = init_pq_mem,
     .enqueue = enqueue_mem,
     .dequeue = dequeue_mem,
+    .dequeue_into = dequeue_into_mem,
+    .dequeue_if = dequeue_if_mem,
+    .enqueue_bulk = enqueue_bulk_mem,
+    .dequeue_bulk = dequeue_bulk_mem,
+    .dequeue_match = dequeue_match_mem,
+    .dequeue_expired = dequeue_expired_mem,
     .peek = peek,
+    .peek_into = peek_into_mem,
     .get_queue_size = get_queue_size,
+    .grow = grow_pq_mem,
     .clean_up = clean_up_pq_mem};
\ No newline at end of file
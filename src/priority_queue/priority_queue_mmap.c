@@ -1,15 +1,351 @@
+#define _GNU_SOURCE // mremap
 #include "priority_queue.h"
 #include "utils/minitrace.h"
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
+#include <stddef.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <stdio.h>
+#include "crc32c.h"
 
-// mmap init: map file and set *pq to mapped region. If file is new, zero it and msync.
-int init_pq_mmap(PriorityQueue **pq, char *filename)
+// Layout of queue files written before the versioned header was introduced. The batch
+// layout is frozen here, since ImageBatch has grown since; checksum sits in what used to
+// be trailing padding and is only valid when the file carries PQ_CHECKSUM_MAGIC.
+#define PQ_LEGACY_CAPACITY 100
+typedef struct LegacyImageBatch
+{
+    long mtype;
+    int num_images;
+    int batch_size;
+    int pipeline_id;
+    int priority;
+    unsigned char *data;
+    char filename[111];
+    int shmid;
+    char uuid[37];
+    int progress;
+    StorageMode storage_mode;
+    uint32_t checksum;
+} LegacyImageBatch;
+_Static_assert(sizeof(LegacyImageBatch) == 200, "legacy queue files hold 200-byte batches");
+
+typedef struct LegacyPriorityQueue
+{
+    LegacyImageBatch items[PQ_LEGACY_CAPACITY];
+    int size;
+    pthread_mutex_t lock;
+    uint32_t checksum_magic;
+} LegacyPriorityQueue;
+
+// Checksum of a legacy batch as it was computed when the file was written
+static uint32_t legacy_batch_checksum(const LegacyImageBatch *item)
+{
+    uint32_t crc = 0;
+    crc = crc32c(crc, &item->mtype, sizeof(item->mtype));
+    crc = crc32c(crc, &item->num_images, sizeof(item->num_images));
+    crc = crc32c(crc, &item->batch_size, sizeof(item->batch_size));
+    crc = crc32c(crc, &item->pipeline_id, sizeof(item->pipeline_id));
+    crc = crc32c(crc, &item->priority, sizeof(item->priority));
+    crc = crc32c(crc, item->filename, sizeof(item->filename));
+    crc = crc32c(crc, &item->shmid, sizeof(item->shmid));
+    crc = crc32c(crc, item->uuid, sizeof(item->uuid));
+    crc = crc32c(crc, &item->progress, sizeof(item->progress));
+    crc = crc32c(crc, &item->storage_mode, sizeof(item->storage_mode));
+    return crc;
+}
+
+// Convert a legacy batch field by field; the fields added since start out zero
+static void convert_legacy_batch(const LegacyImageBatch *legacy, ImageBatch *item)
+{
+    memset(item, 0, sizeof(*item));
+    item->mtype = legacy->mtype;
+    item->num_images = legacy->num_images;
+    item->batch_size = legacy->batch_size;
+    item->pipeline_id = legacy->pipeline_id;
+    item->priority = legacy->priority;
+    memcpy(item->filename, legacy->filename, sizeof(item->filename));
+    item->shmid = legacy->shmid;
+    memcpy(item->uuid, legacy->uuid, sizeof(item->uuid));
+    item->progress = legacy->progress;
+    item->storage_mode = legacy->storage_mode;
+}
+
+#define PQ_ITEMS_SIZE(capacity) ((size_t)(capacity) * sizeof(ImageBatch))
+
+// Write records into a fresh queue file next to path and atomically replace path with it.
+// Records shorter than ImageBatch are zero-extended, longer ones truncated, and all are resealed.
+static int write_pq_file(const char *path, const uint8_t *records, size_t count, size_t record_size, size_t capacity)
+{
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    if (capacity < count)
+        capacity = count;
+
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+    {
+        printf("Failed to create queue file: %s (%s)\n", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    if (ftruncate(fd, PQ_HEADER_SIZE + PQ_ITEMS_SIZE(capacity)) == -1)
+    {
+        printf("Failed to set file size: %s (%s)\n", tmp_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        ImageBatch item;
+        memset(&item, 0, sizeof(item));
+        memcpy(&item, records + i * record_size, record_size < sizeof(item) ? record_size : sizeof(item));
+        pq_seal_item(&item);
+
+        pwrite(fd, &item, sizeof(item), PQ_HEADER_SIZE + kept * sizeof(item));
+        kept++;
+    }
+
+    PriorityQueueHeader header = {
+        .magic = PQ_FILE_MAGIC,
+        .version = PQ_FILE_VERSION,
+        .capacity = capacity,
+        .record_size = sizeof(ImageBatch),
+        .size = kept,
+    };
+    pwrite(fd, &header, sizeof(header), 0);
+
+    fsync(fd);
+    close(fd);
+
+    if (rename(tmp_path, path) == -1)
+    {
+        printf("Failed to replace queue file: %s (%s)\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Bring the file at path to the current layout. Returns 1 if the items were
+// rewritten (and the heap must be rebuilt), 0 if the file was already current, -1 on error.
+static int prepare_pq_file(const char *path, size_t capacity)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd == -1)
+    {
+        printf("Failed to open/create queue file: %s (%s)\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    PriorityQueueHeader header;
+    memset(&header, 0, sizeof(header));
+    if (fstat(fd, &st) == -1 ||
+        (st.st_size >= (off_t)sizeof(header) && pread(fd, &header, sizeof(header), 0) != sizeof(header)))
+    {
+        printf("Failed to read queue file: %s (%s)\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (header.magic == PQ_FILE_MAGIC)
+    {
+        close(fd);
+        if (header.version > PQ_FILE_VERSION)
+        {
+            printf("Queue file %s has unsupported version %u\n", path, header.version);
+            return -1;
+        }
+        if (header.record_size == sizeof(ImageBatch))
+            return 0;
+
+        // written with a different ImageBatch layout: convert the records
+        printf("Converting queue file %s from record size %u to %zu\n", path, header.record_size, sizeof(ImageBatch));
+        if (header.size < 0 || (uint32_t)header.size > header.capacity ||
+            (size_t)st.st_size < PQ_HEADER_SIZE + (size_t)header.size * header.record_size)
+            header.size = 0;
+
+        uint8_t *records = malloc((size_t)header.size * header.record_size + 1);
+        fd = open(path, O_RDONLY);
+        if (!records || fd == -1 ||
+            pread(fd, records, (size_t)header.size * header.record_size, PQ_HEADER_SIZE) != (ssize_t)((size_t)header.size * header.record_size))
+        {
+            printf("Failed to read queue records: %s\n", path);
+            free(records);
+            if (fd != -1)
+                close(fd);
+            return -1;
+        }
+        close(fd);
+        size_t new_capacity = header.capacity > capacity ? header.capacity : capacity;
+        int res = write_pq_file(path, records, header.size, header.record_size, new_capacity);
+        free(records);
+        return res == 0 ? 1 : -1;
+    }
+
+    if (st.st_size >= (off_t)offsetof(LegacyPriorityQueue, lock))
+    {
+        // fixed-size queue file from before the versioned header
+        LegacyPriorityQueue *legacy = calloc(1, sizeof(LegacyPriorityQueue));
+        if (!legacy)
+        {
+            close(fd);
+            return -1;
+        }
+        size_t len = (size_t)st.st_size < sizeof(*legacy) ? (size_t)st.st_size : sizeof(*legacy);
+        ssize_t read_len = pread(fd, legacy, len, 0);
+        close(fd);
+        if (read_len != (ssize_t)len)
+        {
+            printf("Failed to read legacy queue file: %s\n", path);
+            free(legacy);
+            return -1;
+        }
+
+        if (legacy->size < 0 || legacy->size > PQ_LEGACY_CAPACITY)
+        {
+            printf("Queue file %s has invalid size %d, resetting it\n", path, legacy->size);
+            legacy->size = 0;
+        }
+
+        printf("Converting legacy queue file %s with %d items\n", path, legacy->size);
+        ImageBatch *items = malloc(PQ_LEGACY_CAPACITY * sizeof(ImageBatch));
+        if (!items)
+        {
+            free(legacy);
+            return -1;
+        }
+        int verify = legacy->checksum_magic == PQ_CHECKSUM_MAGIC;
+        size_t kept = 0;
+        for (int i = 0; i < legacy->size; i++)
+        {
+            if (verify && legacy->items[i].checksum != legacy_batch_checksum(&legacy->items[i]))
+            {
+                printf("Dropping corrupt batch while converting %s\n", path);
+                continue;
+            }
+            convert_legacy_batch(&legacy->items[i], &items[kept++]);
+        }
+        int res = write_pq_file(path, (const uint8_t *)items, kept, sizeof(ImageBatch), capacity);
+        free(items);
+        free(legacy);
+        return res == 0 ? 1 : -1;
+    }
+
+    close(fd);
+    if (st.st_size != 0)
+        printf("Queue file %s is not a queue, reinitializing it\n", path);
+
+    return write_pq_file(path, NULL, 0, sizeof(ImageBatch), capacity) == 0 ? 0 : -1;
+}
+
+// The lock lives in the file so producers in other processes can share it; it is
+// robust so a process dying inside a critical section does not wedge the queue
+static void init_shared_lock(pthread_mutex_t *lock)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+// Map the header page of an open queue file into a new handle
+static PriorityQueue *map_pq_header(PriorityQueue *pq, int fd, const char *file)
+{
+    PriorityQueueHeader *header = mmap(NULL, PQ_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED)
+    {
+        printf("Failed to memory map queue file: %s (%s)\n", file, strerror(errno));
+        return NULL;
+    }
+
+    if (pq == NULL)
+    {
+        pq = malloc(sizeof(PriorityQueue));
+        if (!pq)
+        {
+            printf("Failed to allocate memory for priority queue\n");
+            munmap(header, PQ_HEADER_SIZE);
+            return NULL;
+        }
+    }
+
+    pq->header = header;
+    pq->items = NULL;
+    pq->mapped_capacity = 0;
+    pq->fd = fd;
+    pq->backend = NULL;
+    return pq;
+}
+
+// Make the item mapping match the capacity in the header, which another process
+// may have grown since this process last held the lock; caller holds the lock
+static int remap_pq_mmap_locked(PriorityQueue *pq)
+{
+    size_t capacity = pq->header->capacity;
+    if (capacity == pq->mapped_capacity)
+        return 0;
+    if (capacity == 0 || capacity > PQ_MAX_CAPACITY)
+    {
+        printf("Queue has invalid capacity %zu\n", capacity);
+        return -1;
+    }
+
+    void *items;
+    if (pq->items == NULL)
+        items = mmap(NULL, PQ_ITEMS_SIZE(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, pq->fd, PQ_HEADER_SIZE);
+    else
+        items = mremap(pq->items, PQ_ITEMS_SIZE(pq->mapped_capacity), PQ_ITEMS_SIZE(capacity), MREMAP_MAYMOVE);
+
+    if (items == MAP_FAILED)
+    {
+        printf("Failed to map queue items (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    pq->items = items;
+    pq->mapped_capacity = capacity;
+    return 0;
+}
+
+// Clamp the size and rebuild the heap after an owner died mid-operation or the file was
+// converted; items left half-written fail verification and are dropped on dequeue
+static void repair_pq_mmap_locked(PriorityQueue *pq)
+{
+    if (pq->header->size < 0 || (uint32_t)pq->header->size > pq->header->capacity)
+        pq->header->size = 0;
+    heapify(pq);
+    pq->header->needs_repair = 0;
+}
+
+// Take the shared lock and bring the mapping up to date, repairing the heap if needed
+static int lock_pq_mmap(PriorityQueue *pq)
+{
+    pq_lock(pq);
+    if (remap_pq_mmap_locked(pq) != 0)
+    {
+        pq_unlock(pq);
+        return -1;
+    }
+
+    if (pq->header->needs_repair)
+    {
+        repair_pq_mmap_locked(pq);
+        printf("Repaired priority queue with %d items\n", pq->header->size);
+    }
+    return 0;
+}
+
+// mmap init: bring the file to the current layout, then map the header page and the
+// item array separately so the items can be remapped on growth.
+int init_pq_mmap(PriorityQueue **pq, char *filename, size_t capacity)
 {
     const char *file = filename;
     if (pq == NULL || file == NULL)
@@ -18,62 +354,205 @@ int init_pq_mmap(PriorityQueue **pq, char *filename)
         return -1;
     }
 
-    struct stat st;
-    int exists = (stat(file, &st) == 0);
+    if (capacity == 0 || capacity > PQ_MAX_CAPACITY)
+        capacity = DEFAULT_QUEUE_CAPACITY;
 
-    int fd = open(file, O_RDWR | O_CREAT, 0666);
+    int converted = prepare_pq_file(file, capacity);
+    if (converted == -1)
+        return -1;
+
+    int fd = open(file, O_RDWR);
     if (fd == -1)
     {
-        printf("Failed to open/create queue file: %s (%s)\n", file, strerror(errno));
+        printf("Failed to open queue file: %s (%s)\n", file, strerror(errno));
+        return -1;
+    }
+
+    PriorityQueue *handle = map_pq_header(*pq, fd, file);
+    if (!handle)
+    {
+        close(fd);
         return -1;
     }
+    *pq = handle;
+    PriorityQueueHeader *header = handle->header;
+
+    // a lock from an earlier boot (or an older file version) may be held by a process
+    // that no longer exists; within one boot the lock is reused, producers may hold it
+    uint32_t boot_id = pq_boot_id();
+    if (converted || header->version < PQ_FILE_VERSION || boot_id == 0 || header->boot_id != boot_id)
+    {
+        init_shared_lock(&header->lock);
+        header->version = PQ_FILE_VERSION;
+        header->boot_id = boot_id;
+        header->waiters = 0;
+        header->needs_repair = converted;
+    }
+
+    pq_lock(handle);
+
+    if (header->capacity == 0 || header->capacity > PQ_MAX_CAPACITY)
+    {
+        printf("Queue file %s has invalid capacity %u, resetting it\n", file, header->capacity);
+        header->capacity = capacity;
+        header->size = 0;
+    }
+
+    // a torn write may leave an impossible size behind; start over rather than read garbage
+    if (header->size < 0 || (uint32_t)header->size > header->capacity)
+    {
+        printf("Queue file %s has invalid size %d, resetting it\n", file, header->size);
+        header->size = 0;
+    }
+
+    // an existing queue keeps its (possibly grown) capacity
+    if (capacity < header->capacity)
+        capacity = header->capacity;
 
-    size_t size = sizeof(PriorityQueue);
-    if (ftruncate(fd, size) == -1)
+    // the file may be shorter than the header claims after a crash during growth
+    if (ftruncate(fd, PQ_HEADER_SIZE + PQ_ITEMS_SIZE(capacity)) == -1)
     {
         printf("Failed to set file size: %s (%s)\n", file, strerror(errno));
+        pq_unlock(handle);
+        return -1;
+    }
+    header->capacity = capacity;
+
+    if (remap_pq_mmap_locked(handle) != 0)
+    {
+        pq_unlock(handle);
+        return -1;
+    }
+
+    // converted files may have lost items, restore the heap property bottom-up
+    if (header->needs_repair)
+        repair_pq_mmap_locked(handle);
+
+    msync(handle->items, PQ_ITEMS_SIZE(header->size), MS_SYNC);
+    msync(header, PQ_HEADER_SIZE, MS_SYNC);
+    pq_unlock(handle);
+
+    // keep mapping and fd alive; the fd is needed to grow the file
+    return 0;
+}
+
+// Attach to a queue file that a running DIPP instance has initialised in this boot.
+// The file is never created or converted here, so producers cannot race DIPP's setup.
+int attach_pq_mmap(PriorityQueue **pq, const char *filename)
+{
+    if (pq == NULL || filename == NULL)
+    {
+        printf("Error: provided PriorityQueue** or filename is NULL\n");
+        return -1;
+    }
+
+    int fd = open(filename, O_RDWR);
+    if (fd == -1)
+    {
+        printf("Failed to open queue file: %s (%s)\n", filename, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < PQ_HEADER_SIZE)
+    {
+        printf("Queue file %s is not initialised\n", filename);
         close(fd);
         return -1;
     }
 
-    void *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (mapped == MAP_FAILED)
+    PriorityQueue *handle = map_pq_header(*pq, fd, filename);
+    if (!handle)
     {
-        printf("Failed to memory map queue file: %s (%s)\n", file, strerror(errno));
         close(fd);
         return -1;
     }
 
-    if (!exists)
+    PriorityQueueHeader *header = handle->header;
+    uint32_t boot_id = pq_boot_id();
+    if (header->magic != PQ_FILE_MAGIC || header->version != PQ_FILE_VERSION ||
+        header->record_size != sizeof(ImageBatch) || boot_id == 0 || header->boot_id != boot_id)
     {
-        memset(mapped, 0, size);
-        msync(mapped, size, MS_SYNC);
+        printf("Queue file %s has not been initialised by DIPP in this boot\n", filename);
+        munmap(header, PQ_HEADER_SIZE);
+        close(fd);
+        if (handle != *pq)
+            free(handle);
+        return -1;
     }
 
-    // return mapped region to caller
-    *pq = (PriorityQueue *)mapped;
+    *pq = handle;
+    if (lock_pq_mmap(handle) != 0)
+        return -1;
+    pq_unlock(handle);
+    return 0;
+}
+
+// Persist the items that may have changed and the header
+static void sync_pq_mmap(PriorityQueue *pq)
+{
+    size_t touched = (size_t)pq->header->size + 1;
+    if (touched > pq->mapped_capacity)
+        touched = pq->mapped_capacity;
+    msync(pq->items, PQ_ITEMS_SIZE(touched), MS_SYNC);
+    msync(pq->header, PQ_HEADER_SIZE, MS_SYNC);
+}
+
+// Grow the backing file and remap the item array; caller holds the lock
+static int grow_pq_mmap_locked(PriorityQueue *pq, size_t capacity)
+{
+    if (capacity <= pq->header->capacity)
+        return 0;
+    if (capacity > PQ_MAX_CAPACITY)
+        return -1;
 
-    // initialize mutex and size (if newly created)
-    if (!exists)
+    // extend the file first: a crash after this leaves a larger file with the old capacity, which is harmless
+    if (ftruncate(pq->fd, PQ_HEADER_SIZE + PQ_ITEMS_SIZE(capacity)) == -1)
     {
-        (*pq)->size = 0;
+        printf("Failed to grow queue file (%s)\n", strerror(errno));
+        return -1;
     }
-    pthread_mutex_init(&(*pq)->lock, NULL);
 
-    // keep mapping alive; close fd
-    close(fd);
+    void *items = mremap(pq->items, PQ_ITEMS_SIZE(pq->mapped_capacity), PQ_ITEMS_SIZE(capacity), MREMAP_MAYMOVE);
+    if (items == MAP_FAILED)
+    {
+        printf("Failed to remap queue items (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    pq->items = items;
+    pq->mapped_capacity = capacity;
+    // other processes pick up the new capacity and remap the next time they take the lock
+    pq->header->capacity = capacity;
+    msync(pq->header, PQ_HEADER_SIZE, MS_SYNC);
+
+    printf("Grew priority queue to %zu items\n", capacity);
     return 0;
 }
 
+int grow_pq_mmap(PriorityQueue *pq, size_t capacity)
+{
+    if (lock_pq_mmap(pq) != 0)
+        return -1;
+    int res = grow_pq_mmap_locked(pq, capacity);
+    pq_unlock(pq);
+    return res;
+}
+
 // Define enqueue function to add an item to the queue
 int enqueue_mmap(PriorityQueue *pq, ImageBatch item)
 {
     MTR_BEGIN_FUNC();
-    pthread_mutex_lock(&pq->lock);
+    if (lock_pq_mmap(pq) != 0)
+    {
+        MTR_END_FUNC();
+        return -1;
+    }
 
-    if (pq->size == MAX_QUEUE_SIZE)
+    if (pq->header->size == pq->header->capacity &&
+        grow_pq_mmap_locked(pq, pq_next_capacity(pq->header->capacity)) != 0)
     {
-        pthread_mutex_unlock(&pq->lock);
+        pq_unlock(pq);
         printf("Priority queue is full\n");
         MTR_END_FUNC();
         return -1; // full
@@ -81,6 +560,7 @@ int enqueue_mmap(PriorityQueue *pq, ImageBatch item)
 
     // each process will later memory-map the contents into this pointer
     item.data = NULL;
+    pq_stamp_item(&item);
 
     // printf("New item arrived in pq: \r\n");
     // printf("Number of images: %i\r\n", item.num_images);
@@ -92,14 +572,15 @@ int enqueue_mmap(PriorityQueue *pq, ImageBatch item)
     // printf("Progress: %i\r\n", item.progress);
     // printf("Storage mode: %i\r\n", item.storage_mode);
 
-    pq->items[pq->size++] = item;
-    heapifyUp(pq, pq->size - 1);
+    pq_seal_item(&item);
+    pq->items[pq->header->size++] = item;
+    heapifyUp(pq, pq->header->size - 1);
 
     // sync to disk
-    msync(pq, sizeof(PriorityQueue), MS_SYNC);
+    sync_pq_mmap(pq);
 
     // printf("Item enqueued. Here is the queue.\r\n");
-    // for (int i = 0; i < pq->size; i++)
+    // for (int i = 0; i < pq->header->size; i++)
     // {
     //     // print data inside each item
     //     printf("Item %i:\r\n", i);
@@ -114,53 +595,242 @@ int enqueue_mmap(PriorityQueue *pq, ImageBatch item)
     //     printf("----\r\n");
     // }
 
-    pthread_mutex_unlock(&pq->lock);
+    pq_unlock(pq);
+    pq_notify(pq);
     MTR_END_FUNC();
     return 0; // success
 }
 
-// Define dequeue function to remove an item from the queue
-ImageBatch *dequeue_mmap(PriorityQueue *pq)
+// Drop corrupt items from the root until it holds a valid one; caller holds the lock.
+// Items are verified lazily when they reach the root; corrupt ones (e.g. restored
+// from a torn msync) are dropped instead of processed. Returns 1 if any item was dropped.
+static int drop_corrupt_head_locked(PriorityQueue *pq)
 {
-    MTR_BEGIN_FUNC();
-    pthread_mutex_lock(&pq->lock);
+    int dropped = 0;
+    while (pq->header->size && !pq_verify_item(&pq->items[0]))
+    {
+        printf("Dropping corrupt batch from priority queue (checksum mismatch)\n");
+        heap_remove_at(pq, 0);
+        dropped = 1;
+    }
+    return dropped;
+}
 
-    if (!pq->size)
+// Take the head into out only if predicate (when given) accepts it, deciding and
+// removing under one lock so the head cannot change in between
+int dequeue_if_mmap(PriorityQueue *pq, int (*predicate)(const ImageBatch *head, void *ctx), void *ctx, ImageBatch *out)
+{
+    MTR_BEGIN_FUNC();
+    if (lock_pq_mmap(pq) != 0)
     {
-        pthread_mutex_unlock(&pq->lock);
-        // printf("Priority queue is empty\n");
         MTR_END_FUNC();
-        return NULL;
+        return 0;
+    }
+
+    int changed = drop_corrupt_head_locked(pq);
+    int taken = 0;
+    if (pq->header->size && (predicate == NULL || predicate(&pq->items[0], ctx)))
+    {
+        *out = pq->items[0]; // shallow copy of the item
+        heap_remove_at(pq, 0);
+        changed = taken = 1;
     }
 
+    // sync to disk
+    if (changed)
+        sync_pq_mmap(pq);
+
+    pq_unlock(pq);
+    MTR_END_FUNC();
+    return taken;
+}
+
+int dequeue_into_mmap(PriorityQueue *pq, ImageBatch *out)
+{
+    return dequeue_if_mmap(pq, NULL, NULL, out);
+}
+
+// Copy the head into out without removing it
+int peek_into_mmap(PriorityQueue *pq, ImageBatch *out)
+{
+    if (lock_pq_mmap(pq) != 0)
+        return 0;
+
+    if (drop_corrupt_head_locked(pq))
+        sync_pq_mmap(pq);
+
+    int found = pq->header->size > 0;
+    if (found)
+        *out = pq->items[0];
+
+    pq_unlock(pq);
+    return found;
+}
+
+// Define dequeue function to remove an item from the queue
+ImageBatch *dequeue_mmap(PriorityQueue *pq)
+{
+    ImageBatch item;
+    if (!dequeue_into_mmap(pq, &item))
+        return NULL;
+
     // allocate a stable copy for the caller (so returned pointer isn't into the mmap region)
     ImageBatch *res = malloc(sizeof(ImageBatch));
-    if (!res)
+    if (res)
+        *res = item;
+    return res;
+}
+
+// Append a burst of items and restore the heap once, with a single msync
+int enqueue_bulk_mmap(PriorityQueue *pq, ImageBatch *items, size_t count)
+{
+    MTR_BEGIN_FUNC_I("count", (int)count);
+    if (lock_pq_mmap(pq) != 0)
     {
-        pthread_mutex_unlock(&pq->lock);
         MTR_END_FUNC();
-        return NULL;
+        return 0;
     }
 
-    *res = pq->items[0]; // shallow copy of the item
-    pq->items[0] = pq->items[--pq->size];
-    heapifyDown(pq, 0);
+    // make room for the whole burst up front, as far as growth allows
+    grow_pq_mmap_locked(pq, pq_capacity_for(pq->header->capacity, pq->header->size + count));
+
+    int old_size = pq->header->size;
+    size_t enqueued = 0;
+    while (enqueued < count && (uint32_t)pq->header->size < pq->header->capacity)
+    {
+        ImageBatch item = items[enqueued++];
+        item.data = NULL;
+        pq_stamp_item(&item);
+        pq_seal_item(&item);
+        pq->items[pq->header->size++] = item;
+    }
+    heapify_appended(pq, old_size);
 
     // sync to disk
-    msync(pq, sizeof(PriorityQueue), MS_SYNC);
+    sync_pq_mmap(pq);
 
-    pthread_mutex_unlock(&pq->lock);
+    pq_unlock(pq);
+    if (enqueued)
+        pq_notify(pq);
+
+    if (enqueued < count)
+        printf("Priority queue is full, dropped %zu batches\n", count - enqueued);
 
     MTR_END_FUNC();
-    return res;
+    return (int)enqueued;
+}
+
+// Pop up to max items in priority order, verifying each, with a single msync
+size_t dequeue_bulk_mmap(PriorityQueue *pq, ImageBatch *out, size_t max)
+{
+    MTR_BEGIN_FUNC();
+    if (lock_pq_mmap(pq) != 0)
+    {
+        MTR_END_FUNC();
+        return 0;
+    }
+
+    size_t dequeued = 0;
+    int popped = 0;
+    while (dequeued < max && pq->header->size)
+    {
+        out[dequeued] = pq->items[0];
+        pq->items[0] = pq->items[--pq->header->size];
+        heapifyDown(pq, 0);
+        popped = 1;
+
+        if (!pq_verify_item(&out[dequeued]))
+        {
+            printf("Dropping corrupt batch from priority queue (checksum mismatch)\n");
+            continue;
+        }
+        dequeued++;
+    }
+
+    if (popped)
+        sync_pq_mmap(pq);
+
+    pq_unlock(pq);
+    MTR_END_FUNC();
+    return dequeued;
+}
+
+// Scan for the earliest matching item in O(n) and remove it in O(log n), dropping corrupt matches
+int dequeue_match_mmap(PriorityQueue *pq, int (*match)(const ImageBatch *item, void *ctx), void *ctx, ImageBatch *out)
+{
+    MTR_BEGIN_FUNC();
+    if (lock_pq_mmap(pq) != 0)
+    {
+        MTR_END_FUNC();
+        return 0;
+    }
+
+    int found = 0;
+    int popped = 0;
+    int index;
+    while (!found && (index = heap_find_match(pq, match, ctx)) != -1)
+    {
+        *out = pq->items[index];
+        heap_remove_at(pq, index);
+        popped = 1;
+
+        found = pq_verify_item(out);
+        if (!found)
+            printf("Dropping corrupt batch from priority queue (checksum mismatch)\n");
+    }
+
+    if (popped)
+        sync_pq_mmap(pq);
+
+    pq_unlock(pq);
+    MTR_END_FUNC();
+    return found;
+}
+
+// The root holds the earliest deadline, so expired items are popped from the top
+size_t dequeue_expired_mmap(PriorityQueue *pq, int64_t now, ImageBatch *out, size_t max)
+{
+    MTR_BEGIN_FUNC();
+    if (lock_pq_mmap(pq) != 0)
+    {
+        MTR_END_FUNC();
+        return 0;
+    }
+
+    size_t dequeued = 0;
+    int popped = 0;
+    while (dequeued < max && pq->header->size && pq->items[0].priority < now)
+    {
+        out[dequeued] = pq->items[0];
+        pq->items[0] = pq->items[--pq->header->size];
+        heapifyDown(pq, 0);
+        popped = 1;
+
+        if (!pq_verify_item(&out[dequeued]))
+        {
+            printf("Dropping corrupt batch from priority queue (checksum mismatch)\n");
+            continue;
+        }
+        dequeued++;
+    }
+
+    if (popped)
+        sync_pq_mmap(pq);
+
+    pq_unlock(pq);
+    MTR_END_FUNC();
+    return dequeued;
 }
 
 int clean_up_pq_mmap(PriorityQueue *pq)
 {
-    pthread_mutex_destroy(&pq->lock);
     if (pq)
     {
-        munmap(pq, sizeof(PriorityQueue));
+        // the lock stays in the file, other processes may still share it
+        munmap(pq->items, PQ_ITEMS_SIZE(pq->mapped_capacity));
+        munmap(pq->header, PQ_HEADER_SIZE);
+        close(pq->fd);
+        free(pq);
     }
     return 0;
 }
@@ -169,6 +839,14 @@ PriorityQueueImpl priority_queue_mmap = {
     .init = init_pq_mmap,
     .enqueue = enqueue_mmap,
     .dequeue = dequeue_mmap,
+    .dequeue_into = dequeue_into_mmap,
+    .dequeue_if = dequeue_if_mmap,
+    .enqueue_bulk = enqueue_bulk_mmap,
+    .dequeue_bulk = dequeue_bulk_mmap,
+    .dequeue_match = dequeue_match_mmap,
+    .dequeue_expired = dequeue_expired_mmap,
     .peek = peek,
+    .peek_into = peek_into_mmap,
     .get_queue_size = get_queue_size,
+    .grow = grow_pq_mmap,
     .clean_up = clean_up_pq_mmap};
\ No newline at end of file
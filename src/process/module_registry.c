@@ -0,0 +1,265 @@
+#define _GNU_SOURCE // dl_iterate_phdr
+#include <dlfcn.h>
+#include <link.h>
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "module_registry.h"
+#include "dipp_error.h"
+#include "murmur_hash.h"
+#include "utils/minitrace.h"
+
+// Only touched from the processing thread (config loading), so no locking
+static LoadedModule loaded_modules[MAX_LOADED_MODULES];
+
+typedef struct BuildIdSearch
+{
+    const char *path;
+    uint32_t build_id;
+    int found;
+} BuildIdSearch;
+
+// Hash the NT_GNU_BUILD_ID note of the loaded object named search->path
+static int find_build_id(struct dl_phdr_info *info, size_t size, void *data)
+{
+    (void)size;
+    BuildIdSearch *search = data;
+    if (info->dlpi_name == NULL || strcmp(info->dlpi_name, search->path) != 0)
+        return 0;
+
+    for (int i = 0; i < info->dlpi_phnum; i++)
+    {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_NOTE)
+            continue;
+
+        const uint8_t *note = (const uint8_t *)(info->dlpi_addr + phdr->p_vaddr);
+        const uint8_t *end = note + phdr->p_memsz;
+        while (note + sizeof(ElfW(Nhdr)) <= end)
+        {
+            const ElfW(Nhdr) *nhdr = (const ElfW(Nhdr) *)note;
+            const uint8_t *name = note + sizeof(ElfW(Nhdr));
+            const uint8_t *desc = name + ((nhdr->n_namesz + 3) & ~3u);
+            if (desc + nhdr->n_descsz > end)
+                break;
+
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 && memcmp(name, "GNU", 4) == 0)
+            {
+                search->build_id = murmur3_32(desc, nhdr->n_descsz, 42);
+                search->found = 1;
+                return 1;
+            }
+            note = desc + ((nhdr->n_descsz + 3) & ~3u);
+        }
+    }
+    return 1; // the object has no build-id, stop looking
+}
+
+// Identify the module binary, so costs measured on another build are never reused.
+// Modules linked without a build-id are identified by their file instead.
+static uint32_t get_module_build_id(const char *filename, const struct stat *st)
+{
+    BuildIdSearch search = {.path = filename, .build_id = 0, .found = 0};
+    dl_iterate_phdr(find_build_id, &search);
+    if (search.found)
+        return search.build_id;
+
+    uint64_t identity[] = {st->st_dev, st->st_ino, st->st_size, st->st_mtim.tv_sec, st->st_mtim.tv_nsec};
+    return murmur3_32((const uint8_t *)identity, sizeof(identity), 42);
+}
+
+static int64_t mtime_ns(const struct stat *st)
+{
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static LoadedModule *find_loaded(const char *path, const struct stat *st)
+{
+    for (int i = 0; i < MAX_LOADED_MODULES; i++)
+    {
+        LoadedModule *module = &loaded_modules[i];
+        if (module->refcount > 0 && strcmp(module->path, path) == 0 &&
+            module->dev == st->st_dev && module->ino == st->st_ino && module->mtime_ns == mtime_ns(st))
+            return module;
+    }
+    return NULL;
+}
+
+// A loaded build of the binary at path, other than the one now on disk
+static LoadedModule *find_other_build(const char *path)
+{
+    for (int i = 0; i < MAX_LOADED_MODULES; i++)
+    {
+        if (loaded_modules[i].refcount > 0 && strcmp(loaded_modules[i].path, path) == 0)
+            return &loaded_modules[i];
+    }
+    return NULL;
+}
+
+// Returns 1 if handle belongs to a build of the binary at path that is already loaded
+static int is_loaded_build(const char *path, void *handle)
+{
+    for (int i = 0; i < MAX_LOADED_MODULES; i++)
+    {
+        if (loaded_modules[i].refcount > 0 && strcmp(loaded_modules[i].path, path) == 0 &&
+            loaded_modules[i].handle == handle)
+            return 1;
+    }
+    return 0;
+}
+
+// Copy the module binary to a private file next to it. The dynamic loader hands back an
+// object it already mapped from the same path or inode, so a rebuilt module is only
+// really loaded from a file of its own while the previous build is still in use.
+// Returns 0 and the copy's path, which the caller unlinks once it is opened.
+static int copy_module(const char *filename, const char *module_name, char *copy_path, size_t size)
+{
+    snprintf(copy_path, size, MODULE_DIRECTORY "/.%s-XXXXXX.so", module_name);
+    int out = mkstemps(copy_path, 3);
+    if (out == -1)
+        return -1;
+
+    int in = open(filename, O_RDONLY);
+    char buffer[65536];
+    ssize_t len = in == -1 ? -1 : 0;
+    while (in != -1 && (len = read(in, buffer, sizeof(buffer))) > 0)
+    {
+        if (write(out, buffer, len) != len)
+        {
+            len = -1;
+            break;
+        }
+    }
+    if (in != -1)
+        close(in);
+    close(out);
+
+    if (len != 0)
+    {
+        unlink(copy_path);
+        return -1;
+    }
+    return 0;
+}
+
+static LoadedModule *free_slot()
+{
+    for (int i = 0; i < MAX_LOADED_MODULES; i++)
+    {
+        if (loaded_modules[i].refcount == 0)
+            return &loaded_modules[i];
+    }
+    return NULL;
+}
+
+LoadedModule *module_registry_acquire(const char *module_name)
+{
+    char filename[MODULE_PATH_SIZE];
+    snprintf(filename, sizeof(filename), MODULE_DIRECTORY "/%s.so", module_name);
+
+    struct stat st;
+    if (stat(filename, &st) == -1)
+    {
+        printf("Error loading module: %s not found\r\n", filename);
+        set_error_param(INTERNAL_SO_NOT_FOUND);
+        return NULL;
+    }
+
+    LoadedModule *module = find_loaded(filename, &st);
+    if (module != NULL)
+    {
+        module->refcount++;
+        return module;
+    }
+
+    module = free_slot();
+    if (module == NULL)
+    {
+        printf("Error loading module %s: too many modules loaded\r\n", module_name);
+        set_error_param(INTERNAL_SO_NOT_FOUND);
+        return NULL;
+    }
+
+    MTR_BEGIN_FUNC();
+    printf("Loading module from %s\r\n", filename);
+
+    // the previous build stays loaded until the pipelines using it are rebuilt
+    LoadedModule *previous = find_other_build(filename);
+    char load_path[MODULE_PATH_SIZE];
+    strncpy(load_path, filename, sizeof(load_path));
+    if (previous != NULL && copy_module(filename, module_name, load_path, sizeof(load_path)) != 0)
+    {
+        printf("Error loading module %s: could not copy the rebuilt binary\r\n", module_name);
+        set_error_param(INTERNAL_SO_NOT_FOUND);
+        MTR_END_FUNC();
+        return NULL;
+    }
+
+    // bind every symbol now, in the parent, instead of in each forked child
+    void *handle = dlopen(load_path, RTLD_NOW);
+    if (previous != NULL)
+        unlink(load_path); // stays mapped
+    if (handle == NULL)
+    {
+        printf("Error loading module: %s\r\n", dlerror());
+        set_error_param(INTERNAL_SO_NOT_FOUND);
+        MTR_END_FUNC();
+        return NULL;
+    }
+    if (previous != NULL && is_loaded_build(filename, handle))
+    {
+        printf("Error loading module %s: the loader returned the previous build\r\n", module_name);
+        set_error_param(INTERNAL_SO_NOT_FOUND);
+        dlclose(handle);
+        MTR_END_FUNC();
+        return NULL;
+    }
+
+    ProcessFunction run = (ProcessFunction)dlsym(handle, "run");
+    if (run == NULL)
+    {
+        set_error_param(INTERNAL_RUN_NOT_FOUND);
+        dlclose(handle);
+        MTR_END_FUNC();
+        return NULL;
+    }
+
+    ModuleInitFunction init = (ModuleInitFunction)dlsym(handle, "init");
+    if (init != NULL && init() != 0)
+    {
+        printf("Module %s failed to initialise\r\n", module_name);
+        set_error_param(INTERNAL_MODULE_INIT);
+        dlclose(handle);
+        MTR_END_FUNC();
+        return NULL;
+    }
+
+    strncpy(module->path, filename, sizeof(module->path) - 1);
+    module->path[sizeof(module->path) - 1] = '\0';
+    module->handle = handle;
+    module->run = run;
+    module->build_id = get_module_build_id(load_path, &st);
+    module->dev = st.st_dev;
+    module->ino = st.st_ino;
+    module->mtime_ns = mtime_ns(&st);
+    module->refcount = 1;
+    MTR_END_FUNC();
+    return module;
+}
+
+void module_registry_release(LoadedModule *module)
+{
+    if (module == NULL || module->refcount <= 0)
+        return;
+
+    if (--module->refcount == 0)
+    {
+        printf("Unloading module %s\r\n", module->path);
+        dlclose(module->handle);
+        memset(module, 0, sizeof(*module));
+    }
+}
@@ -1,10 +1,13 @@
+#define _GNU_SOURCE // pipe2
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <errno.h>
 #include "process_module.h"
 #include "image_batch.h"
 #include "dipp_config.h"
@@ -12,79 +15,182 @@
 #include "dipp_error.h"
 #include "utils/minitrace.h"
 
-int output_pipe[2] = {-1, -1};
 int error_pipe[2] = {-1, -1};
 
+// Module processes started and not collected yet. A new child closes their pipes, so
+// that each pipe reaches end of file as soon as its own module exits.
+static ModuleProcess live_processes[MAX_MODULES];
+static int num_live_processes = 0;
+
 // Signal handler for timeout
 void timeout_handler(int signum)
 {
     printf("Module timeout reached\n");
     uint16_t error_code = MODULE_EXIT_TIMEOUT;
     write(error_pipe[1], &error_code, sizeof(uint16_t));
-    exit(EXIT_FAILURE); // Exit the child process with failure status
+    fflush(stdout);
+    _exit(EXIT_FAILURE); // Exit the child process with failure status
+}
+
+uint32_t module_timeout_s()
+{
+    return param_get_uint32(&module_timeout);
+}
+
+static void close_pipes(ModuleProcess *process)
+{
+    close(process->output_pipe[0]);
+    close(process->output_pipe[1]);
+    close(process->error_pipe[0]);
+    close(process->error_pipe[1]);
 }
 
-int execute_module_in_process(ProcessFunction func, ImageBatch *input, ModuleParameterList *config)
+static void forget_process(ModuleProcess *process)
+{
+    for (int i = 0; i < num_live_processes; i++)
+    {
+        if (live_processes[i].pid == process->pid)
+        {
+            live_processes[i] = live_processes[--num_live_processes];
+            break;
+        }
+    }
+}
+
+int start_module_process(ModuleProcess *process, ProcessFunction func, ImageBatch *input, ModuleParameterList *config)
 {
     MTR_BEGIN_FUNC();
+    /* Initiate communication pipes */
+    if (pipe2(process->output_pipe, O_CLOEXEC) == -1)
+    {
+        set_error_param(PIPE_CREATE);
+        MTR_END_FUNC();
+        return -1;
+    }
+    if (pipe2(process->error_pipe, O_CLOEXEC) == -1)
+    {
+        close(process->output_pipe[0]);
+        close(process->output_pipe[1]);
+        set_error_param(PIPE_CREATE);
+        MTR_END_FUNC();
+        return -1;
+    }
+
     // Create a new process
-    pid_t pid = fork();
+    process->pid = fork();
 
-    if (pid == 0)
+    if (process->pid == 0)
     {
+        // the pipes of the modules running next to this one are theirs alone
+        for (int i = 0; i < num_live_processes; i++)
+            close_pipes(&live_processes[i]);
+        num_live_processes = 0;
+
         // Set up signal handler for timeout and starm alarm timer
+        error_pipe[0] = process->error_pipe[0];
+        error_pipe[1] = process->error_pipe[1];
         signal(SIGALRM, timeout_handler);
-        alarm(param_get_uint32(&module_timeout));
+        alarm(module_timeout_s());
 
         // Child process: Execute the module function
-        ImageBatch result = func(input, config, error_pipe);
+        ImageBatch result = func(input, config, process->error_pipe);
         alarm(0); // stop timeout alarm
         size_t data_size = sizeof(result);
-        write(output_pipe[1], &result, data_size); // Write the result to the pipe
-        exit(EXIT_SUCCESS);
+        write(process->output_pipe[1], &result, data_size); // Write the result to the pipe
+        // skip the exit handlers, they shut down the parent's threads and stores
+        fflush(stdout);
+        _exit(EXIT_SUCCESS);
+    }
+    else if (process->pid == -1)
+    {
+        close_pipes(process);
+        set_error_param(MODULE_EXIT_CRASH);
+        MTR_END_FUNC();
+        return -1;
+    }
+
+    if (num_live_processes < MAX_MODULES)
+        live_processes[num_live_processes++] = *process;
+    MTR_END_FUNC();
+    return 0;
+}
+
+int finish_module_process(ModuleProcess *process, int status, ImageBatch *result)
+{
+    MTR_BEGIN_FUNC();
+    int ret = 0;
+    if (WIFEXITED(status))
+    {
+        // Child process exited normally (EXIT_FAILURE)
+        if (WEXITSTATUS(status) != 0)
+        {
+            uint16_t module_error;
+            close(process->error_pipe[1]); // an empty pipe then reads as end of file
+            ssize_t res = read(process->error_pipe[0], &module_error, sizeof(uint16_t));
+            process->error_pipe[1] = -1;
+            if (res == -1)
+                set_error_param(PIPE_READ);
+            else if (res == 0)
+                set_error_param(MODULE_EXIT_NORMAL);
+            else if (module_error < 100)
+                set_error_param(MODULE_EXIT_CUSTOM + module_error);
+            else
+                set_error_param(module_error);
+
+            // the module ran in the child, so the parent's configuration is intact
+
+            fprintf(stderr, "Child process exited with non-zero status\n");
+            ret = -1;
+        }
     }
     else
     {
-        // Parent process: Wait for the child process to finish
-        int status;
-        waitpid(pid, &status, 0);
+        // Child process did not exit normally (CRASH)
+        set_error_param(MODULE_EXIT_CRASH);
+        fprintf(stderr, "Child process did not exit normally\n");
+        ret = -1;
+    }
 
-        if (WIFEXITED(status))
+    if (ret == 0)
+    {
+        close(process->output_pipe[1]);
+        process->output_pipe[1] = -1;
+        ssize_t res = read(process->output_pipe[0], result, sizeof(*result)); // Read the result from the pipe
+        if (res == -1)
         {
-            // Child process exited normally (EXIT_FAILURE)
-            if (WEXITSTATUS(status) != 0)
-            {
-                uint16_t module_error;
-                size_t res = read(error_pipe[0], &module_error, sizeof(uint16_t));
-                if (res == -1)
-                    set_error_param(PIPE_READ);
-                else if (res == 0)
-                    set_error_param(MODULE_EXIT_NORMAL);
-                else if (module_error < 100)
-                    set_error_param(MODULE_EXIT_CUSTOM + module_error);
-                else
-                    set_error_param(module_error);
-
-                // invalidate cache, to be rebuilt in next pipeline invocation
-                invalidate_cache();
-
-                fprintf(stderr, "Child process exited with non-zero status\n");
-                MTR_END_FUNC();
-                return -1;
-            }
+            set_error_param(PIPE_READ);
+            ret = -1;
         }
-        else
+        else if (res == 0)
         {
-            // Child process did not exit normally (CRASH)
-            set_error_param(MODULE_EXIT_CRASH);
-            // invalidate cache
-            invalidate_cache();
-            fprintf(stderr, "Child process did not exit normally\n");
-            MTR_END_FUNC();
-            return -1;
+            set_error_param(PIPE_EMPTY);
+            ret = -1;
         }
-
-        MTR_END_FUNC();
-        return 0;
     }
-}
\ No newline at end of file
+
+    close_pipes(process);
+    forget_process(process);
+    MTR_END_FUNC();
+    return ret;
+}
+
+void kill_module_process(ModuleProcess *process)
+{
+    kill(process->pid, SIGKILL);
+    while (waitpid(process->pid, NULL, 0) == -1 && errno == EINTR)
+        ;
+    close_pipes(process);
+    forget_process(process);
+}
+
+int execute_module_in_process(ProcessFunction func, ImageBatch *input, ModuleParameterList *config, ImageBatch *result)
+{
+    ModuleProcess process;
+    if (start_module_process(&process, func, input, config) != 0)
+        return -1;
+
+    // Parent process: Wait for the child process to finish
+    int status;
+    waitpid(process.pid, &status, 0);
+    return finish_module_process(&process, status, result);
+}
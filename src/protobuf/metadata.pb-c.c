@@ -187,7 +187,7 @@ const ProtobufCMessageDescriptor metadata_item__descriptor =
   (ProtobufCMessageInit) metadata_item__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor metadata__field_descriptors[9] =
+static const ProtobufCFieldDescriptor metadata__field_descriptors[11] =
 {
   {
     "size",
@@ -297,14 +297,40 @@ static const ProtobufCFieldDescriptor metadata__field_descriptors[9] =
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "codec",
+    10,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_INT32,
+    0,   /* quantifier_offset */
+    offsetof(Metadata, codec),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "original_size",
+    11,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_INT32,
+    0,   /* quantifier_offset */
+    offsetof(Metadata, original_size),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned metadata__field_indices_by_name[] = {
   5,   /* field[5] = bits_pixel */
   7,   /* field[7] = camera */
   3,   /* field[3] = channels */
+  9,   /* field[9] = codec */
   1,   /* field[1] = height */
   8,   /* field[8] = items */
   6,   /* field[6] = obid */
+  10,   /* field[10] = original_size */
   0,   /* field[0] = size */
   4,   /* field[4] = timestamp */
   2,   /* field[2] = width */
@@ -312,7 +338,7 @@ static const unsigned metadata__field_indices_by_name[] = {
 static const ProtobufCIntRange metadata__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 9 }
+  { 0, 11 }
 };
 const ProtobufCMessageDescriptor metadata__descriptor =
 {
@@ -322,7 +348,7 @@ const ProtobufCMessageDescriptor metadata__descriptor =
   "Metadata",
   "",
   sizeof(Metadata),
-  9,
+  11,
   metadata__field_descriptors,
   metadata__field_indices_by_name,
   1,  metadata__number_ranges,
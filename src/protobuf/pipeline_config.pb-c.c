@@ -174,7 +174,7 @@ const ProtobufCMessageDescriptor implementation__descriptor =
         (ProtobufCMessageInit)implementation__init,
         NULL, NULL, NULL /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor module_definition__field_descriptors[2] =
+static const ProtobufCFieldDescriptor module_definition__field_descriptors[3] =
     {
         {
             "name",
@@ -200,15 +200,28 @@ static const ProtobufCFieldDescriptor module_definition__field_descriptors[2] =
             0,            /* flags */
             0, NULL, NULL /* reserved1,reserved2, etc */
         },
+        {
+            "depends_on",
+            3,
+            PROTOBUF_C_LABEL_REPEATED,
+            PROTOBUF_C_TYPE_INT32,
+            offsetof(ModuleDefinition, n_depends_on),
+            offsetof(ModuleDefinition, depends_on),
+            NULL,
+            NULL,
+            0 | PROTOBUF_C_FIELD_FLAG_PACKED, /* flags */
+            0, NULL, NULL                     /* reserved1,reserved2, etc */
+        },
 };
 static const unsigned module_definition__field_indices_by_name[] = {
+    2, /* field[2] = depends_on */
     1, /* field[1] = implementations */
     0, /* field[0] = name */
 };
 static const ProtobufCIntRange module_definition__number_ranges[1 + 1] =
     {
         {1, 0},
-        {0, 2}};
+        {0, 3}};
 const ProtobufCMessageDescriptor module_definition__descriptor =
     {
         PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
@@ -217,7 +230,7 @@ const ProtobufCMessageDescriptor module_definition__descriptor =
         "ModuleDefinition",
         "",
         sizeof(ModuleDefinition),
-        2,
+        3,
         module_definition__field_descriptors,
         module_definition__field_indices_by_name,
         1, module_definition__number_ranges,
@@ -0,0 +1,87 @@
+#include "scheduler.h"
+#include "utils/minitrace.h"
+
+// Deficit round robin across pipelines. Each turn tops a pipeline's deficit up by its
+// weight and every batch taken costs one, so under contention pipelines get batches in
+// proportion to their weights, whatever their deadlines. Within a pipeline, batches
+// still leave in deadline order, started ones first. Partially processed batches that
+// waited past the aging limit jump the round, so no started batch starves.
+static int32_t deficit[MAX_PIPELINE_ID];
+static int current_pipeline = 0; // index into deficit, pipeline_id - 1
+
+static int match_pipeline(const ImageBatch *item, void *ctx)
+{
+    return item->pipeline_id == *(int *)ctx;
+}
+
+static int match_aged(const ImageBatch *item, void *ctx)
+{
+    return scheduler_wait_ms(item) >= *(int64_t *)ctx;
+}
+
+static int taken(ImageBatch *out)
+{
+    scheduler_record_wait(out);
+    return 1;
+}
+
+static int next_batch_fair_share(PriorityQueue *partial_pq, PriorityQueue *ingest_pq, size_t partial_limit, ImageBatch *out)
+{
+    MTR_BEGIN_FUNC();
+    if (pq_impl->get_queue_size(partial_pq) == 0 && pq_impl->get_queue_size(ingest_pq) == 0)
+    {
+        MTR_END_FUNC();
+        return 0;
+    }
+
+    int64_t aging_ms = scheduler_partial_aging_ms();
+    if (pq_impl->dequeue_match(partial_pq, match_aged, &aging_ms, out))
+    {
+        MTR_INSTANT_I(__FILE__, "aged_partial_batch", "pipeline_id", out->pipeline_id);
+        MTR_END_FUNC();
+        return taken(out);
+    }
+
+    // the round covers every configured pipeline, including the ones of the config index
+    int round = num_pipelines > MAX_PIPELINES ? (int)num_pipelines : MAX_PIPELINES;
+    if (current_pipeline >= round)
+        current_pipeline = 0;
+
+    // two laps: one to spend deficits left from the previous call, one after topping up
+    for (int visits = 0; visits < 2 * round; visits++)
+    {
+        int pipeline_id = current_pipeline + 1;
+        if (deficit[current_pipeline] >= 1)
+        {
+            // new work is only started while the partial queue has room
+            if (pq_impl->dequeue_match(partial_pq, match_pipeline, &pipeline_id, out) ||
+                (pq_impl->get_queue_size(partial_pq) < partial_limit &&
+                 pq_impl->dequeue_match(ingest_pq, match_pipeline, &pipeline_id, out)))
+            {
+                deficit[current_pipeline]--;
+                MTR_END_FUNC();
+                return taken(out);
+            }
+
+            // an idle pipeline does not bank credit
+            deficit[current_pipeline] = 0;
+        }
+
+        current_pipeline = (current_pipeline + 1) % round;
+        deficit[current_pipeline] += scheduler_pipeline_weight(current_pipeline + 1);
+    }
+
+    // batches for unknown pipelines, or new work held back by a full partial queue with nothing else to run
+    if (pq_impl->dequeue_into(partial_pq, out) || pq_impl->dequeue_into(ingest_pq, out))
+    {
+        MTR_END_FUNC();
+        return taken(out);
+    }
+
+    MTR_END_FUNC();
+    return 0;
+}
+
+SchedulingPolicy fair_share_policy = {
+    .next_batch = next_batch_fair_share,
+};
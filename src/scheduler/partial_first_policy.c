@@ -0,0 +1,37 @@
+#include "scheduler.h"
+#include "utils/minitrace.h"
+
+// Whether the previous pick may be followed by starting a new batch
+static int start_new_batch = 0;
+
+static int take_head(PriorityQueue *pq, ImageBatch *out)
+{
+    if (!pq_impl->dequeue_into(pq, out))
+        return 0;
+
+    scheduler_record_wait(out);
+    return 1;
+}
+
+// Original DIPP order: the partially processed queue first (or ingest if it is empty),
+// then one new batch from ingest if the partial queue is below its limit
+static int next_batch_partial_first(PriorityQueue *partial_pq, PriorityQueue *ingest_pq, size_t partial_limit, ImageBatch *out)
+{
+    if (start_new_batch)
+    {
+        start_new_batch = 0;
+        if (pq_impl->get_queue_size(partial_pq) < partial_limit && take_head(ingest_pq, out))
+            return 1;
+    }
+
+    if (take_head(partial_pq, out) || take_head(ingest_pq, out))
+    {
+        start_new_batch = 1;
+        return 1;
+    }
+    return 0;
+}
+
+SchedulingPolicy partial_first_policy = {
+    .next_batch = next_batch_partial_first,
+};
@@ -0,0 +1,44 @@
+#include <time.h>
+#include "scheduler.h"
+#include "dipp_scheduler_param.h"
+#include "utils/minitrace.h"
+
+uint32_t scheduler_pipeline_weight(int pipeline_id)
+{
+    if (pipeline_id < 1 || pipeline_id > MAX_PIPELINE_ID)
+        return DEFAULT_PIPELINE_WEIGHT;
+    uint8_t weight = param_get_uint8_array(&pipeline_weights, pipeline_id - 1);
+    return weight ? weight : DEFAULT_PIPELINE_WEIGHT;
+}
+
+uint32_t scheduler_partial_aging_ms()
+{
+    uint32_t aging_ms = param_get_uint32(&partial_aging_ms);
+    return aging_ms ? aging_ms : DEFAULT_PARTIAL_AGING_MS;
+}
+
+int64_t scheduler_wait_ms(const ImageBatch *batch)
+{
+    if (batch->enqueued_ms == 0)
+        return 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t wait_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000 - batch->enqueued_ms;
+    return wait_ms > 0 ? wait_ms : 0; // the clock may have been stepped back
+}
+
+void scheduler_record_wait(const ImageBatch *batch)
+{
+    int64_t wait_ms = scheduler_wait_ms(batch);
+    MTR_COUNTER(__FILE__, "batch_wait_ms", (int)wait_ms);
+
+    if (batch->pipeline_id < 1 || batch->pipeline_id > MAX_PIPELINE_ID)
+        return;
+
+    int bucket = 0;
+    while (bucket < SCHED_HIST_BUCKETS - 1 && wait_ms >= (1LL << bucket))
+        bucket++;
+
+    __atomic_add_fetch(&_sched_wait_hist[(batch->pipeline_id - 1) * SCHED_HIST_BUCKETS + bucket], 1, __ATOMIC_RELAXED);
+}
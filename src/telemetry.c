@@ -7,6 +7,12 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "battery_simulator.h"
+#include "dipp_telemetry_param.h"
+#include "utils/minitrace.h"
 
 // Static storage for remote energy reading
 static uint8_t _measurement_flag = 0;
@@ -74,36 +80,121 @@ int start_energy_measurement()
 
 float get_energy_reading()
 {
+    if (param_pull_single(&remote_energy, -1, CSP_PRIO_NORM, 1, ENERGY_NODE_ADDR, ENERGY_PULL_TIMEOUT_MS, 2) != 0)
+        return -1.0f;
+    return _remote_energy;
+}
+
+// Readings are published under a seqlock: write_seq is odd while the poller rewrites
+// published, and a reader retries if it saw an odd value or the value changed while it
+// was copying. The snapshot is small and written once per poll, so retries are rare.
+static TelemetrySnapshot published;
+static uint32_t write_seq = 0;
+
+static uint32_t enabled_sources = 0;
+static pthread_mutex_t telemetry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t telemetry_handle;
+static int telemetry_running = 0;
+
+static int64_t monotonic_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint32_t poll_interval_ms()
+{
+    uint32_t interval_ms = param_get_uint32(&telemetry_poll_interval_ms);
+    return interval_ms ? interval_ms : DEFAULT_TELEMETRY_POLL_INTERVAL_MS;
+}
+
+static void *telemetry_task(void *param)
+{
+    (void)param;
+    TelemetrySnapshot latest;
+    memset(&latest, 0, sizeof(latest));
+
+    while (1)
+    {
+        uint32_t sources = __atomic_load_n(&enabled_sources, __ATOMIC_RELAXED);
+
+        // a failed poll keeps the previous reading, which then ages
+        if (sources & TELEMETRY_SOURCE_ENERGY)
+        {
+            float energy = get_energy_reading();
+            if (energy >= 0.0f)
+            {
+                latest.energy_uwh = energy;
+                latest.energy_time_us = monotonic_us();
+                latest.energy_valid = 1;
+            }
+        }
+        if (sources & TELEMETRY_SOURCE_BATTERY)
+        {
+            latest.battery_level_wh = get_battery_level_wh();
+            latest.battery_time_us = monotonic_us();
+            latest.battery_valid = 1;
+        }
+
+        uint32_t seq = __atomic_load_n(&write_seq, __ATOMIC_RELAXED);
+        latest.sequence = seq / 2 + 1;
+        __atomic_store_n(&write_seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        published = latest;
+        __atomic_store_n(&write_seq, seq + 2, __ATOMIC_RELEASE);
+        MTR_COUNTER(__FILE__, "telemetry_sequence", latest.sequence);
+
+        usleep(poll_interval_ms() * 1000);
+    }
+    return NULL;
+}
+
+int telemetry_enable(uint32_t sources)
+{
+    pthread_mutex_lock(&telemetry_lock);
+    __atomic_or_fetch(&enabled_sources, sources, __ATOMIC_RELAXED);
+    int res = 0;
+    if (!telemetry_running)
+    {
+        if (pthread_create(&telemetry_handle, NULL, &telemetry_task, NULL) == 0)
+        {
+            pthread_detach(telemetry_handle);
+            telemetry_running = 1;
+        }
+        else
+        {
+            printf("Failed to start telemetry thread\n");
+            res = -1;
+        }
+    }
+    pthread_mutex_unlock(&telemetry_lock);
+    return res;
+}
 
-    // float old_energy = _remote_energy;
-
-    // uint8_t temp_val = 0;
-
-    // if (param_push_single(&measurement_flag, -1, &temp_val, 1, ENERGY_NODE_ADDR, 500, 2, 1) != 0)
-    // {
-    //     fprintf(stderr, "Failed to push start measurement flag\n");
-    //     // return -1.0f; // Indicate failure
-    // }
-
-    // trigger_energy_measurement(0); // Reset measurement flag
-
-    // // wait till new reading is available
-    // int max_retries = 10;
-    // int retries = 0;
-    // while (retries < max_retries)
-    // {
-    //     if (param_pull_single(&remote_energy, -1, CSP_PRIO_NORM, 1, ENERGY_NODE_ADDR, 5000, 2) != 0)
-    //     {
-    //         fprintf(stderr, "Failed to pull energy reading\n");
-    //         // return -1.0f; // Return 0 if the pull fails
-    //     }
-    //     if (_remote_energy != old_energy)
-    //     {
-    //         break; // New reading available
-    //     }
-    //     retries++;
-    // }
-    // return _remote_energy;
-
-    return rand() % 1000 / 10.0f; // Return a mock energy reading between 0.0 and 99.9
-}
\ No newline at end of file
+void telemetry_snapshot(TelemetrySnapshot *snapshot)
+{
+    uint32_t seq;
+    do
+    {
+        seq = __atomic_load_n(&write_seq, __ATOMIC_ACQUIRE);
+        *snapshot = published;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&write_seq, __ATOMIC_RELAXED) != seq);
+
+    int64_t now = monotonic_us();
+    snapshot->energy_age_us = snapshot->energy_valid ? now - snapshot->energy_time_us : -1;
+    snapshot->battery_age_us = snapshot->battery_valid ? now - snapshot->battery_time_us : -1;
+}
+
+float telemetry_battery_level_wh()
+{
+    TelemetrySnapshot snapshot;
+    telemetry_snapshot(&snapshot);
+    int64_t stale_after_us = (int64_t)poll_interval_ms() * 1000 * TELEMETRY_STALE_POLLS;
+    if (snapshot.battery_valid && snapshot.battery_age_us <= stale_after_us)
+        return snapshot.battery_level_wh;
+
+    MTR_INSTANT_I(__FILE__, "stale battery reading", "age_us", (int)snapshot.battery_age_us);
+    return get_battery_level_wh();
+}
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "downlink_codec.h"
+#include "metadata.pb-c.h"
+
+// Downlink compression benchmark: compresses the images of product files the way the
+// upload does and reports the compression ratio and throughput per level, so a codec and
+// level can be chosen per pipeline (downlink_codec, downlink_level). Product files hold
+// observations as uploaded ([uint32 metadata size][Metadata][image]...); with -R every
+// file is taken as one raw image instead, e.g. a Bayer frame straight off the camera.
+
+#define DEFAULT_BENCH_RUNS 3
+#define MAX_BENCH_IMAGES 256
+
+static const int default_levels[] = {1, 3, 5, 7, 9, 11};
+
+typedef struct ProductImages
+{
+    unsigned char *data;
+    size_t size;
+    size_t num_images;
+    size_t offsets[MAX_BENCH_IMAGES]; // of the image bytes in data
+    size_t sizes[MAX_BENCH_IMAGES];
+} ProductImages;
+
+static double elapsed_s(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static unsigned char *read_file(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char *data = length > 0 ? malloc(length) : NULL;
+    if (data != NULL && fread(data, 1, length, file) != (size_t)length)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = data ? (size_t)length : 0;
+    return data;
+}
+
+// Locate the images of a product file; returns 0 on success
+static int load_product(const char *path, int raw, ProductImages *product)
+{
+    memset(product, 0, sizeof(*product));
+    product->data = read_file(path, &product->size);
+    if (product->data == NULL)
+    {
+        printf("Could not read %s\n", path);
+        return -1;
+    }
+
+    if (raw)
+    {
+        product->offsets[0] = 0;
+        product->sizes[0] = product->size;
+        product->num_images = 1;
+        return 0;
+    }
+
+    size_t offset = 0;
+    while (offset < product->size && product->num_images < MAX_BENCH_IMAGES)
+    {
+        uint32_t meta_size;
+        if (product->size - offset < sizeof(meta_size))
+            break;
+        memcpy(&meta_size, product->data + offset, sizeof(meta_size));
+        offset += sizeof(meta_size);
+        if (meta_size > product->size - offset)
+            break;
+
+        Metadata *meta = metadata__unpack(NULL, meta_size, product->data + offset);
+        if (meta == NULL)
+            break;
+        uint32_t image_size = meta->size;
+        int codec = meta->codec;
+        metadata__free_unpacked(meta, NULL);
+        offset += meta_size;
+        if (image_size > product->size - offset)
+            break;
+        if (codec != DOWNLINK_CODEC_NONE)
+        {
+            printf("%s is already compressed (%s)\n", path, downlink_codec_name(codec));
+            return -1;
+        }
+
+        product->offsets[product->num_images] = offset;
+        product->sizes[product->num_images] = image_size;
+        product->num_images++;
+        offset += image_size;
+    }
+
+    if (product->num_images == 0 || offset != product->size)
+    {
+        printf("%s is not a product file of at most %d images, use -R for raw images\n", path, MAX_BENCH_IMAGES);
+        return -1;
+    }
+    return 0;
+}
+
+// Compress every image of the product at one level and print a result line
+static void bench_level(const char *path, const ProductImages *product, DownlinkCodec codec, int level, int runs)
+{
+    size_t largest = 0;
+    for (size_t i = 0; i < product->num_images; i++)
+    {
+        if (product->sizes[i] > largest)
+            largest = product->sizes[i];
+    }
+    size_t output_size = downlink_max_compressed_size(codec, largest);
+    uint8_t *output = malloc(output_size);
+    if (output == NULL)
+    {
+        printf("Could not allocate %zu bytes\n", output_size);
+        return;
+    }
+
+    size_t original = 0;
+    size_t stored = 0;
+    double total_s = 0.0;
+    for (int run = 0; run < runs; run++)
+    {
+        for (size_t i = 0; i < product->num_images; i++)
+        {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            size_t compressed = downlink_compress(codec, level, product->data + product->offsets[i], product->sizes[i], output, output_size);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            total_s += elapsed_s(&start, &end);
+
+            if (run == 0)
+            {
+                original += product->sizes[i];
+                // images that do not shrink are stored as produced, as the upload does
+                stored += compressed ? compressed : product->sizes[i];
+            }
+        }
+    }
+    free(output);
+
+    double ratio = stored ? (double)original / stored : 0.0;
+    double mb_per_s = total_s > 0.0 ? (double)original * runs / total_s / 1e6 : 0.0;
+    printf("%-32s %-7s %5d %6zu %12zu %12zu %7.3f %9.2f\n", path, downlink_codec_name(codec), level,
+           product->num_images, original, stored, ratio, mb_per_s);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-c <codec>] [-l <level>] [-r <runs>] [-R] <product_file>...\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    DownlinkCodec codec = DOWNLINK_CODEC_BROTLI;
+    int level = 0;
+    int runs = DEFAULT_BENCH_RUNS;
+    int raw = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:l:r:R")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            codec = (DownlinkCodec)atoi(optarg);
+            break;
+        case 'l':
+            level = atoi(optarg);
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'R':
+            raw = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc || runs < 1 || codec <= DOWNLINK_CODEC_NONE || codec >= DOWNLINK_CODEC_COUNT ||
+        level < 0 || level > DOWNLINK_MAX_LEVEL)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%-32s %-7s %5s %6s %12s %12s %7s %9s\n", "file", "codec", "level", "images", "bytes", "stored", "ratio", "MB/s");
+    int benchmarked = 0;
+    for (int f = optind; f < argc; f++)
+    {
+        ProductImages product;
+        if (load_product(argv[f], raw, &product) != 0)
+        {
+            free(product.data);
+            continue;
+        }
+
+        if (level)
+        {
+            bench_level(argv[f], &product, codec, level, runs);
+        }
+        else
+        {
+            for (size_t l = 0; l < sizeof(default_levels) / sizeof(default_levels[0]); l++)
+                bench_level(argv[f], &product, codec, default_levels[l], runs);
+        }
+        free(product.data);
+        benchmarked++;
+    }
+    return benchmarked > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
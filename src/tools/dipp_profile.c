@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <vmem/vmem_file.h>
+#include "vmem_storage.h"
+#include "dipp_config.h"
+#include "image_batch.h"
+#include "cost_profile.h"
+#include "pipeline_config.pb-c.h"
+
+// Offline profiler: runs every configured effort level of every module over representative
+// batch files and writes a cost profile DIPP can import (COST_PROFILE or cost_profile_cmd).
+// Configurations are read from storage.vmem in the working directory, exactly as DIPP
+// loads them, so the cost seeds in the profile match the ones DIPP looks up.
+
+#define DEFAULT_PROFILE_RUNS 5
+#define DEFAULT_PROFILE_TIMEOUT_S 60
+
+static int error_pipe[2] = {-1, -1};
+static unsigned int timeout_s = DEFAULT_PROFILE_TIMEOUT_S;
+
+static void timeout_handler(int signum)
+{
+    (void)signum;
+    _exit(EXIT_FAILURE);
+}
+
+// Run the module in a child process like the executor does; returns the elapsed
+// microseconds, or -1 if the module failed, crashed or timed out
+static long run_module_once(ProcessFunction func, ImageBatch *input, ModuleParameterList *config, ImageBatch *result)
+{
+    int output_pipe[2];
+    if (pipe(output_pipe) == -1 || pipe(error_pipe) == -1)
+        return -1;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        signal(SIGALRM, timeout_handler);
+        alarm(timeout_s);
+        ImageBatch out = func(input, config, error_pipe);
+        alarm(0);
+        write(output_pipe[1], &out, sizeof(out));
+        exit(EXIT_SUCCESS);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    long elapsed_us = -1;
+    if (pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+        read(output_pipe[0], result, sizeof(*result)) == sizeof(*result))
+    {
+        elapsed_us = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000L;
+    }
+
+    close(output_pipe[0]);
+    close(output_pipe[1]);
+    close(error_pipe[0]);
+    close(error_pipe[1]);
+    return elapsed_us;
+}
+
+// Measure one effort level of a module on input; returns 0 and fills record and result on success
+static int profile_effort(Module *module, int param_id, ImageBatch *input, int runs, CostProfileRecord *record, ImageBatch *result)
+{
+    ModuleParameterList *config = &module_parameter_lists[param_id];
+
+    memset(record, 0, sizeof(*record));
+    record->seed = module_cost_seed(module, config);
+    record->fingerprint.num_images = input->num_images;
+    record->fingerprint.batch_size = input->batch_size;
+    record->fingerprint.pipeline_id = input->pipeline_id;
+    record->latency_min = UINT32_MAX;
+    // no energy sensor is sampled here, same estimate the executor stores
+    record->energy_mean = (float)config->energy_cost;
+
+    uint64_t total_us = 0;
+    for (int run = 0; run < runs; run++)
+    {
+        long elapsed_us = run_module_once(module->module_function, input, config, result);
+        if (elapsed_us < 0)
+        {
+            printf("  %s (param %d) failed on run %d\n", module->module_name, param_id + 1, run + 1);
+            return -1;
+        }
+        total_us += elapsed_us;
+        if ((uint32_t)elapsed_us < record->latency_min)
+            record->latency_min = elapsed_us;
+        if ((uint32_t)elapsed_us > record->latency_max)
+            record->latency_max = elapsed_us;
+        record->samples++;
+    }
+    record->latency_mean = total_us / record->samples;
+    return 0;
+}
+
+// Walk the pipeline on one batch file. Every effort level of a module is measured on the
+// same input; the output of the first one that ran feeds the next module.
+static int profile_pipeline(Pipeline *pipeline, const char *batch_file, int num_images, int runs, FILE *out)
+{
+    struct stat st;
+    if (stat(batch_file, &st) == -1)
+    {
+        printf("Could not stat batch file %s\n", batch_file);
+        return -1;
+    }
+
+    ImageBatch input;
+    memset(&input, 0, sizeof(input));
+    input.num_images = num_images;
+    input.batch_size = st.st_size;
+    input.pipeline_id = pipeline->pipeline_id;
+    input.shmid = -1;
+    input.progress = -1;
+    input.storage_mode = STORAGE_MMAP;
+    strncpy(input.filename, batch_file, sizeof(input.filename) - 1);
+    strncpy(input.uuid, "dipp-profile", sizeof(input.uuid) - 1);
+
+    int profiled = 0;
+    for (size_t i = 0; i < pipeline->num_modules; i++)
+    {
+        Module *module = &pipeline->modules[i];
+        if (module->module_function == NULL)
+        {
+            printf("Module %s is not loaded, stopping pipeline %d\n", module->module_name, pipeline->pipeline_id);
+            break;
+        }
+
+        int param_ids[] = {module->default_effort_param_id, module->low_effort_param_id,
+                           module->medium_effort_param_id, module->high_effort_param_id};
+        ImageBatch next;
+        int have_next = 0;
+        for (size_t e = 0; e < sizeof(param_ids) / sizeof(param_ids[0]); e++)
+        {
+            if (param_ids[e] < 0 || (size_t)param_ids[e] >= num_module_configs)
+                continue;
+
+            CostProfileRecord record;
+            ImageBatch result;
+            if (profile_effort(module, param_ids[e], &input, runs, &record, &result) != 0)
+                continue;
+
+            printf("  %s (param %d): %u us mean over %u runs\n", module->module_name, param_ids[e] + 1, record.latency_mean, record.samples);
+            cost_profile_write_record(out, &record);
+            profiled++;
+            if (!have_next)
+            {
+                next = result;
+                have_next = 1;
+            }
+        }
+
+        if (!have_next)
+            break;
+        input = next;
+    }
+    return profiled;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-o <profile>] [-p <pipeline_id>] [-n <num_images>] [-r <runs>] [-T <timeout_s>] <batch_file>...\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *output = "cost_profile.txt";
+    int pipeline_filter = 0;
+    int num_images = 1;
+    int runs = DEFAULT_PROFILE_RUNS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:p:n:r:T:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            output = optarg;
+            break;
+        case 'p':
+            pipeline_filter = atoi(optarg);
+            break;
+        case 'n':
+            num_images = atoi(optarg);
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'T':
+            timeout_s = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc || runs < 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    vmem_file_init(&vmem_storage);
+    vmem_file_init(&vmem_configs);
+    setup_cache_if_needed();
+
+    FILE *out = fopen(output, "w");
+    if (out == NULL)
+    {
+        printf("Could not create %s\n", output);
+        return EXIT_FAILURE;
+    }
+    cost_profile_write_header(out);
+
+    int profiled = 0;
+    for (size_t p = 0; p < num_pipelines; p++)
+    {
+        Pipeline *pipeline = &pipelines[p];
+        if (pipeline->pipeline_id == 0 || pipeline->num_modules == 0)
+            continue;
+        if (pipeline_filter && pipeline->pipeline_id != pipeline_filter)
+            continue;
+
+        for (int f = optind; f < argc; f++)
+        {
+            printf("Profiling pipeline %d on %s\n", pipeline->pipeline_id, argv[f]);
+            int res = profile_pipeline(pipeline, argv[f], num_images, runs, out);
+            if (res > 0)
+                profiled += res;
+        }
+    }
+
+    fclose(out);
+    printf("Wrote %d profile records to %s\n", profiled, output);
+    return profiled > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
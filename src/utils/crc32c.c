@@ -0,0 +1,170 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_HW_X86 1
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC32C_HW_ARM 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78 // reflected Castagnoli polynomial
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t *buf, size_t len);
+
+static uint32_t crc32c_table[8][256];
+static crc32c_fn crc32c_impl = NULL;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+// Software fallback: slicing-by-8 over a table built on first use
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    while (len && ((uintptr_t)buf & 7))
+    {
+        crc = crc32c_table[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, buf, sizeof(word));
+        word ^= crc;
+        crc = crc32c_table[7][word & 0xFF] ^
+              crc32c_table[6][(word >> 8) & 0xFF] ^
+              crc32c_table[5][(word >> 16) & 0xFF] ^
+              crc32c_table[4][(word >> 24) & 0xFF] ^
+              crc32c_table[3][(word >> 32) & 0xFF] ^
+              crc32c_table[2][(word >> 40) & 0xFF] ^
+              crc32c_table[1][(word >> 48) & 0xFF] ^
+              crc32c_table[0][word >> 56];
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len--)
+    {
+        crc = crc32c_table[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(CRC32C_HW_X86)
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    while (len && ((uintptr_t)buf & 7))
+    {
+        crc = _mm_crc32_u8(crc, *buf++);
+        len--;
+    }
+
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, buf, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        buf += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+
+    while (len >= 4)
+    {
+        uint32_t word;
+        memcpy(&word, buf, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+        buf += 4;
+        len -= 4;
+    }
+
+    while (len--)
+    {
+        crc = _mm_crc32_u8(crc, *buf++);
+    }
+
+    return crc;
+}
+
+static int crc32c_hw_available()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(CRC32C_HW_ARM)
+__attribute__((target("+crc"))) static uint32_t crc32c_hw(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    while (len && ((uintptr_t)buf & 7))
+    {
+        crc = __crc32cb(crc, *buf++);
+        len--;
+    }
+
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, buf, sizeof(word));
+        crc = __crc32cd(crc, word);
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len--)
+    {
+        crc = __crc32cb(crc, *buf++);
+    }
+
+    return crc;
+}
+
+static int crc32c_hw_available()
+{
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#endif
+
+// Build the slicing tables and pick the fastest implementation for this CPU
+static void crc32c_init()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][i] = crc;
+    }
+
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        for (int slice = 1; slice < 8; slice++)
+        {
+            uint32_t prev = crc32c_table[slice - 1][i];
+            crc32c_table[slice][i] = crc32c_table[0][prev & 0xFF] ^ (prev >> 8);
+        }
+    }
+
+    crc32c_impl = crc32c_sw;
+#if defined(CRC32C_HW_X86) || defined(CRC32C_HW_ARM)
+    if (crc32c_hw_available())
+    {
+        crc32c_impl = crc32c_hw;
+    }
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return ~crc32c_impl(~crc, (const uint8_t *)data, len);
+}
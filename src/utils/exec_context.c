@@ -0,0 +1,106 @@
+#define _GNU_SOURCE // sched_getcpu
+#include "utils/exec_context.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+static ExecutionContext cached_context;
+static int64_t cached_at_ms = -1;
+
+// Read a small sysfs/procfs file into buf; returns 0 on success
+static int read_small_file(const char *path, char *buf, size_t size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    ssize_t len = read(fd, buf, size - 1);
+    close(fd);
+    if (len <= 0)
+        return -1;
+    buf[len] = '\0';
+    return 0;
+}
+
+static uint32_t read_cpu_freq_khz()
+{
+    int cpu = sched_getcpu();
+    char path[96];
+    char buf[32];
+    snprintf(path, sizeof(path), EXEC_CONTEXT_FREQ_FILE, cpu < 0 ? 0 : cpu);
+    if (read_small_file(path, buf, sizeof(buf)) != 0)
+        return 0;
+    return (uint32_t)strtoul(buf, NULL, 10);
+}
+
+// /proc/loadavg: "<1min> <5min> <15min> <runnable>/<total> <last_pid>"
+static uint16_t read_runnable()
+{
+    char buf[128];
+    unsigned int runnable = 0;
+    unsigned int total = 0;
+    if (read_small_file(EXEC_CONTEXT_LOAD_FILE, buf, sizeof(buf)) != 0 ||
+        sscanf(buf, "%*f %*f %*f %u/%u", &runnable, &total) != 2)
+        return 0;
+    return runnable > UINT16_MAX ? UINT16_MAX : runnable;
+}
+
+static int16_t read_temp_decic()
+{
+    char buf[32];
+    if (read_small_file(EXEC_CONTEXT_THERMAL_FILE, buf, sizeof(buf)) != 0)
+        return EXEC_CONTEXT_TEMP_UNKNOWN;
+    long millic = strtol(buf, NULL, 10); // millidegrees C
+    return (int16_t)(millic / 100);
+}
+
+void exec_context_read(ExecutionContext *ctx)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    int64_t now_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    if (cached_at_ms < 0 || now_ms - cached_at_ms >= EXEC_CONTEXT_REFRESH_MS)
+    {
+        cached_context.cpu_freq_khz = read_cpu_freq_khz();
+        cached_context.runnable = read_runnable();
+        cached_context.temp_decic = read_temp_decic();
+        cached_at_ms = now_ms;
+    }
+    *ctx = cached_context;
+}
+
+// Tasks competing for each CPU, at least 1
+static float contention(uint16_t runnable)
+{
+    static long online_cpus = 0;
+    if (online_cpus <= 0)
+    {
+        online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (online_cpus <= 0)
+            online_cpus = 1;
+    }
+    float per_cpu = (float)runnable / (float)online_cpus;
+    return per_cpu > 1.0f ? per_cpu : 1.0f;
+}
+
+uint32_t exec_context_scale_latency(uint32_t latency, const ExecutionContext *measured, const ExecutionContext *current)
+{
+    float scale = 1.0f;
+    if (measured->cpu_freq_khz && current->cpu_freq_khz)
+        scale *= (float)measured->cpu_freq_khz / (float)current->cpu_freq_khz;
+    if (measured->runnable && current->runnable)
+        scale *= contention(current->runnable) / contention(measured->runnable);
+
+    if (scale > EXEC_CONTEXT_MAX_SCALE)
+        scale = EXEC_CONTEXT_MAX_SCALE;
+    else if (scale < 1.0f / EXEC_CONTEXT_MAX_SCALE)
+        scale = 1.0f / EXEC_CONTEXT_MAX_SCALE;
+
+    float scaled = (float)latency * scale;
+    return scaled >= (float)UINT32_MAX ? UINT32_MAX : (uint32_t)scaled;
+}
@@ -52,15 +52,3 @@ uint32_t murmur3_32(const uint8_t *key, size_t len, uint32_t seed)
 
     return h;
 }
-
-uint32_t murmur3_batch_fingerprint(ImageBatch *batch, uint32_t config_hash)
-{
-    ImageBatchFingerprint fingerprint;
-    fingerprint.num_images = batch->num_images;
-    fingerprint.batch_size = batch->batch_size;
-    fingerprint.pipeline_id = batch->pipeline_id;
-
-    uint32_t hash = murmur3_32((const uint8_t *)&fingerprint, sizeof(fingerprint), config_hash);
-
-    return hash;
-}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#include <brotli/encode.h>
+#include "downlink_codec.h"
+#include "utils/minitrace.h"
+
+static const char *codec_names[DOWNLINK_CODEC_COUNT] = {"none", "brotli"};
+
+const char *downlink_codec_name(int codec)
+{
+    if (codec < 0 || codec >= DOWNLINK_CODEC_COUNT)
+        return "unknown";
+    return codec_names[codec];
+}
+
+size_t downlink_max_compressed_size(DownlinkCodec codec, size_t len)
+{
+    switch (codec)
+    {
+    case DOWNLINK_CODEC_BROTLI:
+        return BrotliEncoderMaxCompressedSize(len);
+    default:
+        return len;
+    }
+}
+
+size_t downlink_compress(DownlinkCodec codec, int level, const uint8_t *input, size_t len, uint8_t *output, size_t output_size)
+{
+    if (level <= 0 || level > DOWNLINK_MAX_LEVEL)
+        level = DOWNLINK_DEFAULT_LEVEL;
+
+    size_t compressed = 0;
+    switch (codec)
+    {
+    case DOWNLINK_CODEC_BROTLI:
+    {
+        MTR_BEGIN_FUNC();
+        size_t encoded_size = output_size;
+        // images carry no text, the generic mode and default window suit Bayer and encoded data alike
+        if (BrotliEncoderCompress(level, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, len, input, &encoded_size, output) == BROTLI_TRUE)
+            compressed = encoded_size;
+        MTR_END_FUNC();
+        break;
+    }
+    default:
+        break;
+    }
+    return compressed < len ? compressed : 0;
+}
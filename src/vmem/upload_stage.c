@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "upload_stage.h"
+#include "image_store.h"
+#include "dipp_process.h"
+#include "vmem_upload_local.h"
+#include "utils/minitrace.h"
+
+// Upload of completed products on a thread of its own, so the processing thread starts
+// the next batch while the previous one is still written to the image ring. Products
+// wait in a bounded FIFO; when it is full the scheduler holds back new batches.
+typedef struct UploadJob
+{
+    ImageBatch product;
+    struct timespec submitted;
+} UploadJob;
+
+static UploadJob jobs[UPLOAD_QUEUE_CAPACITY];
+static size_t jobs_head = 0; // oldest job
+static size_t jobs_count = 0;
+
+static pthread_mutex_t upload_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_available = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t space_available = PTHREAD_COND_INITIALIZER;
+static pthread_t upload_handle;
+static int upload_running = 0;
+static pid_t exit_hook_pid;
+
+static long elapsed_us(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000000L + (now.tv_nsec - since->tv_nsec) / 1000L;
+}
+
+static void upload_product(ImageBatch *product)
+{
+    MTR_BEGIN_FUNC_S("batch_uuid", product->uuid);
+    if (image_batch_read_data(product) != SUCCESS || product->data == NULL)
+    {
+        printf("Error reading image data\n");
+        MTR_END_FUNC();
+        return;
+    }
+
+    upload(product->data, product->num_images, product->batch_size, product->pipeline_id);
+
+    image_batch_cleanup(product);
+    MTR_END_FUNC();
+}
+
+static void *upload_task(void *param)
+{
+    (void)param;
+    pthread_mutex_lock(&upload_lock);
+    while (1)
+    {
+        while (upload_running && jobs_count == 0)
+            pthread_cond_wait(&jobs_available, &upload_lock);
+        // a stop still uploads what was queued before it
+        if (jobs_count == 0)
+            break;
+
+        UploadJob job = jobs[jobs_head];
+        jobs_head = (jobs_head + 1) % UPLOAD_QUEUE_CAPACITY;
+        jobs_count--;
+        MTR_COUNTER(__FILE__, "upload_queue_depth", (int)jobs_count);
+        pthread_cond_broadcast(&space_available);
+        pthread_mutex_unlock(&upload_lock);
+
+        upload_product(&job.product);
+        // from completion of the pipeline, so time spent queued counts as well
+        MTR_COUNTER(__FILE__, "upload_latency_us", (int)elapsed_us(&job.submitted));
+
+        pthread_mutex_lock(&upload_lock);
+    }
+    pthread_mutex_unlock(&upload_lock);
+    return NULL;
+}
+
+// a forked child has no upload thread and maybe a copy of upload_lock taken by it
+static void stop_at_exit()
+{
+    if (getpid() == exit_hook_pid)
+        upload_stage_stop();
+}
+
+int upload_stage_start()
+{
+    pthread_mutex_lock(&upload_lock);
+    if (upload_running)
+    {
+        pthread_mutex_unlock(&upload_lock);
+        return 0;
+    }
+    upload_running = 1;
+    if (pthread_create(&upload_handle, NULL, &upload_task, NULL) != 0)
+    {
+        printf("Failed to start upload thread, uploading inline\n");
+        upload_running = 0;
+        pthread_mutex_unlock(&upload_lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&upload_lock);
+
+    // exit() is the clean shutdown path (e.g. the SIGINT handler), finish queued uploads
+    static int exit_hook_registered = 0;
+    if (!exit_hook_registered)
+    {
+        exit_hook_pid = getpid();
+        atexit(stop_at_exit);
+        exit_hook_registered = 1;
+    }
+    return 0;
+}
+
+void upload_stage_submit(const ImageBatch *product)
+{
+    UploadJob job;
+    job.product = *product;
+    clock_gettime(CLOCK_MONOTONIC, &job.submitted);
+
+    pthread_mutex_lock(&upload_lock);
+    while (upload_running && jobs_count == UPLOAD_QUEUE_CAPACITY)
+        pthread_cond_wait(&space_available, &upload_lock);
+    if (!upload_running)
+    {
+        pthread_mutex_unlock(&upload_lock);
+        upload_product(&job.product);
+        MTR_COUNTER(__FILE__, "upload_latency_us", (int)elapsed_us(&job.submitted));
+        return;
+    }
+
+    jobs[(jobs_head + jobs_count) % UPLOAD_QUEUE_CAPACITY] = job;
+    jobs_count++;
+    MTR_COUNTER(__FILE__, "upload_queue_depth", (int)jobs_count);
+    pthread_cond_signal(&jobs_available);
+    pthread_mutex_unlock(&upload_lock);
+}
+
+int upload_stage_full()
+{
+    pthread_mutex_lock(&upload_lock);
+    int full = upload_running && jobs_count == UPLOAD_QUEUE_CAPACITY;
+    pthread_mutex_unlock(&upload_lock);
+    return full;
+}
+
+void upload_stage_wait_space(long timeout_us)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_us / 1000000L;
+    deadline.tv_nsec += (timeout_us % 1000000L) * 1000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&upload_lock);
+    if (upload_running && jobs_count == UPLOAD_QUEUE_CAPACITY)
+        pthread_cond_timedwait(&space_available, &upload_lock, &deadline);
+    pthread_mutex_unlock(&upload_lock);
+}
+
+void upload_stage_stop()
+{
+    pthread_mutex_lock(&upload_lock);
+    int running = upload_running;
+    upload_running = 0;
+    pthread_cond_broadcast(&jobs_available);
+    pthread_cond_broadcast(&space_available);
+    pthread_mutex_unlock(&upload_lock);
+
+    if (running)
+        pthread_join(upload_handle, NULL);
+}
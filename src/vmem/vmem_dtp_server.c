@@ -13,8 +13,10 @@
 typedef struct observation_meta
 {
     uint16_t index;
-    uint32_t size;
+    uint32_t size; // of the image as stored in the ring, compressed if codec is set
     uint32_t obid;
+    uint32_t codec; // appended, so clients reading only the fields above keep working
+    uint32_t original_size;
 } observation_meta_t;
 
 // Read the observation at specified index within ring buffer
@@ -65,7 +67,8 @@ static Metadata *observation_get_metadata(uint16_t index)
     return metadata;
 }
 
-// Get metadata for a specific observation which is to be transferred, in this case only OBID, size and index
+// Get metadata for a specific observation which is to be transferred: index, OBID, size and,
+// for observations compressed at upload, the codec and the size to decompress to
 observation_meta_t observation_get_dtp_meta(uint16_t index)
 {
     Metadata *meta = observation_get_metadata(index);
@@ -74,6 +77,8 @@ observation_meta_t observation_get_dtp_meta(uint16_t index)
         .index = index,
         .size = meta->size,
         .obid = meta->obid,
+        .codec = meta->codec,
+        .original_size = meta->codec ? meta->original_size : meta->size,
     };
 
     metadata__free_unpacked(meta, NULL);
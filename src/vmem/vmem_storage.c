@@ -1,4 +1,8 @@
 #include <vmem/vmem_file.h>
+#include "vmem_storage.h"
 
 /* Define file to store persistent params */
 VMEM_DEFINE_FILE(storage, "storage", "storage.vmem", 10000);
+
+/* Define file to store configs that do not fit in their param */
+VMEM_DEFINE_FILE(configs, "configs", "configs.vmem", CONFIG_BLOB_VMEM_SIZE);
@@ -1,4 +1,7 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 #include <vmem/vmem_client.h>
 #include <param/param.h>
 #include <param/param_client.h>
@@ -7,35 +10,236 @@
 #include "vmem_upload_local.h"
 #include "vmem_upload_param.h"
 #include "vmem_ring_buffer.h"
-#include "protobuf/metadata.pb-c.h"
+#include "downlink_codec.h"
+#include "utils/minitrace.h"
 
-/* Local ring-buffer */
-void upload(unsigned char *data, int num, int len)
+// Protobuf wire types and the fields of Metadata read and written here (see metadata.proto)
+#define WIRE_VARINT 0
+#define WIRE_FIXED64 1
+#define WIRE_LENGTH_DELIMITED 2
+#define WIRE_FIXED32 5
+#define METADATA_FIELD_SIZE 1
+#define METADATA_FIELD_CODEC 10
+#define METADATA_FIELD_ORIGINAL_SIZE 11
+// Appended to the metadata of a compressed image: size, codec and original_size, each a
+// one-byte key and a varint of at most 5 bytes
+#define COMPRESSED_FIELDS_MAX 18
+
+// Read a base-128 varint; returns the number of bytes consumed, 0 if it is truncated or overlong
+static size_t read_varint(const uint8_t *buf, size_t len, uint64_t *value)
 {
-    uint8_t node = param_get_uint8(&radio_node_id);
-    int timeout = 1000;
+    *value = 0;
+    for (size_t i = 0; i < len && i < 10; i++)
+    {
+        *value |= (uint64_t)(buf[i] & 0x7F) << (7 * i);
+        if ((buf[i] & 0x80) == 0)
+            return i + 1;
+    }
+    return 0;
+}
 
-    printf("Uploading batch size of %d bytes\n", len);
+// Write a base-128 varint; returns the number of bytes written, at most 5
+static size_t write_varint(uint8_t *buf, uint32_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80)
+    {
+        buf[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (uint8_t)value;
+    return n;
+}
 
-    uint32_t offset = 0;
-    int image_index = 0;
-    while (image_index < num && offset < len)
+// Image size of a packed Metadata message, read off the wire without unpacking it.
+// Returns -1 if the message is malformed.
+static int metadata_image_size(const uint8_t *buf, size_t len, uint32_t *size)
+{
+    *size = 0; // proto3 leaves fields with default values out
+    size_t pos = 0;
+    while (pos < len)
     {
-        uint32_t start = offset;
+        uint64_t key, value;
+        size_t n = read_varint(buf + pos, len - pos, &key);
+        if (n == 0)
+            return -1;
+        pos += n;
 
-        uint32_t meta_size = *((uint32_t *)(data + offset));
-        offset += sizeof(uint32_t); // Move the offset to the start of metadata
-        Metadata *metadata = metadata__unpack(NULL, meta_size, data + offset);
-        offset += meta_size;      // Move offset to start of image
-        offset += metadata->size; // Move the offset to the start of the next image block
+        switch (key & 7)
+        {
+        case WIRE_VARINT:
+            n = read_varint(buf + pos, len - pos, &value);
+            if (n == 0)
+                return -1;
+            pos += n;
+            if ((key >> 3) == METADATA_FIELD_SIZE)
+            {
+                if (value > INT32_MAX)
+                    return -1; // negative size
+                *size = (uint32_t)value;
+            }
+            break;
+        case WIRE_FIXED64:
+            pos += 8;
+            break;
+        case WIRE_LENGTH_DELIMITED:
+            n = read_varint(buf + pos, len - pos, &value);
+            if (n == 0 || value > len)
+                return -1;
+            pos += n + value;
+            break;
+        case WIRE_FIXED32:
+            pos += 4;
+            break;
+        default:
+            return -1;
+        }
+    }
+    return pos == len ? 0 : -1;
+}
 
-        printf("Uploading image %d: metadata size = %u, image size = %u\n",
-               image_index, meta_size, metadata->size);
+// Length of the observation (metadata size prefix, metadata and image) at offset,
+// 0 if it is malformed or does not fit in the batch
+static uint32_t observation_length(const unsigned char *data, uint32_t offset, uint32_t len)
+{
+    uint32_t meta_size;
+    if (len - offset < sizeof(meta_size))
+        return 0;
+    memcpy(&meta_size, data + offset, sizeof(meta_size));
+    if (meta_size > len - offset - sizeof(meta_size))
+        return 0;
 
-        uint32_t end = offset;
-        image_index++;
+    uint32_t image_size;
+    if (metadata_image_size(data + offset + sizeof(meta_size), meta_size, &image_size) != 0 ||
+        image_size > len - offset - sizeof(meta_size) - meta_size)
+        return 0;
+    return sizeof(meta_size) + meta_size + image_size;
+}
+
+// Downlink compression configured for the pipeline. Pipelines added through the config
+// index have no compression params and are stored as produced.
+static DownlinkCodec pipeline_codec(int pipeline_id, int *level)
+{
+    *level = 0;
+    if (pipeline_id < 1 || pipeline_id > MAX_PIPELINES)
+        return DOWNLINK_CODEC_NONE;
 
-        // vmem_ring_upload(node, timeout, "images", (char *)(data + start), end - start, 2);
-        vmem_ring_write(&vmem_images, 0, (char *)(data + start), end - start);
+    uint8_t codec = param_get_uint8_array(&downlink_codec, pipeline_id - 1);
+    if (codec >= DOWNLINK_CODEC_COUNT)
+    {
+        printf("Unknown downlink codec %u of pipeline %d, storing uncompressed\n", codec, pipeline_id);
+        return DOWNLINK_CODEC_NONE;
     }
-}
\ No newline at end of file
+    *level = param_get_uint8_array(&downlink_level, pipeline_id - 1);
+    return (DownlinkCodec)codec;
+}
+
+// Compress the image of an observation into scratch and write the observation to the ring.
+// The compressed size, codec and original size are appended to the packed metadata rather
+// than re-encoding it: a parser keeps the last value of a scalar field, so the appended
+// size replaces the original one. Returns the bytes written, 0 if the image did not shrink.
+static uint32_t write_compressed(const unsigned char *observation, uint32_t meta_size, uint32_t image_size,
+                                 DownlinkCodec codec, int level, uint8_t *scratch, size_t scratch_size)
+{
+    // the image is compressed behind room for the largest header, which then goes right before it
+    size_t header_max = sizeof(meta_size) + meta_size + COMPRESSED_FIELDS_MAX;
+    uint8_t *compressed = scratch + header_max;
+    size_t compressed_size = downlink_compress(codec, level, observation + sizeof(meta_size) + meta_size, image_size,
+                                               compressed, scratch_size - header_max);
+    if (compressed_size == 0)
+        return 0;
+
+    uint8_t fields[COMPRESSED_FIELDS_MAX];
+    size_t num_fields = 0;
+    fields[num_fields++] = METADATA_FIELD_SIZE << 3 | WIRE_VARINT;
+    num_fields += write_varint(fields + num_fields, (uint32_t)compressed_size);
+    fields[num_fields++] = METADATA_FIELD_CODEC << 3 | WIRE_VARINT;
+    num_fields += write_varint(fields + num_fields, codec);
+    fields[num_fields++] = METADATA_FIELD_ORIGINAL_SIZE << 3 | WIRE_VARINT;
+    num_fields += write_varint(fields + num_fields, image_size);
+
+    uint32_t compressed_meta_size = meta_size + num_fields;
+    uint8_t *start = compressed - compressed_meta_size - sizeof(compressed_meta_size);
+    memcpy(start, &compressed_meta_size, sizeof(compressed_meta_size));
+    memcpy(start + sizeof(compressed_meta_size), observation + sizeof(meta_size), meta_size);
+    memcpy(start + sizeof(compressed_meta_size) + meta_size, fields, num_fields);
+
+    uint32_t length = (uint32_t)(compressed + compressed_size - start);
+    vmem_ring_write(&vmem_images, 0, (char *)start, length);
+    return length;
+}
+
+/* Local ring-buffer */
+void upload(unsigned char *data, int num, int len, int pipeline_id)
+{
+    MTR_BEGIN_FUNC();
+    printf("Uploading batch size of %d bytes\n", len);
+
+    // Only the headers are read to find the image boundaries, so the image data is
+    // touched once, by the ring writes or the compression. The whole batch is checked
+    // before anything is written, so a malformed batch leaves no partial upload behind.
+    uint32_t offset = 0;
+    uint32_t largest = 0;
+    int num_images = 0;
+    while (num_images < num && offset < (uint32_t)len)
+    {
+        uint32_t observation = observation_length(data, offset, len);
+        if (observation == 0)
+        {
+            printf("Not uploading batch, image %d is malformed\n", num_images);
+            set_error_param(INTERNAL_VMEM_UPLOAD);
+            MTR_END_FUNC();
+            return;
+        }
+        if (observation > largest)
+            largest = observation;
+        offset += observation;
+        num_images++;
+    }
+
+    // one scratch buffer for the batch, large enough for any of its compressed observations
+    int level;
+    DownlinkCodec codec = pipeline_codec(pipeline_id, &level);
+    uint8_t *scratch = NULL;
+    size_t scratch_size = 0;
+    if (codec != DOWNLINK_CODEC_NONE)
+    {
+        scratch_size = COMPRESSED_FIELDS_MAX + largest + downlink_max_compressed_size(codec, largest);
+        scratch = malloc(scratch_size);
+        if (scratch == NULL)
+        {
+            printf("Could not allocate %zu bytes for compression, storing uncompressed\n", scratch_size);
+            codec = DOWNLINK_CODEC_NONE;
+        }
+    }
+
+    // every observation is a ring element of its own, the DTP server serves them by index
+    offset = 0;
+    uint32_t stored = 0;
+    for (int image_index = 0; image_index < num_images; image_index++)
+    {
+        uint32_t observation = observation_length(data, offset, len);
+        uint32_t written = 0;
+        if (codec != DOWNLINK_CODEC_NONE)
+        {
+            uint32_t meta_size;
+            memcpy(&meta_size, data + offset, sizeof(meta_size));
+            written = write_compressed(data + offset, meta_size, observation - sizeof(meta_size) - meta_size,
+                                       codec, level, scratch, scratch_size);
+        }
+        if (written == 0)
+        {
+            vmem_ring_write(&vmem_images, 0, (char *)(data + offset), observation);
+            written = observation;
+        }
+        stored += written;
+        offset += observation;
+    }
+    free(scratch);
+
+    if (codec != DOWNLINK_CODEC_NONE)
+        printf("Uploaded %d images, %u bytes (%u before %s compression)\n", num_images, stored, offset, downlink_codec_name(codec));
+    else
+        printf("Uploaded %d images, %u bytes\n", num_images, offset);
+    MTR_END_FUNC();
+}